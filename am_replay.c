@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 199309L
+#define AM_IMPLEMENTATION
+#include "amoeba.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <windows.h>
+static double now(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+}
+#else
+# include <time.h>
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+#endif
+
+static const char *opnames[AM_OP_COUNT] = {
+    "delsolver", "resetsolver", "compact", "updatevars", "autoupdate",
+    "dedup", "add", "remove", "addedit", "addedits", "suggest", "deledit",
+    "newvariable", "usevariable", "delvariable", "newconstraint",
+    "cloneconstraint", "resetconstraint", "delconstraint", "addterm",
+    "setrelation", "addconstant", "setstrength", "mergeconstraint",
+    "suggestmany", "addterms", "defer", "step", "dualpolicy",
+    "lazyvalues", "setcoefficient", "setvariablekey", "setconstraintkey",
+    "setbasis", "profile",
+};
+
+typedef struct Timing {
+    size_t count;
+    double total, max;
+} Timing;
+
+typedef struct Reader {
+    const unsigned char *p, *end;
+    int bad;
+} Reader;
+
+static unsigned getuint(Reader *r) {
+    unsigned v = 0;
+    int shift = 0;
+    while (r->p < r->end && shift < 35) {
+        unsigned char b = *r->p++;
+        v |= (unsigned)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return v;
+        shift += 7;
+    }
+    r->bad = 1;
+    return 0;
+}
+
+static am_Float getfloat(Reader *r) {
+    am_Float f = 0.0f;
+    if (r->end - r->p < (long)sizeof(f)) { r->bad = 1; return f; }
+    memcpy(&f, r->p, sizeof(f));
+    r->p += sizeof(f);
+    return f;
+}
+
+/* ids are deterministic, so the recorded ones name the same objects here */
+static am_Variable *getvar(am_Solver *solver, Reader *r) {
+    am_Symbol sym;
+    am_VarEntry *ve;
+    sym.id = getuint(r), sym.type = AM_EXTERNAL;
+    ve = (am_VarEntry*)am_gettable(&solver->vars, sym);
+    if (ve == NULL && sym.id != 0) r->bad = 2;
+    return ve ? ve->variable : NULL;
+}
+
+static am_Constraint *getcons(am_Solver *solver, Reader *r) {
+    am_Symbol key;
+    am_ConsEntry *ce;
+    key.id = getuint(r), key.type = AM_EXTERNAL;
+    ce = (am_ConsEntry*)am_gettable(&solver->constraints, key);
+    if (ce == NULL && key.id != 0) r->bad = 2;
+    return ce ? ce->constraint : NULL;
+}
+
+static unsigned char *readfile(const char *path, size_t *psize) {
+    FILE *fp = fopen(path, "rb");
+    unsigned char *data = NULL;
+    size_t size = 0, cap = 0, n;
+    if (fp == NULL) return NULL;
+    do {
+        if (size == cap) {
+            unsigned char *newdata;
+            cap = cap ? cap*2 : 65536;
+            if ((newdata = (unsigned char*)realloc(data, cap)) == NULL)
+            { free(data), fclose(fp); return NULL; }
+            data = newdata;
+        }
+        size += n = fread(data + size, 1, cap - size, fp);
+    } while (n != 0);
+    fclose(fp);
+    *psize = size;
+    return data;
+}
+
+/* recorded with am_profile(solver, 1): the constraints that cost most */
+static void report_costs(am_Solver *solver) {
+    am_Profile top[10];
+    int i, n = am_topcosts(solver, top, 10);
+    if (n == 0) return;
+    printf("\n%-16s %12s %10s %10s %10s\n",
+            "constraint", "total ms", "pivots", "rows", "entered");
+    for (i = 0; i < n && i < 10; ++i)
+        printf("%-16u %12.3f %10lu %10lu %10lu\n",
+                (unsigned)am_key(top[i].constraint).id, top[i].seconds*1e3,
+                (unsigned long)top[i].pivots,
+                (unsigned long)top[i].substitutions,
+                (unsigned long)top[i].entered);
+}
+
+static void report(am_Solver *solver, const Timing *timings, double total) {
+    am_Stats stats;
+    int i;
+    printf("%-16s %10s %12s %10s %10s\n",
+            "call", "count", "total ms", "avg us", "max us");
+    for (i = 0; i < AM_OP_COUNT; ++i) {
+        const Timing *t = &timings[i];
+        if (t->count == 0) continue;
+        printf("%-16s %10lu %12.3f %10.3f %10.3f\n", opnames[i],
+                (unsigned long)t->count, t->total*1e3,
+                t->total*1e6/t->count, t->max*1e6);
+    }
+    printf("%-16s %10s %12.3f\n", "all", "", total*1e3);
+    am_stats(solver, &stats);
+    printf("\nvars %lu, constraints %lu, rows %lu, symbols %lu\n",
+            (unsigned long)stats.vars, (unsigned long)stats.constraints,
+            (unsigned long)stats.rows, (unsigned long)stats.symbols);
+    printf("pivots %lu, dual pivots %lu\n",
+            (unsigned long)stats.pivots, (unsigned long)stats.dual_pivots);
+    report_costs(solver);
+}
+
+int main(int argc, char **argv) {
+    Timing timings[AM_OP_COUNT];
+    am_Variable **vars = NULL;
+    am_Float *values = NULL;
+    am_Hint *hints = NULL;
+    am_Solver *solver;
+    unsigned char *data;
+    size_t size, calls = 0;
+    double total = 0.0;
+    Reader r;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace\n", argv[0]);
+        return 1;
+    }
+    if ((data = readfile(argv[1], &size)) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (size < 6 || memcmp(data, "AMTR", 4) != 0
+            || data[4] != AM_TRACE_VERSION) {
+        fprintf(stderr, "%s: not an amoeba trace\n", argv[1]);
+        return 1;
+    }
+    if (data[5] != sizeof(am_Float)) {
+        fprintf(stderr, "%s: recorded with %d-byte am_Float, built with %d\n",
+                argv[1], data[5], (int)sizeof(am_Float));
+        return 1;
+    }
+
+    memset(timings, 0, sizeof(timings));
+    solver = am_newsolver(NULL, NULL);
+    r.p = data + 6, r.end = data + size, r.bad = 0;
+    while (r.p < r.end && !r.bad) {
+        int op = *r.p++;
+        am_Variable *var = NULL;
+        am_Constraint *cons = NULL, *other = NULL;
+        am_Float value = 0.0f;
+        unsigned i, n = 0;
+        double t0;
+
+        switch (op) {
+        case AM_OP_RESETSOLVER: case AM_OP_AUTOUPDATE: case AM_OP_DEDUP:
+        case AM_OP_DEFER: case AM_OP_STEP: case AM_OP_DUALPOLICY:
+        case AM_OP_LAZYVALUES: case AM_OP_PROFILE:
+            n = getuint(&r); break;
+        case AM_OP_ADD: case AM_OP_REMOVE: case AM_OP_RESETCONS:
+        case AM_OP_DELCONSTRAINT:
+            cons = getcons(solver, &r); break;
+        case AM_OP_ADDEDIT: case AM_OP_SUGGEST:
+            var = getvar(solver, &r), value = getfloat(&r); break;
+        case AM_OP_ADDEDITS:
+            value = getfloat(&r), n = getuint(&r);
+            if (r.bad || n > (unsigned)(r.end - r.p)) { r.bad = 1; break; }
+            vars = (am_Variable**)realloc(vars, sizeof(am_Variable*)*(n+1));
+            for (i = 0; i < n; ++i) vars[i] = getvar(solver, &r);
+            break;
+        case AM_OP_SUGGESTMANY:
+            n = getuint(&r);
+            if (r.bad || n > (unsigned)(r.end - r.p)) { r.bad = 1; break; }
+            vars = (am_Variable**)realloc(vars, sizeof(am_Variable*)*(n+1));
+            values = (am_Float*)realloc(values, sizeof(am_Float)*(n+1));
+            for (i = 0; i < n; ++i) vars[i] = getvar(solver, &r);
+            for (i = 0; i < n; ++i) values[i] = getfloat(&r);
+            break;
+        case AM_OP_ADDTERMS:
+            cons = getcons(solver, &r), n = getuint(&r);
+            if (r.bad || n > (unsigned)(r.end - r.p)) { r.bad = 1; break; }
+            vars = (am_Variable**)realloc(vars, sizeof(am_Variable*)*(n+1));
+            values = (am_Float*)realloc(values, sizeof(am_Float)*(n+1));
+            for (i = 0; i < n; ++i) vars[i] = getvar(solver, &r);
+            for (i = 0; i < n; ++i) values[i] = getfloat(&r);
+            break;
+        case AM_OP_DELEDIT: case AM_OP_USEVARIABLE: case AM_OP_DELVARIABLE:
+            var = getvar(solver, &r); break;
+        case AM_OP_VARKEY:
+            var = getvar(solver, &r), n = getuint(&r); break;
+        case AM_OP_CONSKEY:
+            cons = getcons(solver, &r), n = getuint(&r); break;
+        case AM_OP_SETBASIS:
+            n = getuint(&r);
+            if (r.bad || n > (unsigned)(r.end - r.p)) { r.bad = 1; break; }
+            hints = (am_Hint*)realloc(hints, sizeof(am_Hint)*(n+1));
+            for (i = 0; i < n; ++i) {
+                hints[i].key = getuint(&r);
+                hints[i].kind = (int)getuint(&r);
+            }
+            break;
+        case AM_OP_NEWVARIABLE:
+            n = getuint(&r); break;
+        case AM_OP_NEWCONSTRAINT:
+            n = getuint(&r), value = getfloat(&r); break;
+        case AM_OP_CLONE:
+            n = getuint(&r), other = getcons(solver, &r);
+            value = getfloat(&r); break;
+        case AM_OP_ADDTERM: case AM_OP_SETCOEF:
+            cons = getcons(solver, &r), var = getvar(solver, &r);
+            value = getfloat(&r); break;
+        case AM_OP_SETRELATION:
+            cons = getcons(solver, &r), n = getuint(&r); break;
+        case AM_OP_ADDCONSTANT: case AM_OP_SETSTRENGTH:
+            cons = getcons(solver, &r), value = getfloat(&r); break;
+        case AM_OP_MERGE:
+            cons = getcons(solver, &r), other = getcons(solver, &r);
+            value = getfloat(&r); break;
+        case AM_OP_END: case AM_OP_COMPACT: case AM_OP_UPDATEVARS:
+            break;
+        default:
+            r.bad = 1;
+        }
+        if (r.bad || op == AM_OP_END) break;
+
+        t0 = now();
+        switch (op) {
+        case AM_OP_RESETSOLVER:   am_resetsolver(solver, (int)n); break;
+        case AM_OP_COMPACT:       am_compact(solver); break;
+        case AM_OP_UPDATEVARS:    am_updatevars(solver); break;
+        case AM_OP_AUTOUPDATE:    am_autoupdate(solver, (int)n); break;
+        case AM_OP_DEDUP:         am_dedup(solver, (int)n); break;
+        case AM_OP_DEFER:         am_defer(solver, (int)n); break;
+        case AM_OP_STEP:          am_step(solver, (int)n); break;
+        case AM_OP_DUALPOLICY:    am_dualpolicy(solver, (int)n); break;
+        case AM_OP_LAZYVALUES:    am_lazyvalues(solver, (int)n); break;
+        case AM_OP_PROFILE:       am_profile(solver, (int)n); break;
+        case AM_OP_ADD:           am_add(cons); break;
+        case AM_OP_REMOVE:        am_remove(cons); break;
+        case AM_OP_ADDEDIT:       am_addedit(var, value); break;
+        case AM_OP_ADDEDITS:      am_addedits(vars, (int)n, value); break;
+        case AM_OP_SUGGEST:       am_suggest(var, value); break;
+        case AM_OP_SUGGESTMANY:   am_suggestmany(vars, values, (int)n); break;
+        case AM_OP_DELEDIT:       am_deledit(var); break;
+        case AM_OP_NEWVARIABLE:   var = am_newvariable(solver); break;
+        case AM_OP_USEVARIABLE:   am_usevariable(var); break;
+        case AM_OP_DELVARIABLE:   am_delvariable(var); break;
+        case AM_OP_NEWCONSTRAINT: cons = am_newconstraint(solver, value); break;
+        case AM_OP_CLONE:         cons = am_cloneconstraint(other, value); break;
+        case AM_OP_RESETCONS:     am_resetconstraint(cons); break;
+        case AM_OP_DELCONSTRAINT: am_delconstraint(cons); break;
+        case AM_OP_ADDTERM:       am_addterm(cons, var, value); break;
+        case AM_OP_ADDTERMS:      am_addterms(cons, vars, values, (int)n); break;
+        case AM_OP_SETRELATION:   am_setrelation(cons, (int)n); break;
+        case AM_OP_ADDCONSTANT:   am_addconstant(cons, value); break;
+        case AM_OP_SETSTRENGTH:   am_setstrength(cons, value); break;
+        case AM_OP_SETCOEF:       am_setcoefficient(cons, var, value); break;
+        case AM_OP_MERGE:         am_mergeconstraint(cons, other, value); break;
+        case AM_OP_VARKEY:        am_setvariablekey(var, n); break;
+        case AM_OP_CONSKEY:       am_setconstraintkey(cons, n); break;
+        case AM_OP_SETBASIS:      am_setbasis(solver, n ? hints : NULL, (int)n); break;
+        }
+        t0 = now() - t0;
+        timings[op].count += 1;
+        timings[op].total += t0;
+        if (t0 > timings[op].max) timings[op].max = t0;
+        total += t0, ++calls;
+
+        if ((op == AM_OP_NEWVARIABLE && (unsigned)am_variableid(var) != n)
+                || ((op == AM_OP_NEWCONSTRAINT || op == AM_OP_CLONE)
+                    && (cons == NULL || am_key(cons).id != n)))
+            r.bad = 2;
+    }
+    if (r.bad)
+        fprintf(stderr, "%s: %s after %lu calls\n", argv[1],
+                r.bad == 1 ? "truncated or corrupt record"
+                           : "replay diverged from recording",
+                (unsigned long)calls);
+
+    report(solver, timings, total);
+    am_delsolver(solver);
+    free(vars);
+    free(values);
+    free(hints);
+    free(data);
+    return r.bad ? 1 : 0;
+}
+
+/* cc: flags='-O2 -fno-strict-aliasing -Wall -Wextra -pedantic -std=c89' output='am_replay' */
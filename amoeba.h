@@ -42,6 +42,7 @@
 #define AM_FAILED       (-1)
 #define AM_UNSATISFIED  (-2)
 #define AM_UNBOUND      (-3)
+#define AM_OVERFLOW     (-4)
 
 #define AM_LESSEQUAL    (1)
 #define AM_EQUAL        (2)
@@ -52,6 +53,13 @@
 #define AM_MEDIUM       ((am_Float)1000)
 #define AM_WEAK         ((am_Float)1)
 
+#define AM_DUAL_LIFO    (0) /* last row made infeasible first */
+#define AM_DUAL_WORST   (1) /* most negative constant first */
+
+#define AM_HINT_VAR     (0) /* the variable is basic */
+#define AM_HINT_CONS    (1) /* the constraint's slack or error is basic */
+#define AM_HINT_EDIT    (2) /* an error of the variable's edit is basic */
+
 #include <stddef.h>
 
 
@@ -68,13 +76,90 @@ typedef struct am_Variable   am_Variable;
 typedef struct am_Constraint am_Constraint;
 
 typedef void *am_Allocf (void *ud, void *ptr, size_t nsize, size_t osize);
+typedef void  am_Writef (void *ud, const void *data, size_t size);
+
+typedef am_Variable *am_Resolver (void *ud, const char *name, size_t len);
+
+typedef struct am_Stats {
+    size_t vars;
+    size_t constraints;
+    size_t rows;
+    size_t symbols;
+    size_t pivots;      /* primal simplex iterations */
+    size_t dual_pivots; /* dual simplex iterations */
+} am_Stats;
+
+typedef struct am_Hint {
+    unsigned key;  /* of a variable or constraint, see am_setvariablekey() */
+    int      kind; /* AM_HINT_* */
+} am_Hint;
+
+typedef struct am_Profile {
+    am_Constraint *constraint;
+    size_t pivots;        /* done by its am_add() and am_remove() */
+    size_t substitutions; /* rows those pivots rewrote */
+    size_t entered;       /* pivots that made its slack or error basic */
+    double seconds;       /* spent in its am_add() and am_remove() */
+} am_Profile;
 
 AM_API am_Solver *am_newsolver   (am_Allocf *allocf, void *ud);
 AM_API void       am_resetsolver (am_Solver *solver, int clear_constraints);
 AM_API void       am_delsolver   (am_Solver *solver);
+AM_API void       am_compact     (am_Solver *solver);
+AM_API int        am_error       (am_Solver *solver);
 
 AM_API void am_updatevars(am_Solver *solver);
 AM_API void am_autoupdate(am_Solver *solver, int auto_update);
+AM_API void am_dedup(am_Solver *solver, int dedup);
+AM_API void am_defer(am_Solver *solver, int defer);
+AM_API void am_dualpolicy(am_Solver *solver, int policy);
+AM_API void am_lazyvalues(am_Solver *solver, int lazy);
+AM_API int  am_step(am_Solver *solver, int max_pivots);
+AM_API void am_stats(am_Solver *solver, am_Stats *stats);
+AM_API void am_trace(am_Solver *solver, am_Writef *writef, void *ud);
+
+/* am_updatevars() also stores changed values to values[am_variableid(var)]
+ * for ids below count, between two increments of *generation: readers in
+ * other processes retry while it is odd or changed under them.  NULL
+ * values stops publishing. */
+AM_API void am_publish(am_Solver *solver, am_Float *values, int count, unsigned *generation);
+
+/* finish the am_defer()red work of independent solvers, spread over up
+ * to threads threads if built with AM_USE_THREADS; status[i] (if not
+ * NULL) gets AM_OK or the error of solvers[i], the first error is
+ * returned.  A solver must not be in the batch twice. */
+AM_API int am_solveall(am_Solver **solvers, int count, int threads, int *status);
+
+/* warm start: keys (nonzero, below 2^30) name variables and constraints
+ * stably across solvers.  am_getbasis() lists the basic ones of a solved
+ * tableau into hints[count] and returns how many there are; after
+ * am_setbasis() new rows pick hinted symbols as subjects, so a similar
+ * layout built in a fresh solver needs few pivots.  NULL clears them. */
+AM_API void am_setvariablekey   (am_Variable *var, unsigned key);
+AM_API void am_setconstraintkey (am_Constraint *cons, unsigned key);
+AM_API int  am_getbasis (am_Solver *solver, am_Hint *hints, int count);
+AM_API int  am_setbasis (am_Solver *solver, const am_Hint *hints, int count);
+
+/* cost attribution: while profiling, constraints added or removed are
+ * charged for the work of that call, and for every later pivot that brings
+ * their slack or error into the basis.  am_topcosts() copies up to count
+ * records, most pivots (then rows, then seconds) first, and returns how
+ * many constraints have one.  Disabling drops the records; edits are not
+ * charged. */
+AM_API void am_profile  (am_Solver *solver, int enable);
+AM_API int  am_topcosts (am_Solver *solver, am_Profile *profiles, int count);
+
+/* nested solvers: a container's solver is nested under its parent's, and
+ * am_link() feeds the value of from as an edit of to, one level up or
+ * down.  am_propagate() pushes the changed values of solver up while they
+ * change the parent, then down from there into the children they change,
+ * and returns how many it pushed.  Values coming back up wait for the
+ * next am_propagate(); deferred solvers need am_step() in between.
+ * Detaching (NULL parent, or deleting either solver) drops their links. */
+AM_API int  am_nest      (am_Solver *child, am_Solver *parent);
+AM_API int  am_link      (am_Variable *from, am_Variable *to, am_Float strength);
+AM_API void am_unlink    (am_Variable *from, am_Variable *to);
+AM_API int  am_propagate (am_Solver *solver);
 
 AM_API int am_hasedit       (am_Variable *var);
 AM_API int am_hasconstraint (am_Constraint *cons);
@@ -82,9 +167,11 @@ AM_API int am_hasconstraint (am_Constraint *cons);
 AM_API int  am_add    (am_Constraint *cons);
 AM_API void am_remove (am_Constraint *cons);
 
-AM_API int  am_addedit (am_Variable *var, am_Float strength);
-AM_API void am_suggest (am_Variable *var, am_Float value);
-AM_API void am_deledit (am_Variable *var);
+AM_API int  am_addedit  (am_Variable *var, am_Float strength);
+AM_API int  am_addedits (am_Variable **vars, int count, am_Float strength);
+AM_API void am_suggest  (am_Variable *var, am_Float value);
+AM_API void am_suggestmany (am_Variable **vars, const am_Float *values, int count);
+AM_API void am_deledit  (am_Variable *var);
 
 AM_API am_Variable *am_newvariable (am_Solver *solver);
 AM_API void         am_usevariable (am_Variable *var);
@@ -99,12 +186,32 @@ AM_API void am_resetconstraint (am_Constraint *cons);
 AM_API void am_delconstraint   (am_Constraint *cons);
 
 AM_API int am_addterm     (am_Constraint *cons, am_Variable *var, am_Float multiplier);
+AM_API int am_addterms    (am_Constraint *cons, am_Variable **vars, const am_Float *multipliers, int count);
 AM_API int am_setrelation (am_Constraint *cons, int relation);
 AM_API int am_addconstant (am_Constraint *cons, am_Float constant);
 AM_API int am_setstrength (am_Constraint *cons, am_Float strength);
 
 AM_API int am_mergeconstraint (am_Constraint *cons, am_Constraint *other, am_Float multiplier);
 
+/* set var's multiplier, read as am_addterm() would now; an added
+ * constraint is updated in place when the tableau allows */
+AM_API int am_setcoefficient (am_Constraint *cons, am_Variable *var, am_Float multiplier);
+
+AM_API int am_parse (am_Solver *solver, const char *text, am_Resolver *resolver, void *ud, const char **errpos);
+
+/* the constraints the last am_parse() made (none if it failed) that are
+ * not deleted yet, in text order: copies up to count, returns how many */
+AM_API int am_parsed (am_Solver *solver, am_Constraint **conss, int count);
+
+#ifdef AM_STATIC_CAPACITY
+/* fixed-capacity build: the solver keeps all its storage inline and never
+ * calls allocf except for the am_Solver itself in am_newsolver().  Running
+ * out of AM_STATIC_CAPACITY variables, AM_STATIC_ROWS rows or
+ * AM_STATIC_HEAP bytes returns AM_OVERFLOW (or NULL) and leaves
+ * am_error() set: only deletions work until am_resetsolver(solver, 1). */
+AM_API am_Solver *am_initsolver (am_Solver *solver);
+#endif
+
 AM_NS_END
 
 
@@ -117,14 +224,105 @@ AM_NS_END
 
 #include <assert.h>
 #include <float.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef AM_STATIC_CAPACITY /* max variables; the solver needs no heap */
+# include <setjmp.h>
+# ifndef AM_STATIC_ROWS
+#   define AM_STATIC_ROWS   (AM_STATIC_CAPACITY*2) /* constraints and edits */
+# endif
+# ifndef AM_STATIC_TERMS
+#   define AM_STATIC_TERMS  16 /* terms per row */
+# endif
+# ifndef AM_STATIC_HEAP /* bytes for pools, tables and rows */
+#   define AM_STATIC_HEAP   (AM_POOLSIZE*8 + AM_STATIC_CAPACITY*256 \
+                            + AM_STATIC_ROWS*(512 + AM_STATIC_TERMS*96))
+# endif
+#endif /* AM_STATIC_CAPACITY */
+
+#ifdef AM_USE_OPENHASH /* open addressing tables, probed a group at a time */
+# if defined(__SSE2__) || defined(_M_X64) \
+        || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define AM_GROUP_SSE2
+#   define AM_GROUP     16
+# else
+#   define AM_GROUP     sizeof(size_t) /* SWAR over a machine word */
+# endif
+#endif /* AM_USE_OPENHASH */
+
+#ifdef AM_USE_THREADS
+# ifdef _WIN32
+#   include <windows.h>
+# else
+#   include <pthread.h>
+# endif
+# ifndef AM_MAX_THREADS
+#   define AM_MAX_THREADS 64
+# endif
+#endif /* AM_USE_THREADS */
+
+#ifdef AM_USE_SDT /* USDT probes amoeba:*, e.g. bpftrace -l 'usdt:./a.out:*' */
+# include <sys/sdt.h>
+# define am_sdt1(n,a)         DTRACE_PROBE1(amoeba, n, a)
+# define am_sdt2(n,a,b)       DTRACE_PROBE2(amoeba, n, a, b)
+# define am_sdt3(n,a,b,c)     DTRACE_PROBE3(amoeba, n, a, b, c)
+# define am_sdt4(n,a,b,c,d)   DTRACE_PROBE4(amoeba, n, a, b, c, d)
+#else /* arguments stay used, for locals kept only for a probe */
+# define am_sdt1(n,a)         ((void)0)
+# define am_sdt2(n,a,b)       ((void)(b))
+# define am_sdt3(n,a,b,c)     ((void)(b), (void)(c))
+# define am_sdt4(n,a,b,c,d)   ((void)(b), (void)(c), (void)(d))
+#endif /* AM_USE_SDT */
+
 #define AM_EXTERNAL     (0)
 #define AM_SLACK        (1)
 #define AM_ERROR        (2)
 #define AM_DUMMY        (3)
 
+/* trace stream: "AMTR", version, sizeof(am_Float), then one record per
+ * call: opcode byte, ids as LEB128 varints, am_Float values raw */
+#define AM_TRACE_VERSION 1
+
+#define AM_OP_END           0   /* am_delsolver */
+#define AM_OP_RESETSOLVER   1   /* clear */
+#define AM_OP_COMPACT       2
+#define AM_OP_UPDATEVARS    3
+#define AM_OP_AUTOUPDATE    4   /* flag */
+#define AM_OP_DEDUP         5   /* flag */
+#define AM_OP_ADD           6   /* cons */
+#define AM_OP_REMOVE        7   /* cons */
+#define AM_OP_ADDEDIT       8   /* var strength */
+#define AM_OP_ADDEDITS      9   /* strength count var... */
+#define AM_OP_SUGGEST       10  /* var value */
+#define AM_OP_DELEDIT       11  /* var */
+#define AM_OP_NEWVARIABLE   12  /* var */
+#define AM_OP_USEVARIABLE   13  /* var */
+#define AM_OP_DELVARIABLE   14  /* var */
+#define AM_OP_NEWCONSTRAINT 15  /* cons strength */
+#define AM_OP_CLONE         16  /* cons other strength */
+#define AM_OP_RESETCONS     17  /* cons */
+#define AM_OP_DELCONSTRAINT 18  /* cons */
+#define AM_OP_ADDTERM       19  /* cons var multiplier */
+#define AM_OP_SETRELATION   20  /* cons relation */
+#define AM_OP_ADDCONSTANT   21  /* cons constant */
+#define AM_OP_SETSTRENGTH   22  /* cons strength */
+#define AM_OP_MERGE         23  /* cons other multiplier */
+#define AM_OP_SUGGESTMANY   24  /* count var... value... */
+#define AM_OP_ADDTERMS      25  /* cons count var... multiplier... */
+#define AM_OP_DEFER         26  /* flag */
+#define AM_OP_STEP          27  /* max_pivots */
+#define AM_OP_DUALPOLICY    28  /* policy */
+#define AM_OP_LAZYVALUES    29  /* flag */
+#define AM_OP_SETCOEF       30  /* cons var multiplier */
+#define AM_OP_VARKEY        31  /* var key */
+#define AM_OP_CONSKEY       32  /* cons key */
+#define AM_OP_SETBASIS      33  /* count (key kind)... */
+#define AM_OP_PROFILE       34  /* flag */
+#define AM_OP_COUNT         35
+
 #define am_isexternal(key)   ((key).type == AM_EXTERNAL)
 #define am_isslack(key)      ((key).type == AM_SLACK)
 #define am_iserror(key)      ((key).type == AM_ERROR)
@@ -132,7 +330,29 @@ AM_NS_END
 #define am_ispivotable(key)  (am_isslack(key) || am_iserror(key))
 
 #define AM_POOLSIZE     4096
+#define AM_ARENASIZE    AM_POOLSIZE
+#ifdef AM_STATIC_CAPACITY /* equal chunks reuse each other */
+# define AM_MAX_ARENASIZE AM_ARENASIZE
+#else
+# define AM_MAX_ARENASIZE (AM_ARENASIZE*64)
+#endif
+#define AM_ARENACLASSES 32
 #define AM_MIN_HASHSIZE 4
+#ifndef AM_DENSE_MAX /* dense tableau while symbol ids stay below, 0: never */
+# define AM_DENSE_MAX   128
+#endif
+#define AM_TRACEBUF     64
+#ifndef am_fence /* orders published values against their generation */
+# ifdef __GNUC__
+#   define am_fence()   __sync_synchronize()
+# else
+#   define am_fence()   ((void)0)
+# endif
+#endif
+#ifndef am_clock /* seconds, for am_profile() */
+# include <time.h>
+# define am_clock()     ((double)clock() / CLOCKS_PER_SEC)
+#endif
 #define AM_MAX_SIZET    ((~(size_t)0)-100)
 
 #ifdef AM_USE_FLOAT
@@ -156,8 +376,28 @@ typedef struct am_MemPool {
     void  *pages;
 } am_MemPool;
 
+typedef union am_Align {
+    void    *p;
+    size_t   s;
+    am_Float f;
+} am_Align;
+
+typedef struct am_Chunk {
+    struct am_Chunk *next;
+    size_t           size;
+} am_Chunk;
+
+typedef struct am_Arena {
+    am_Chunk *chunks;
+    am_Chunk *current; /* chunk being carved */
+    size_t    used;    /* bytes carved from current chunk */
+    void     *freed[AM_ARENACLASSES]; /* power-of-two size classes */
+} am_Arena;
+
 typedef struct am_Entry {
+#ifndef AM_USE_OPENHASH
     int       next;
+#endif
     am_Symbol key;
 } am_Entry;
 
@@ -165,8 +405,12 @@ typedef struct am_Table {
     size_t    size;
     size_t    count;
     size_t    entry_size;
-    size_t    lastfree;
+    size_t    lastfree; /* AM_USE_OPENHASH: inserts left before a rehash */
     am_Entry *hash;
+#ifdef AM_USE_OPENHASH
+    unsigned char *ctrl; /* per slot: empty, deleted or 7 bits of hash */
+#endif
+    am_Arena *arena;    /* storage of hash, NULL for allocf */
 } am_Table;
 
 typedef struct am_VarEntry {
@@ -179,6 +423,21 @@ typedef struct am_ConsEntry {
     am_Constraint *constraint;
 } am_ConsEntry;
 
+typedef struct am_SymEntry {
+    am_Entry  entry;
+    am_Symbol sym;
+} am_SymEntry;
+
+typedef struct am_HintEntry {
+    am_Entry entry;
+    unsigned kinds; /* 1 << AM_HINT_* */
+} am_HintEntry;
+
+typedef struct am_CostEntry {
+    am_Entry   entry;
+    am_Profile profile;
+} am_CostEntry;
+
 typedef struct am_Term {
     am_Entry entry;
     am_Float multiplier;
@@ -188,9 +447,24 @@ typedef struct am_Row {
     am_Entry  entry;
     am_Symbol infeasible_next;
     am_Table  terms;
+    am_Float *dense;    /* AM_DENSE_MAX multipliers by symbol id, or NULL */
     am_Float  constant;
 } am_Row;
 
+typedef struct am_Link {
+    struct am_Link *next;
+    am_Variable *from;  /* in the solver holding the link */
+    am_Variable *to;    /* edited, in its parent or a child */
+    am_Float     value; /* last pushed */
+    am_Float     strength;
+    int          up;
+} am_Link;
+
+typedef struct am_Infeasible {
+    am_Symbol row;
+    am_Float  constant; /* when pushed, may be stale */
+} am_Infeasible;
+
 struct am_Variable {
     am_Symbol      sym;
     am_Symbol      dirty_next;
@@ -199,6 +473,9 @@ struct am_Variable {
     am_Constraint *constraint;
     am_Float       edit_value;
     am_Float       value;
+    unsigned       epoch;  /* of value, with lazy values */
+    int            placed; /* has been in a row, see am_place() */
+    unsigned       key;    /* caller's, for basis hints */
 };
 
 struct am_Constraint {
@@ -208,6 +485,9 @@ struct am_Constraint {
     int        relation;
     am_Solver *solver;
     am_Float   strength;
+    am_Constraint *shared; /* ring of constraints sharing this row */
+    unsigned   hash;       /* key in solver->shared, 0 if not deduplicated */
+    unsigned   key;        /* caller's, for basis hints; edits: the var's */
 };
 
 struct am_Solver {
@@ -217,19 +497,93 @@ struct am_Solver {
     am_Table   vars;            /* symbol -> VarEntry */
     am_Table   constraints;     /* symbol -> ConsEntry */
     am_Table   rows;            /* symbol -> Row */
+    am_Table   shared;          /* constraint hash -> ConsEntry */
+    am_Table   hints;           /* am_setbasis(): key -> HintEntry */
+    am_Table   hinted;          /* markers of hinted constraints -> Entry */
+    am_Table   costs;           /* am_profile(): cons symbol -> CostEntry */
+    am_Table   costsyms;        /* their markers -> SymEntry of the cons */
+    am_Constraint *blame;       /* whose am_add()/am_remove() is running */
+    unsigned   profiling;
     am_MemPool varpool;
     am_MemPool conspool;
+    am_MemPool linkpool;
+    am_Solver *parent;          /* am_nest() */
+    am_Solver *children;
+    am_Solver *sibling;         /* next child of parent */
+    am_Link   *links;           /* from our variables */
+    unsigned   stale;           /* got new values pushed down */
+    am_Arena   arena;           /* term storage of tableau rows */
+    unsigned   dense;           /* tableau rows are am_Row.dense arrays */
+    unsigned char dense_types[AM_DENSE_MAX + 1]; /* symbol id -> type */
     unsigned   symbol_count;
     unsigned   constraint_count;
+    unsigned   parsed_first;    /* ids of the last am_parse() */
+    unsigned   parsed_last;
     unsigned   auto_update;
+    unsigned   dedup;
+    unsigned   defer;
+    unsigned   lazy_values;
+    unsigned   epoch;           /* bumped by every change of a value */
+    unsigned   unoptimized;     /* primal pivots left for am_step() */
+    size_t     budget;          /* pivots am_step() may still do */
     am_Symbol  infeasible_rows;
+    unsigned   dual_policy;
+    am_Infeasible *dual_heap;   /* AM_DUAL_WORST: min-heap on constant */
+    size_t     dual_count;
+    size_t     dual_size;
     am_Symbol  dirty_vars;
+    size_t     pivots;
+    size_t     dual_pivots;
+    am_Writef *tracef;
+    void      *trace_ud;
+    volatile am_Float *published; /* am_publish() slots, by variable id */
+    volatile unsigned *generation;
+    unsigned   published_count;
+    unsigned   republish;       /* ids moved or slots new: store them all */
+#ifdef AM_STATIC_CAPACITY
+    int        error;           /* sticky AM_OVERFLOW */
+    jmp_buf   *jmp;             /* innermost am_try() */
+    am_Allocf *owner;           /* allocf of the solver itself, if any */
+    void      *owner_ud;
+    size_t     heap_used;
+    void      *heap_freed[AM_ARENACLASSES];
+    am_Align   heap[AM_STATIC_HEAP/sizeof(am_Align)];
+#endif
 };
 
+/* am_try(S) { work } am_catch(S) { on error } am_end;
+ * work runs unless S is in sticky error; if it overflows the solver turns
+ * sticky and the catch block runs, as it does when work did not run.  Do
+ * not return from work, and make volatile the locals it changes that are
+ * read after it. */
+#ifdef AM_STATIC_CAPACITY
+# define am_try(S) do {                      \
+    jmp_buf *volatile am_oldjmp = (S)->jmp;  \
+    jmp_buf am_jmp;                          \
+    if ((S)->error == AM_OK) {               \
+        (S)->jmp = &am_jmp;                  \
+        if (setjmp(am_jmp) == 0)
+# define am_catch(S)                         \
+        else (S)->error = AM_OVERFLOW;       \
+        (S)->jmp = am_oldjmp;                \
+    }                                        \
+    if ((S)->error != AM_OK)
+# define am_end } while (0)
+#else
+# define am_try(S)   do { if (1)
+# define am_catch(S) if (0)
+# define am_end      } while (0)
+#endif
+
 
 /* utils */
 
 static am_Symbol am_newsymbol(am_Solver *solver, int type);
+static void am_remove_constraint(am_Constraint *cons);
+static void am_remove_edit(am_Variable *var);
+static void am_delete_edit(am_Variable *var);
+static void am_update_vars(am_Solver *solver);
+static void am_markdirty(am_Solver *solver, am_Variable *var);
 
 static int am_approx(am_Float a, am_Float b)
 { return a > b ? a - b < AM_FLOAT_EPS : b - a < AM_FLOAT_EPS; }
@@ -283,6 +637,97 @@ static void am_free(am_MemPool *pool, void *obj) {
     pool->freed = obj;
 }
 
+#define AM_CHUNKHEAD \
+    ((sizeof(am_Chunk)+sizeof(am_Align)-1)/sizeof(am_Align)*sizeof(am_Align))
+
+static void am_initarena(am_Arena *arena)
+{ memset(arena, 0, sizeof(*arena)); }
+
+static void am_freearena(am_Solver *solver, am_Arena *arena) {
+    while (arena->chunks != NULL) {
+        am_Chunk *next = arena->chunks->next;
+        solver->allocf(solver->ud, arena->chunks, 0, arena->chunks->size);
+        arena->chunks = next;
+    }
+    am_initarena(arena);
+}
+
+static void am_rewindarena(am_Arena *arena) {
+    memset(arena->freed, 0, sizeof(arena->freed));
+    arena->current = arena->chunks;
+    arena->used    = AM_CHUNKHEAD;
+}
+
+static int am_sizeclass(size_t size) {
+    int k = 4; /* 16 bytes at least */
+    while (((size_t)1 << k) < size) ++k;
+    assert(k < AM_ARENACLASSES);
+    return k;
+}
+
+static void *am_arenaalloc(am_Solver *solver, am_Arena *arena, size_t size) {
+    int k = am_sizeclass(size);
+    size_t bsize = (size_t)1 << k;
+    void *obj;
+    if ((obj = arena->freed[k]) != NULL) {
+        arena->freed[k] = *(void**)obj;
+        return obj;
+    }
+    while (arena->current == NULL || arena->used + bsize > arena->current->size) {
+        am_Chunk *c = arena->current;
+        if (c == NULL || c->next == NULL) {
+            size_t csize = c == NULL ? AM_ARENASIZE :
+                c->size < AM_MAX_ARENASIZE ? c->size*2 : c->size;
+            while (csize < AM_CHUNKHEAD + bsize) csize *= 2;
+            c = (am_Chunk*)solver->allocf(solver->ud, NULL, csize, 0);
+            c->next = NULL, c->size = csize;
+            if (arena->current) arena->current->next = c;
+            else arena->chunks = c;
+        }
+        else c = c->next;
+        arena->current = c;
+        arena->used    = AM_CHUNKHEAD;
+    }
+    obj = (char*)arena->current + arena->used;
+    arena->used += bsize;
+    return obj;
+}
+
+static void am_arenafree(am_Arena *arena, void *obj, size_t size) {
+    int k = am_sizeclass(size);
+    *(void**)obj = arena->freed[k];
+    arena->freed[k] = obj;
+}
+
+#ifdef AM_STATIC_CAPACITY
+static void am_overflow(am_Solver *solver) {
+    solver->error = AM_OVERFLOW;
+    assert(solver->jmp != NULL); /* only calls in am_try() allocate */
+    longjmp(*solver->jmp, 1);
+}
+
+static void *am_static_allocf(void *ud, void *ptr, size_t nsize, size_t osize) {
+    am_Solver *solver = (am_Solver*)ud;
+    int k;
+    if (ptr != NULL) { /* callers never resize in place */
+        k = am_sizeclass(osize);
+        *(void**)ptr = solver->heap_freed[k];
+        solver->heap_freed[k] = ptr;
+    }
+    if (nsize == 0) return NULL;
+    k = am_sizeclass(nsize);
+    if ((ptr = solver->heap_freed[k]) != NULL) {
+        solver->heap_freed[k] = *(void**)ptr;
+        return ptr;
+    }
+    if (((size_t)1 << k) > sizeof(solver->heap) - solver->heap_used)
+        am_overflow(solver);
+    ptr = (char*)solver->heap + solver->heap_used;
+    solver->heap_used += (size_t)1 << k;
+    return ptr;
+}
+#endif /* AM_STATIC_CAPACITY */
+
 static am_Symbol am_newsymbol(am_Solver *solver, int type) {
     am_Symbol sym;
     unsigned id = ++solver->symbol_count;
@@ -303,18 +748,9 @@ static am_Symbol am_newsymbol(am_Solver *solver, int type) {
 
 static am_Entry *am_newkey(am_Solver *solver, am_Table *t, am_Symbol key);
 
-static void am_delkey(am_Table *t, am_Entry *entry)
-{ entry->key = am_null(), --t->count; }
-
 static void am_inittable(am_Table *t, size_t entry_size)
 { memset(t, 0, sizeof(*t)), t->entry_size = entry_size; }
 
-static am_Entry *am_mainposition(const am_Table *t, am_Symbol key)
-{ return am_index(t->hash, (key.id & (t->size - 1))*t->entry_size); }
-
-static void am_resettable(am_Table *t)
-{ t->count = 0; memset(t->hash, 0, t->lastfree = t->size * t->entry_size); }
-
 static size_t am_hashsize(am_Table *t, size_t len) {
     size_t newsize = AM_MIN_HASHSIZE;
     const size_t max_size = (AM_MAX_SIZET / 2) / t->entry_size;
@@ -324,32 +760,39 @@ static size_t am_hashsize(am_Table *t, size_t len) {
     return newsize < len ? 0 : newsize;
 }
 
-static void am_freetable(am_Solver *solver, am_Table *t) {
-    size_t size = t->size*t->entry_size;
-    if (size) solver->allocf(solver->ud, t->hash, 0, size);
-    am_inittable(t, t->entry_size);
+static void *am_tablealloc(am_Solver *solver, am_Table *t, size_t size) {
+    if (t->arena) return am_arenaalloc(solver, t->arena, size);
+    return solver->allocf(solver->ud, NULL, size, 0);
 }
 
-static size_t am_resizetable(am_Solver *solver, am_Table *t, size_t len) {
-    size_t i, oldsize = t->size * t->entry_size;
-    am_Table nt = *t;
-    nt.size = am_hashsize(t, len);
-    nt.lastfree = nt.size*nt.entry_size;
-    nt.hash = (am_Entry*)solver->allocf(solver->ud, NULL, nt.lastfree, 0);
-    memset(nt.hash, 0, nt.size*nt.entry_size);
-    for (i = 0; i < oldsize; i += nt.entry_size) {
-        am_Entry *e = am_index(t->hash, i);
-        if (e->key.id != 0) {
-            am_Entry *ne = am_newkey(solver, &nt, e->key);
-            if (t->entry_size > sizeof(am_Entry))
-                memcpy(ne + 1, e + 1, t->entry_size-sizeof(am_Entry));
-        }
-    }
-    if (oldsize) solver->allocf(solver->ud, t->hash, 0, oldsize);
-    *t = nt;
-    return t->size;
+static void am_tablefree(am_Solver *solver, am_Table *t, void *hash, size_t size) {
+    if (t->arena) am_arenafree(t->arena, hash, size);
+    else solver->allocf(solver->ud, hash, 0, size);
 }
 
+#ifndef AM_USE_OPENHASH
+
+static void am_delkey(am_Table *t, am_Entry *entry)
+{ entry->key = am_null(), --t->count; }
+
+static am_Entry *am_mainposition(const am_Table *t, am_Symbol key)
+{ return am_index(t->hash, (key.id & (t->size - 1))*t->entry_size); }
+
+static void am_resettable(am_Table *t)
+{ t->count = 0; memset(t->hash, 0, t->lastfree = t->size * t->entry_size); }
+
+static void am_allochash(am_Solver *solver, am_Table *t, size_t size) {
+    t->size = size;
+    t->lastfree = size*t->entry_size;
+    t->hash = (am_Entry*)am_tablealloc(solver, t, t->lastfree);
+    memset(t->hash, 0, t->lastfree);
+}
+
+static void am_freehash(am_Solver *solver, am_Table *t)
+{ am_tablefree(solver, t, t->hash, t->size*t->entry_size); }
+
+static size_t am_resizetable(am_Solver *solver, am_Table *t, size_t len);
+
 static am_Entry *am_newkey(am_Solver *solver, am_Table *t, am_Symbol key) {
     if (t->size == 0) am_resizetable(solver, t, AM_MIN_HASHSIZE);
     for (;;) {
@@ -391,6 +834,168 @@ static const am_Entry *am_gettable(const am_Table *t, am_Symbol key) {
     return e;
 }
 
+#else /* AM_USE_OPENHASH */
+
+#define AM_CTRL_EMPTY   0x80
+#define AM_CTRL_DELETED 0xFE
+#define AM_CTRL_PAD     0xFF /* past the end of a table smaller than a group */
+
+#define am_groups(t)    (((t)->size + AM_GROUP - 1) / AM_GROUP)
+#define am_slot(t, i)   am_index((t)->hash, (i)*(t)->entry_size)
+#define am_group(id)    ((id) / AM_GROUP)  /* consecutive ids share a group */
+#define am_tag(id)      ((int)(id) & 0x7F) /* and differ in their low bits */
+
+/* bit i set if byte i of the group is c */
+#ifdef AM_GROUP_SSE2
+static unsigned am_match(const unsigned char *group, int c) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes,
+                _mm_set1_epi8((char)c)));
+}
+
+#else
+static unsigned am_match(const unsigned char *group, int c) {
+    const size_t ones = ~(size_t)0 / 0xFF;
+    size_t word, x;
+    unsigned i, mask = 0;
+    memcpy(&word, group, sizeof(word));
+    x = word ^ (ones * (size_t)c);
+    if (((x - ones) & ~x & (ones << 7)) == 0) return 0; /* no zero byte */
+    for (i = 0; i < AM_GROUP; ++i)
+        mask |= (unsigned)(group[i] == c) << i;
+    return mask;
+}
+
+#endif
+
+static unsigned am_ctz(unsigned mask) {
+#ifdef __GNUC__
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned i = 0;
+    for (; (mask & 1) == 0; mask >>= 1) ++i;
+    return i;
+#endif
+}
+
+static size_t am_ctrlsize(size_t size)
+{ return size < AM_GROUP ? AM_GROUP : size; }
+
+static void am_clearhash(am_Table *t) {
+    t->lastfree = t->size - t->size/8;
+    memset(t->hash, 0, t->size*t->entry_size);
+    memset(t->ctrl, AM_CTRL_EMPTY, t->size);
+    memset(t->ctrl + t->size, AM_CTRL_PAD, am_ctrlsize(t->size) - t->size);
+}
+
+static void am_delkey(am_Table *t, am_Entry *entry) {
+    size_t i = (size_t)am_offset(entry, t->hash) / t->entry_size;
+    entry->key = am_null(), --t->count;
+    /* a group with an empty slot never filled up, so no probe passed it */
+    if (am_match(t->ctrl + i/AM_GROUP*AM_GROUP, AM_CTRL_EMPTY))
+        t->ctrl[i] = AM_CTRL_EMPTY, ++t->lastfree;
+    else t->ctrl[i] = AM_CTRL_DELETED;
+}
+
+static void am_resettable(am_Table *t)
+{ t->count = 0; am_clearhash(t); }
+
+static void am_allochash(am_Solver *solver, am_Table *t, size_t size) {
+    t->size = size;
+    t->hash = (am_Entry*)am_tablealloc(solver, t, size*t->entry_size);
+    t->ctrl = (unsigned char*)am_tablealloc(solver, t, am_ctrlsize(size));
+    am_clearhash(t);
+}
+
+static void am_freehash(am_Solver *solver, am_Table *t) {
+    am_tablefree(solver, t, t->hash, t->size*t->entry_size);
+    am_tablefree(solver, t, t->ctrl, am_ctrlsize(t->size));
+}
+
+static size_t am_resizetable(am_Solver *solver, am_Table *t, size_t len);
+
+static am_Entry *am_newkey(am_Solver *solver, am_Table *t, am_Symbol key) {
+    if (t->size == 0) am_resizetable(solver, t, AM_MIN_HASHSIZE);
+    for (;;) {
+        size_t g, step, mask = am_groups(t) - 1;
+        g = am_group(key.id) & mask;
+        for (step = 0; step <= mask; g = (g + ++step) & mask) {
+            const unsigned char *group = t->ctrl + g*AM_GROUP;
+            unsigned m = am_match(group, AM_CTRL_EMPTY)
+                       | am_match(group, AM_CTRL_DELETED);
+            size_t i = g*AM_GROUP + (m ? am_ctz(m) : 0);
+            am_Entry *e;
+            if (m == 0) continue;
+            if (t->ctrl[i] == AM_CTRL_EMPTY) {
+                if (t->lastfree == 0) break; /* rehash instead */
+                --t->lastfree;
+            }
+            t->ctrl[i] = (unsigned char)am_tag(key.id);
+            e = am_slot(t, i);
+            e->key = key;
+            return e;
+        }
+        /* mostly deleted slots: rehash in place, else grow */
+        am_resizetable(solver, t, t->count*2 < t->size ? t->size : t->count*2);
+    }
+}
+
+static const am_Entry *am_findslot(const am_Table *t, am_Symbol key, size_t g) {
+    unsigned m = am_match(t->ctrl + g*AM_GROUP, am_tag(key.id));
+    for (; m != 0; m &= m - 1) {
+        const am_Entry *e = am_slot(t, g*AM_GROUP + am_ctz(m));
+        if (e->key.id == key.id) return e;
+    }
+    return NULL;
+}
+
+static const am_Entry *am_probe(const am_Table *t, am_Symbol key, size_t g) {
+    size_t step, mask = am_groups(t) - 1;
+    for (step = 1; step <= mask; ++step) {
+        const am_Entry *e = am_findslot(t, key, g = (g + step) & mask);
+        if (e || am_match(t->ctrl + g*AM_GROUP, AM_CTRL_EMPTY)) return e;
+    }
+    return NULL;
+}
+
+static const am_Entry *am_gettable(const am_Table *t, am_Symbol key) {
+    const am_Entry *e;
+    size_t g;
+    if (t->size == 0 || key.id == 0) return NULL;
+    g = am_group(key.id) & (am_groups(t) - 1);
+    if ((e = am_findslot(t, key, g)) != NULL) return e;
+    /* a group with an empty slot ends the probe sequence */
+    return am_match(t->ctrl + g*AM_GROUP, AM_CTRL_EMPTY) ? NULL
+        : am_probe(t, key, g);
+}
+
+#endif /* AM_USE_OPENHASH */
+
+static void am_freetable(am_Solver *solver, am_Table *t) {
+    am_Arena *arena = t->arena;
+    if (t->size) am_freehash(solver, t);
+    am_inittable(t, t->entry_size);
+    t->arena = arena;
+}
+
+static size_t am_resizetable(am_Solver *solver, am_Table *t, size_t len) {
+    size_t i, oldsize = t->size * t->entry_size;
+    am_Table nt = *t;
+    am_allochash(solver, &nt, am_hashsize(t, len));
+    for (i = 0; i < oldsize; i += nt.entry_size) {
+        am_Entry *e = am_index(t->hash, i);
+        if (e->key.id != 0) {
+            am_Entry *ne = am_newkey(solver, &nt, e->key);
+            if (t->entry_size > sizeof(am_Entry))
+                memcpy(ne + 1, e + 1, t->entry_size-sizeof(am_Entry));
+        }
+    }
+    if (oldsize) am_freehash(solver, t);
+    am_sdt4(table__resize, solver, t, t->size, nt.size);
+    *t = nt;
+    return t->size;
+}
+
 static am_Entry *am_settable(am_Solver *solver, am_Table *t, am_Symbol key) {
     am_Entry *e;
     assert(key.id != 0);
@@ -402,6 +1007,11 @@ static am_Entry *am_settable(am_Solver *solver, am_Table *t, am_Symbol key) {
     return e;
 }
 
+static void am_forget(am_Table *t, am_Symbol key) {
+    am_Entry *e = key.id ? (am_Entry*)am_gettable(t, key) : NULL;
+    if (e) am_delkey(t, e);
+}
+
 static int am_nextentry(const am_Table *t, am_Entry **pentry) {
     size_t i = *pentry ? am_offset(*pentry, t->hash) + t->entry_size : 0;
     size_t size = t->size*t->entry_size;
@@ -416,11 +1026,30 @@ static int am_nextentry(const am_Table *t, am_Entry **pentry) {
 
 /* expression (row) */
 
-static int am_isconstant(am_Row *row)
-{ return row->terms.count == 0; }
+#define AM_DENSESIZE (sizeof(am_Float)*AM_DENSE_MAX)
+
+typedef struct am_Iter {
+    const am_Row        *row;
+    const unsigned char *types;
+    const am_Term *term, *end; /* position in a hashed row */
+    unsigned  i, n;            /* position in a dense row */
+    am_Symbol key;      /* null after the last term */
+    am_Float  multiplier;
+} am_Iter;
+
+static int am_isconstant(am_Row *row) {
+    unsigned i;
+    if (row->dense == NULL) return row->terms.count == 0;
+    for (i = AM_DENSE_MAX; i > 0; --i)
+        if (row->dense[i-1] != 0.0f) return 0;
+    return 1;
+}
 
-static void am_freerow(am_Solver *solver, am_Row *row)
-{ am_freetable(solver, &row->terms); }
+static void am_freerow(am_Solver *solver, am_Row *row) {
+    if (row->dense) am_arenafree(row->terms.arena, row->dense, AM_DENSESIZE);
+    row->dense = NULL;
+    am_freetable(solver, &row->terms);
+}
 
 static void am_resetrow(am_Row *row)
 { row->constant = 0.0f; am_resettable(&row->terms); }
@@ -429,19 +1058,116 @@ static void am_initrow(am_Row *row) {
     am_key(row) = am_null();
     row->infeasible_next = am_null();
     row->constant = 0.0f;
+    row->dense = NULL;
     am_inittable(&row->terms, sizeof(am_Term));
 }
 
+static void am_inittableau(am_Solver *solver, am_Row *row)
+{ am_initrow(row); row->terms.arena = &solver->arena; }
+
+/* dense rows: ids in use plus the artificial one of am_add_with_artificial */
+static unsigned am_densesize(const am_Solver *solver) {
+    unsigned n = solver->symbol_count + 2;
+    return n > AM_DENSE_MAX ? AM_DENSE_MAX : n;
+}
+
+static am_Float *am_denserow(am_Solver *solver, am_Row *row) {
+    if (row->dense == NULL) {
+        row->dense = (am_Float*)am_arenaalloc(solver, row->terms.arena, AM_DENSESIZE);
+        memset(row->dense, 0, AM_DENSESIZE);
+    }
+    return row->dense;
+}
+
+static am_Iter am_iter(const am_Solver *solver, const am_Row *row) {
+    am_Iter it;
+    memset(&it, 0, sizeof(it));
+    it.row = row, it.types = solver->dense_types;
+    it.n = row->dense ? am_densesize(solver) : 0;
+    it.term = (const am_Term*)row->terms.hash;
+    it.end = it.term + (row->dense ? 0 : row->terms.size);
+    return it;
+}
+
+static int am_nextdense(am_Iter *it) {
+    const am_Float *dense = it->row->dense;
+    while (++it->i < it->n) { /* id 0 is never used */
+        if (dense[it->i] == 0.0f) continue;
+        it->key.id = it->i, it->key.type = it->types[it->i];
+        it->multiplier = dense[it->i];
+        return 1;
+    }
+    it->key = am_null();
+    return 0;
+}
+
+static int am_nextterm(am_Iter *it) {
+    for (; it->term < it->end; ++it->term) {
+        if (am_key(it->term).id == 0) continue;
+        it->key = am_key(it->term), it->multiplier = it->term->multiplier;
+        return ++it->term, 1;
+    }
+    return am_nextdense(it);
+}
+
+static am_Float *am_getterm(const am_Row *row, am_Symbol sym) {
+    am_Term *term;
+    if (row->dense)
+        return sym.id < AM_DENSE_MAX && row->dense[sym.id] != 0.0f ?
+            &row->dense[sym.id] : NULL;
+    term = (am_Term*)am_gettable(&row->terms, sym);
+    return term ? &term->multiplier : NULL;
+}
+
+static void am_delterm(am_Row *row, am_Symbol sym) {
+    if (row->dense == NULL) {
+        am_Term *term = (am_Term*)am_gettable(&row->terms, sym);
+        if (term) am_delkey(&row->terms, &term->entry);
+    }
+    else if (sym.id < AM_DENSE_MAX)
+        row->dense[sym.id] = 0.0f;
+}
+
+static void am_denseaddvar(am_Solver *solver, am_Row *row, am_Symbol sym, am_Float value) {
+    am_Float *dense = am_denserow(solver, row);
+    assert(sym.id < AM_DENSE_MAX);
+    solver->dense_types[sym.id] = (unsigned char)sym.type;
+    value += dense[sym.id];
+    dense[sym.id] = am_nearzero(value) ? 0.0f : value;
+}
+
+static void am_denseaddrow(am_Solver *solver, am_Row *row, const am_Float *src, am_Float multiplier) {
+    am_Float *dst = am_denserow(solver, row);
+    unsigned i, n = am_densesize(solver);
+    for (i = 0; i < n; ++i) { /* the compiler vectorizes this (-O3) */
+        am_Float v = dst[i] + src[i]*multiplier;
+        dst[i] = v > -AM_FLOAT_EPS && v < AM_FLOAT_EPS ? 0.0f : v;
+    }
+}
+
+static void am_densesubstitute(am_Solver *solver, am_Row *row, am_Symbol entry, const am_Row *other) {
+    am_Float multiplier;
+    if (entry.id >= AM_DENSE_MAX || row->dense[entry.id] == 0.0f) return;
+    multiplier = row->dense[entry.id], row->dense[entry.id] = 0.0f;
+    row->constant += other->constant*multiplier;
+    if (other->dense) am_denseaddrow(solver, row, other->dense, multiplier);
+}
+
 static void am_multiply(am_Row *row, am_Float multiplier) {
     am_Term *term = NULL;
+    unsigned i;
     row->constant *= multiplier;
-    while (am_nextentry(&row->terms, (am_Entry**)&term))
+    if (row->dense) for (i = AM_DENSE_MAX; i > 0; --i)
+        row->dense[i-1] *= multiplier;
+    else while (am_nextentry(&row->terms, (am_Entry**)&term))
         term->multiplier *= multiplier;
 }
 
 static void am_addvar(am_Solver *solver, am_Row *row, am_Symbol sym, am_Float value) {
     am_Term *term;
     if (sym.id == 0) return;
+    if (row->dense || (solver->dense && row->terms.arena))
+    { am_denseaddvar(solver, row, sym, value); return; }
     if ((term = (am_Term*)am_gettable(&row->terms, sym)) == NULL)
         term = (am_Term*)am_settable(solver, &row->terms, sym);
     if (am_nearzero(term->multiplier += value))
@@ -451,32 +1177,171 @@ static void am_addvar(am_Solver *solver, am_Row *row, am_Symbol sym, am_Float va
 static void am_addrow(am_Solver *solver, am_Row *row, const am_Row *other, am_Float multiplier) {
     am_Term *term = NULL;
     row->constant += other->constant*multiplier;
-    while (am_nextentry(&other->terms, (am_Entry**)&term))
+    if (other->dense) am_denseaddrow(solver, row, other->dense, multiplier);
+    else while (am_nextentry(&other->terms, (am_Entry**)&term))
         am_addvar(solver, row, am_key(term), term->multiplier*multiplier);
 }
 
 static void am_solvefor(am_Solver *solver, am_Row *row, am_Symbol entry, am_Symbol exit) {
-    am_Term *term = (am_Term*)am_gettable(&row->terms, entry);
-    am_Float reciprocal = 1.0f / term->multiplier;
-    assert(entry.id != exit.id && !am_nearzero(term->multiplier));
-    am_delkey(&row->terms, &term->entry);
+    am_Float reciprocal = 1.0f / *am_getterm(row, entry);
+    assert(entry.id != exit.id && !am_nearzero(*am_getterm(row, entry)));
+    am_delterm(row, entry);
     am_multiply(row, -reciprocal);
     if (exit.id != 0) am_addvar(solver, row, exit, reciprocal);
 }
 
 static void am_substitute(am_Solver *solver, am_Row *row, am_Symbol entry, const am_Row *other) {
-    am_Term *term = (am_Term*)am_gettable(&row->terms, entry);
-    if (!term) return;
+    am_Term *term;
+    if (row->dense) { am_densesubstitute(solver, row, entry, other); return; }
+    if ((term = (am_Term*)am_gettable(&row->terms, entry)) == NULL) return;
     am_delkey(&row->terms, &term->entry);
     am_addrow(solver, row, other, term->multiplier);
 }
 
+/* whole tableau between hashed and dense rows, as symbol ids allow */
+static int am_densefits(am_Solver *solver) /* a new marker, other, artificial */
+{ return solver->symbol_count + 4 <= AM_DENSE_MAX; }
+
+static void am_switchrow(am_Solver *solver, am_Row *row) {
+    am_Iter it = am_iter(solver, row);
+    am_Row tmp;
+    am_inittableau(solver, &tmp);
+    while (am_nextterm(&it)) am_addvar(solver, &tmp, it.key, it.multiplier);
+    am_freerow(solver, row);
+    row->terms = tmp.terms, row->dense = tmp.dense;
+}
+
+static void am_setdense(am_Solver *solver, int dense) {
+    am_Row *row = NULL;
+    if (!solver->dense == !dense) return;
+    solver->dense = dense;
+    am_switchrow(solver, &solver->objective);
+    while (am_nextentry(&solver->rows, (am_Entry**)&row))
+        am_switchrow(solver, row);
+}
+
+static void am_checkdense(am_Solver *solver) /* before new rows and symbols */
+{ if (solver->dense && !am_densefits(solver)) am_setdense(solver, 0); }
+
+
+/* tracing */
+
+typedef struct am_TraceOp {
+    am_Solver    *solver;
+    size_t        len;
+    unsigned char data[AM_TRACEBUF];
+} am_TraceOp;
+
+static void am_traceflush(am_TraceOp *op) {
+    if (op->len) op->solver->tracef(op->solver->trace_ud, op->data, op->len);
+    op->len = 0;
+}
+
+static void am_traceuint(am_TraceOp *op, unsigned v) {
+    if (op->len + 5 > AM_TRACEBUF) am_traceflush(op);
+    for (; v >= 0x80; v >>= 7)
+        op->data[op->len++] = (unsigned char)(v | 0x80);
+    op->data[op->len++] = (unsigned char)v;
+}
+
+static void am_tracefloat(am_TraceOp *op, am_Float f) {
+    if (op->len + sizeof(f) > AM_TRACEBUF) am_traceflush(op);
+    memcpy(op->data + op->len, &f, sizeof(f));
+    op->len += sizeof(f);
+}
+
+/* fmt: 'v' variable, 'c' constraint, 'i' int, 'f' am_Float,
+ * 'V' count and array of variables, 'F' count and array of am_Float
+ * (count not written, it follows a 'V') */
+static void am_traceop(am_Solver *solver, int opcode, const char *fmt, ...) {
+    am_TraceOp op;
+    va_list ap;
+    op.solver = solver, op.len = 0;
+    op.data[op.len++] = (unsigned char)opcode;
+    va_start(ap, fmt);
+    for (; *fmt != '\0'; ++fmt) {
+        switch (*fmt) {
+        case 'v': {
+            am_Variable *var = va_arg(ap, am_Variable*);
+            am_traceuint(&op, var ? var->sym.id : 0);
+            break; }
+        case 'c': {
+            am_Constraint *cons = va_arg(ap, am_Constraint*);
+            am_traceuint(&op, cons ? am_key(cons).id : 0);
+            break; }
+        case 'i': am_traceuint(&op, (unsigned)va_arg(ap, int)); break;
+        case 'f': am_tracefloat(&op, (am_Float)va_arg(ap, double)); break;
+        case 'V': {
+            int i, count = va_arg(ap, int);
+            am_Variable **vars = va_arg(ap, am_Variable**);
+            if (count < 0) count = 0;
+            am_traceuint(&op, (unsigned)count);
+            for (i = 0; i < count; ++i)
+                am_traceuint(&op, vars[i] ? vars[i]->sym.id : 0);
+            break; }
+        case 'F': {
+            int i, count = va_arg(ap, int);
+            const am_Float *values = va_arg(ap, const am_Float*);
+            for (i = 0; i < count; ++i)
+                am_tracefloat(&op, values[i]);
+            break; }
+        case 'H': {
+            int i, count = va_arg(ap, int);
+            const am_Hint *hints = va_arg(ap, const am_Hint*);
+            if (count < 0 || hints == NULL) count = 0;
+            am_traceuint(&op, (unsigned)count);
+            for (i = 0; i < count; ++i) {
+                am_traceuint(&op, hints[i].key);
+                am_traceuint(&op, (unsigned)hints[i].kind);
+            }
+            break; }
+        }
+    }
+    va_end(ap);
+    am_traceflush(&op);
+}
+
+/* the stream replays only from an empty solver: attach before creating
+ * variables, see am_replay.c */
+AM_API void am_trace(am_Solver *solver, am_Writef *writef, void *ud) {
+    unsigned char header[6];
+    solver->tracef = writef, solver->trace_ud = ud;
+    if (writef == NULL) return;
+    memcpy(header, "AMTR", 4);
+    header[4] = AM_TRACE_VERSION;
+    header[5] = (unsigned char)sizeof(am_Float);
+    writef(ud, header, sizeof(header));
+    am_traceop(solver, AM_OP_AUTOUPDATE, "i", (int)solver->auto_update);
+    am_traceop(solver, AM_OP_DEDUP, "i", (int)solver->dedup);
+    if (solver->defer) am_traceop(solver, AM_OP_DEFER, "i", 1);
+    if (solver->dual_policy)
+        am_traceop(solver, AM_OP_DUALPOLICY, "i", (int)solver->dual_policy);
+    if (solver->lazy_values) am_traceop(solver, AM_OP_LAZYVALUES, "i", 1);
+    if (solver->profiling) am_traceop(solver, AM_OP_PROFILE, "i", 1);
+}
+
 
 /* variables & constraints */
 
 AM_API int am_variableid(am_Variable *var) { return var ? var->sym.id : -1; }
-AM_API am_Float am_value(am_Variable *var) { return var ? var->value : 0.0f; }
-AM_API void am_usevariable(am_Variable *var) { if (var) ++var->refcount; }
+AM_API am_Float am_value(am_Variable *var) {
+    am_Solver *solver;
+    if (var == NULL) return 0.0f;
+    solver = var->solver;
+    if (solver->lazy_values && var->epoch != solver->epoch) {
+        am_Row *row = (am_Row*)am_gettable(&solver->rows, var->sym);
+        var->value = row ? row->constant : 0.0f;
+        var->epoch = solver->epoch;
+    }
+    return var->value;
+}
+
+AM_API void am_usevariable(am_Variable *var) {
+    if (var == NULL) return;
+    if (var->solver->tracef)
+        am_traceop(var->solver, AM_OP_USEVARIABLE, "v", var);
+    ++var->refcount;
+}
 
 static am_Variable *am_sym2var(am_Solver *solver, am_Symbol sym) {
     am_VarEntry *ve = (am_VarEntry*)am_gettable(&solver->vars, sym);
@@ -484,10 +1349,16 @@ static am_Variable *am_sym2var(am_Solver *solver, am_Symbol sym) {
     return ve->variable;
 }
 
-AM_API am_Variable *am_newvariable(am_Solver *solver) {
-    am_Variable *var = (am_Variable*)am_alloc(solver, &solver->varpool);
-    am_Symbol sym = am_newsymbol(solver, AM_EXTERNAL);
-    am_VarEntry *ve = (am_VarEntry*)am_settable(solver, &solver->vars, sym);
+static am_Variable *am_new_variable(am_Solver *solver) {
+    am_Variable *var;
+    am_Symbol sym;
+    am_VarEntry *ve;
+#ifdef AM_STATIC_CAPACITY
+    if (solver->vars.count >= AM_STATIC_CAPACITY) am_overflow(solver);
+#endif
+    var = (am_Variable*)am_alloc(solver, &solver->varpool);
+    sym = am_newsymbol(solver, AM_EXTERNAL);
+    ve  = (am_VarEntry*)am_settable(solver, &solver->vars, sym);
     assert(ve->variable == NULL);
     memset(var, 0, sizeof(*var));
     var->sym      = sym;
@@ -497,19 +1368,44 @@ AM_API am_Variable *am_newvariable(am_Solver *solver) {
     return var;
 }
 
-AM_API void am_delvariable(am_Variable *var) {
-    if (var && --var->refcount <= 0) {
-        am_Solver *solver = var->solver;
-        am_VarEntry *e = (am_VarEntry*)am_gettable(&solver->vars, var->sym);
-        assert(e != NULL);
-        am_delkey(&solver->vars, &e->entry);
-        am_remove(var->constraint);
-        am_free(&solver->varpool, var);
-    }
+AM_API am_Variable *am_newvariable(am_Solver *solver) {
+    am_Variable *volatile var = NULL;
+    am_try(solver) {
+        var = am_new_variable(solver);
+    } am_catch(solver) {
+        return NULL;
+    } am_end;
+    if (solver->tracef) am_traceop(solver, AM_OP_NEWVARIABLE, "v", var);
+    if (solver->published) am_markdirty(solver, var); /* clear its slot */
+    return var;
 }
 
-AM_API am_Constraint *am_newconstraint(am_Solver *solver, am_Float strength) {
-    am_Constraint *cons = (am_Constraint*)am_alloc(solver, &solver->conspool);
+/* may overflow only before it changes anything, so it can be run again */
+static void am_release_variable(am_Variable *var) {
+    am_Solver *solver = var->solver;
+    am_VarEntry *e;
+    if (var->refcount > 1) { --var->refcount; return; }
+    am_remove_constraint(var->constraint); /* first, may overflow */
+    if (am_isdummy(var->dirty_next)) am_update_vars(solver);
+    e = (am_VarEntry*)am_gettable(&solver->vars, var->sym);
+    assert(e != NULL);
+    am_delkey(&solver->vars, &e->entry);
+    am_free(&solver->varpool, var);
+}
+
+AM_API void am_delvariable(am_Variable *var) {
+    if (var == NULL) return;
+    if (var->solver->tracef)
+        am_traceop(var->solver, AM_OP_DELVARIABLE, "v", var);
+    am_try(var->solver) {
+        am_release_variable(var);
+    } am_catch(var->solver) { /* sticky now: nothing allocates */
+        am_release_variable(var);
+    } am_end;
+}
+
+static am_Constraint *am_create_constraint(am_Solver *solver, am_Float strength) {
+    am_Constraint *cons = (am_Constraint*)am_alloc(solver, &solver->conspool);
     memset(cons, 0, sizeof(*cons));
     cons->solver   = solver;
     cons->strength = am_nearzero(strength) ? AM_REQUIRED : strength;
@@ -521,68 +1417,141 @@ AM_API am_Constraint *am_newconstraint(am_Solver *solver, am_Float strength) {
     return cons;
 }
 
+AM_API am_Constraint *am_newconstraint(am_Solver *solver, am_Float strength) {
+    am_Constraint *volatile cons = NULL;
+    am_try(solver) {
+        cons = am_create_constraint(solver, strength);
+    } am_catch(solver) {
+        return NULL;
+    } am_end;
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_NEWCONSTRAINT, "cf", cons, strength);
+    return cons;
+}
+
+static void am_release_terms(am_Solver *solver, am_Row *row) {
+    am_Term *term = NULL;
+    while (am_nextentry(&row->terms, (am_Entry**)&term))
+        am_release_variable(am_sym2var(solver, am_key(term)));
+}
+
 AM_API void am_delconstraint(am_Constraint *cons) {
     am_Solver *solver = cons ? cons->solver : NULL;
-    am_Term *term = NULL;
     am_ConsEntry *ce;
     if (cons == NULL) return;
-    am_remove(cons);
+    if (solver->tracef) am_traceop(solver, AM_OP_DELCONSTRAINT, "c", cons);
+    am_try(solver) {
+        am_remove_constraint(cons);
+    } am_catch(solver) { /* forgets the row, or finishes forgetting it */
+        am_remove_constraint(cons);
+    } am_end;
+    if (solver->costs.count != 0) am_forget(&solver->costs, am_key(cons));
+    if (solver->blame == cons) solver->blame = NULL;
     ce = (am_ConsEntry*)am_gettable(&solver->constraints, am_key(cons));
     assert(ce != NULL);
     am_delkey(&solver->constraints, &ce->entry);
-    while (am_nextentry(&cons->expression.terms, (am_Entry**)&term))
-        am_delvariable(am_sym2var(solver, am_key(term)));
+    am_release_terms(solver, &cons->expression);
     am_freerow(solver, &cons->expression);
     am_free(&solver->conspool, cons);
 }
 
+static void am_merge_constraint(am_Constraint *cons, am_Constraint *other, am_Float multiplier) {
+    am_Term *term = NULL;
+    if (cons->relation == AM_GREATEQUAL) multiplier = -multiplier;
+    cons->expression.constant += other->expression.constant*multiplier;
+    while (am_nextentry(&other->expression.terms, (am_Entry**)&term)) {
+        ++am_sym2var(cons->solver, am_key(term))->refcount;
+        am_addvar(cons->solver, &cons->expression, am_key(term),
+                term->multiplier*multiplier);
+    }
+}
+
 AM_API am_Constraint *am_cloneconstraint(am_Constraint *other, am_Float strength) {
-    am_Constraint *cons;
+    am_Constraint *volatile cons = NULL;
     if (other == NULL) return NULL;
-    cons = am_newconstraint(other->solver,
-            am_nearzero(strength) ? other->strength : strength);
-    am_mergeconstraint(cons, other, 1.0f);
-    cons->relation = other->relation;
+    am_try(other->solver) {
+        cons = am_create_constraint(other->solver,
+                am_nearzero(strength) ? other->strength : strength);
+        cons->relation = other->relation;
+        am_merge_constraint(cons, other, 1.0f);
+    } am_catch(other->solver) {
+        return NULL;
+    } am_end;
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_CLONE, "ccf", cons, other, strength);
     return cons;
 }
 
 AM_API int am_mergeconstraint(am_Constraint *cons, am_Constraint *other, am_Float multiplier) {
-    am_Term *term = NULL;
     if (cons == NULL || other == NULL || cons->marker.id != 0
             || cons->solver != other->solver) return AM_FAILED;
-    if (cons->relation == AM_GREATEQUAL) multiplier = -multiplier;
-    cons->expression.constant += other->expression.constant*multiplier;
-    while (am_nextentry(&other->expression.terms, (am_Entry**)&term)) {
-        am_usevariable(am_sym2var(cons->solver, am_key(term)));
-        am_addvar(cons->solver, &cons->expression, am_key(term),
-                term->multiplier*multiplier);
-    }
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_MERGE, "ccf", cons, other, multiplier);
+    am_try(cons->solver) {
+        am_merge_constraint(cons, other, multiplier);
+    } am_catch(cons->solver) {
+        return AM_OVERFLOW;
+    } am_end;
     return AM_OK;
 }
 
 AM_API void am_resetconstraint(am_Constraint *cons) {
-    am_Term *term = NULL;
     if (cons == NULL) return;
-    am_remove(cons);
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_RESETCONS, "c", cons);
+    am_try(cons->solver) {
+        am_remove_constraint(cons);
+    } am_catch(cons->solver) {
+        am_remove_constraint(cons);
+    } am_end;
     cons->relation = 0;
-    while (am_nextentry(&cons->expression.terms, (am_Entry**)&term))
-        am_delvariable(am_sym2var(cons->solver, am_key(term)));
+    am_release_terms(cons->solver, &cons->expression);
     am_resetrow(&cons->expression);
 }
 
+static int am_add_term(am_Constraint *cons, am_Variable *var, am_Float multiplier) {
+    am_try(cons->solver) {
+        am_addvar(cons->solver, &cons->expression, var->sym, multiplier);
+    } am_catch(cons->solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    ++var->refcount;
+    return AM_OK;
+}
+
 AM_API int am_addterm(am_Constraint *cons, am_Variable *var, am_Float multiplier) {
     if (cons == NULL || var == NULL || cons->marker.id != 0 ||
             cons->solver != var->solver) return AM_FAILED;
     assert(var->sym.id != 0);
     assert(var->solver == cons->solver);
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_ADDTERM, "cvf", cons, var, multiplier);
     if (cons->relation == AM_GREATEQUAL) multiplier = -multiplier;
-    am_addvar(cons->solver, &cons->expression, var->sym, multiplier);
-    am_usevariable(var);
+    return am_add_term(cons, var, multiplier);
+}
+
+AM_API int am_addterms(am_Constraint *cons, am_Variable **vars, const am_Float *multipliers, int count) {
+    am_Float sign;
+    int i;
+    if (cons == NULL || vars == NULL || multipliers == NULL
+            || cons->marker.id != 0) return AM_FAILED;
+    for (i = 0; i < count; ++i)
+        if (vars[i] == NULL || vars[i]->solver != cons->solver)
+            return AM_FAILED;
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_ADDTERMS, "cVF", cons,
+                count, vars, count, multipliers);
+    sign = cons->relation == AM_GREATEQUAL ? -1.0f : 1.0f;
+    for (i = 0; i < count; ++i)
+        if (am_add_term(cons, vars[i], sign*multipliers[i]) != AM_OK)
+            return AM_OVERFLOW;
     return AM_OK;
 }
 
 AM_API int am_addconstant(am_Constraint *cons, am_Float constant) {
     if (cons == NULL || cons->marker.id != 0) return AM_FAILED;
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_ADDCONSTANT, "cf", cons, constant);
     if (cons->relation == AM_GREATEQUAL)
         cons->expression.constant -= constant;
     else
@@ -594,6 +1563,8 @@ AM_API int am_setrelation(am_Constraint *cons, int relation) {
     assert(relation >= AM_LESSEQUAL && relation <= AM_GREATEQUAL);
     if (cons == NULL || cons->marker.id != 0 || cons->relation != 0)
         return AM_FAILED;
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_SETRELATION, "ci", cons, relation);
     if (relation != AM_GREATEQUAL) am_multiply(&cons->expression, -1.0f);
     cons->relation = relation;
     return AM_OK;
@@ -608,8 +1579,118 @@ AM_API int am_hasedit(am_Variable *var)
 AM_API int am_hasconstraint(am_Constraint *cons)
 { return cons != NULL && cons->marker.id != 0; }
 
-AM_API void am_autoupdate(am_Solver *solver, int auto_update)
-{ solver->auto_update = auto_update; }
+AM_API void am_autoupdate(am_Solver *solver, int auto_update) {
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_AUTOUPDATE, "i", auto_update);
+    solver->auto_update = auto_update;
+}
+
+AM_API void am_dedup(am_Solver *solver, int dedup) {
+    if (solver->tracef) am_traceop(solver, AM_OP_DEDUP, "i", dedup);
+    solver->dedup = dedup;
+}
+
+AM_API void am_defer(am_Solver *solver, int defer) {
+    if (solver->tracef) am_traceop(solver, AM_OP_DEFER, "i", defer);
+    solver->defer = defer;
+}
+
+AM_API void am_dualpolicy(am_Solver *solver, int policy) {
+    if (solver->tracef) am_traceop(solver, AM_OP_DUALPOLICY, "i", policy);
+    solver->dual_policy = policy == AM_DUAL_WORST ? AM_DUAL_WORST : AM_DUAL_LIFO;
+}
+
+AM_API void am_lazyvalues(am_Solver *solver, int lazy) {
+    am_Entry *entry = NULL;
+    if (solver->tracef) am_traceop(solver, AM_OP_LAZYVALUES, "i", lazy);
+    if (!solver->lazy_values == !lazy) return;
+    solver->lazy_values = lazy;
+    while (!lazy && am_nextentry(&solver->vars, &entry)) /* none is fresh */
+        am_markdirty(solver, ((am_VarEntry*)entry)->variable);
+    if (solver->auto_update) am_update_vars(solver);
+}
+
+AM_API void am_stats(am_Solver *solver, am_Stats *stats) {
+    stats->vars        = solver->vars.count;
+    stats->constraints = solver->constraints.count;
+    stats->rows        = solver->rows.count;
+    stats->symbols     = solver->symbol_count;
+    stats->pivots      = solver->pivots;
+    stats->dual_pivots = solver->dual_pivots;
+}
+
+AM_API void am_setvariablekey(am_Variable *var, unsigned key) {
+    if (var == NULL) return;
+    if (var->solver->tracef)
+        am_traceop(var->solver, AM_OP_VARKEY, "vi", var, (int)key);
+    var->key = key & 0x3fffffffu;
+    if (var->constraint) var->constraint->key = var->key;
+}
+
+AM_API void am_setconstraintkey(am_Constraint *cons, unsigned key) {
+    if (cons == NULL) return;
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_CONSKEY, "ci", cons, (int)key);
+    cons->key = key & 0x3fffffffu;
+}
+
+static int am_isbasic(am_Solver *solver, am_Symbol sym)
+{ return sym.id != 0 && am_gettable(&solver->rows, sym) != NULL; }
+
+static int am_addhint(am_Hint *hints, int count, int n, unsigned key, int kind) {
+    if (n < count) hints[n].key = key, hints[n].kind = kind;
+    return n + 1;
+}
+
+AM_API int am_getbasis(am_Solver *solver, am_Hint *hints, int count) {
+    am_Entry *entry = NULL;
+    int n = 0;
+    if (hints == NULL) count = 0;
+    while (am_nextentry(&solver->vars, &entry)) {
+        am_Variable *var = ((am_VarEntry*)entry)->variable;
+        am_Constraint *edit = var->constraint;
+        if (var->key == 0) continue;
+        if (am_isbasic(solver, var->sym))
+            n = am_addhint(hints, count, n, var->key, AM_HINT_VAR);
+        if (edit && (am_isbasic(solver, edit->marker)
+                    || am_isbasic(solver, edit->other)))
+            n = am_addhint(hints, count, n, var->key, AM_HINT_EDIT);
+    }
+    while (am_nextentry(&solver->constraints, &entry)) {
+        am_Constraint *cons = ((am_ConsEntry*)entry)->constraint;
+        if (cons->key == 0) continue;
+        if (am_isbasic(solver, cons->marker) || am_isbasic(solver, cons->other))
+            n = am_addhint(hints, count, n, cons->key, AM_HINT_CONS);
+    }
+    return n;
+}
+
+static void am_sethints(am_Solver *solver, const am_Hint *hints, int count) {
+    int i;
+    for (i = 0; i < count; ++i) {
+        am_Symbol sym;
+        if ((hints[i].key & 0x3fffffffu) == 0 || hints[i].kind < AM_HINT_VAR
+                || hints[i].kind > AM_HINT_EDIT) continue;
+        sym.id = hints[i].key & 0x3fffffffu, sym.type = AM_EXTERNAL;
+        ((am_HintEntry*)am_settable(solver, &solver->hints, sym))->kinds
+            |= 1u << hints[i].kind;
+    }
+}
+
+AM_API int am_setbasis(am_Solver *solver, const am_Hint *hints, int count) {
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_SETBASIS, "H", count, hints);
+    am_freetable(solver, &solver->hinted);
+    if (hints == NULL || count <= 0)
+    { am_freetable(solver, &solver->hints); return AM_OK; }
+    if (solver->hints.size != 0) am_resettable(&solver->hints);
+    am_try(solver) {
+        am_sethints(solver, hints, count);
+    } am_catch(solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    return AM_OK;
+}
 
 static void am_infeasible(am_Solver *solver, am_Row *row) {
     if (am_isdummy(row->infeasible_next)) return;
@@ -618,16 +1699,36 @@ static void am_infeasible(am_Solver *solver, am_Row *row) {
     solver->infeasible_rows = am_key(row);
 }
 
+static int am_hasinfeasible(am_Solver *solver)
+{ return solver->infeasible_rows.id != 0 || solver->dual_count != 0; }
+
 static void am_markdirty(am_Solver *solver, am_Variable *var) {
+    ++solver->epoch;
     if (var->dirty_next.type == AM_DUMMY) return;
+    if (solver->lazy_values && !solver->published) return;
     var->dirty_next.id = solver->dirty_vars.id;
     var->dirty_next.type = AM_DUMMY;
     solver->dirty_vars = var->sym;
 }
 
+/* am_profile(): a pivot made enter basic, rewriting substituted rows */
+static void am_charge(am_Solver *solver, am_Symbol enter, size_t substituted) {
+    am_SymEntry *se = (am_SymEntry*)am_gettable(&solver->costsyms, enter);
+    am_CostEntry *ce;
+    if (se && (ce = (am_CostEntry*)am_gettable(&solver->costs, se->sym))
+            && (ce->profile.constraint->marker.id == enter.id
+                || ce->profile.constraint->other.id == enter.id))
+        ++ce->profile.entered;
+    if (solver->blame && (ce = (am_CostEntry*)am_gettable(&solver->costs,
+                    am_key(solver->blame))) != NULL)
+        ++ce->profile.pivots, ce->profile.substitutions += substituted;
+}
+
 static void am_substitute_rows(am_Solver *solver, am_Symbol var, am_Row *expr) {
     am_Row *row = NULL;
+    size_t substituted = 0;
     while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
+        if (solver->profiling && am_getterm(row, var)) ++substituted;
         am_substitute(solver, row, var, expr);
         if (am_isexternal(am_key(row)))
             am_markdirty(solver, am_sym2var(solver, am_key(row)));
@@ -635,6 +1736,7 @@ static void am_substitute_rows(am_Solver *solver, am_Symbol var, am_Row *expr) {
             am_infeasible(solver, row);
     }
     am_substitute(solver, &solver->objective, var, expr);
+    if (solver->profiling) am_charge(solver, var, substituted);
 }
 
 static int am_getrow(am_Solver *solver, am_Symbol sym, am_Row *dst) {
@@ -644,13 +1746,19 @@ static int am_getrow(am_Solver *solver, am_Symbol sym, am_Row *dst) {
     am_delkey(&solver->rows, &row->entry);
     dst->constant   = row->constant;
     dst->terms      = row->terms;
+    dst->dense      = row->dense;
     return AM_OK;
 }
 
 static int am_putrow(am_Solver *solver, am_Symbol sym, const am_Row *src) {
-    am_Row *row = (am_Row*)am_settable(solver, &solver->rows, sym);
+    am_Row *row;
+#ifdef AM_STATIC_CAPACITY /* pivots take their leaving row out first */
+    if (solver->rows.count >= AM_STATIC_ROWS) am_overflow(solver);
+#endif
+    row = (am_Row*)am_settable(solver, &solver->rows, sym);
     row->constant = src->constant;
     row->terms    = src->terms;
+    row->dense    = src->dense;
     return AM_OK;
 }
 
@@ -660,25 +1768,44 @@ static void am_mergerow(am_Solver *solver, am_Row *row, am_Symbol var, am_Float
     else am_addvar(solver, row, var, multiplier);
 }
 
-static int am_optimize(am_Solver *solver, am_Row *objective) {
+/* sym gets a column in the tableau: am_try_addrow() must not take it for
+ * a fresh subject from now on.  Every way an external variable gets into
+ * a live row goes through here. */
+static void am_place(am_Solver *solver, am_Symbol sym)
+{ if (am_isexternal(sym)) am_sym2var(solver, sym)->placed = 1; }
+
+static void am_mergecolumn(am_Solver *solver, am_Row *row, am_Symbol var, am_Float multiplier)
+{ am_place(solver, var); am_mergerow(solver, row, var, multiplier); }
+
+static am_Symbol am_get_entering(const am_Solver *solver, const am_Row *objective) {
+    am_Term *term = NULL;
+    if (objective->dense) {
+        am_Iter it = am_iter(solver, objective);
+        while (am_nextterm(&it))
+            if (!am_isdummy(it.key) && it.multiplier < 0.0f) return it.key;
+    } /* the hashed objective is long: no am_Iter call per term */
+    else while (am_nextentry(&objective->terms, (am_Entry**)&term))
+        if (!am_isdummy(am_key(term)) && term->multiplier < 0.0f)
+            return am_key(term);
+    return am_null();
+}
+
+static int am_simplex(am_Solver *solver, am_Row *objective) {
     for (;;) {
         am_Symbol enter = am_null(), exit = am_null();
-        am_Float r, min_ratio = AM_FLOAT_MAX;
+        am_Float r, *multiplier, min_ratio = AM_FLOAT_MAX;
         am_Row tmp, *row = NULL;
-        am_Term *term = NULL;
 
-        assert(solver->infeasible_rows.id == 0);
-        while (am_nextentry(&objective->terms, (am_Entry**)&term)) {
-            if (!am_isdummy(am_key(term)) && term->multiplier < 0.0f)
-            { enter = am_key(term); break; }
-        }
-        if (enter.id == 0) return AM_OK;
+        assert(!am_hasinfeasible(solver));
+        if ((enter = am_get_entering(solver, objective)).id == 0)
+            return AM_OK;
+        if (solver->budget == 0) return AM_FAILED;
 
         while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
-            term = (am_Term*)am_gettable(&row->terms, enter);
-            if (term == NULL || !am_ispivotable(am_key(row))
-                    || term->multiplier > 0.0f) continue;
-            r = -row->constant / term->multiplier;
+            multiplier = am_getterm(row, enter);
+            if (multiplier == NULL || !am_ispivotable(am_key(row))
+                    || *multiplier > 0.0f) continue;
+            r = -row->constant / *multiplier;
             if (r < min_ratio || (am_approx(r, min_ratio)
                         && am_key(row).id < exit.id))
                 min_ratio = r, exit = am_key(row);
@@ -686,6 +1813,8 @@ static int am_optimize(am_Solver *solver, am_Row *objective) {
         assert(exit.id != 0);
         if (exit.id == 0) return AM_FAILED;
 
+        ++solver->pivots, --solver->budget;
+        am_sdt4(pivot, solver, (unsigned)enter.id, (unsigned)exit.id, 0);
         am_getrow(solver, exit, &tmp);
         am_solvefor(solver, &tmp, enter, exit);
         am_substitute_rows(solver, enter, &tmp);
@@ -695,10 +1824,20 @@ static int am_optimize(am_Solver *solver, am_Row *objective) {
     }
 }
 
+static int am_optimize(am_Solver *solver, am_Row *objective) {
+    size_t pivots = solver->pivots;
+    int ret;
+    am_sdt2(optimize__entry, solver, objective != &solver->objective);
+    ret = am_simplex(solver, objective);
+    am_sdt3(optimize__return, solver, solver->pivots - pivots, ret);
+    return ret;
+}
+
 static am_Row am_makerow(am_Solver *solver, am_Constraint *cons) {
     am_Term *term = NULL;
     am_Row row;
-    am_initrow(&row);
+    am_checkdense(solver);
+    am_inittableau(solver, &row);
     row.constant = cons->expression.constant;
     while (am_nextentry(&cons->expression.terms, (am_Entry**)&term)) {
         am_markdirty(solver, am_sym2var(solver, am_key(term)));
@@ -730,6 +1869,12 @@ static am_Row am_makerow(am_Solver *solver, am_Constraint *cons) {
 }
 
 static void am_remove_errors(am_Solver *solver, am_Constraint *cons) {
+    if (solver->hinted.count != 0)
+        am_forget(&solver->hinted, cons->marker),
+        am_forget(&solver->hinted, cons->other);
+    if (solver->costsyms.count != 0)
+        am_forget(&solver->costsyms, cons->marker),
+        am_forget(&solver->costsyms, cons->other);
     if (am_iserror(cons->marker))
         am_mergerow(solver, &solver->objective, cons->marker, -cons->strength);
     if (am_iserror(cons->other))
@@ -741,11 +1886,11 @@ static void am_remove_errors(am_Solver *solver, am_Constraint *cons) {
 
 static int am_add_with_artificial(am_Solver *solver, am_Row *row, am_Constraint *cons) {
     am_Symbol a = am_newsymbol(solver, AM_SLACK);
-    am_Term *term = NULL;
+    am_Iter it;
     am_Row tmp;
     int ret;
     --solver->symbol_count; /* artificial variable will be removed */
-    am_initrow(&tmp);
+    am_inittableau(solver, &tmp);
     am_addrow(solver, &tmp, row, 1.0f);
     am_putrow(solver, a, row);
     am_initrow(row), row = NULL; /* row is useless */
@@ -753,42 +1898,100 @@ static int am_add_with_artificial(am_Solver *solver, am_Row *row, am_Constraint
     ret = am_nearzero(tmp.constant) ? AM_OK : AM_UNBOUND;
     am_freerow(solver, &tmp);
     if (am_getrow(solver, a, &tmp) == AM_OK) {
-        am_Symbol entry = am_null();
         if (am_isconstant(&tmp)) { am_freerow(solver, &tmp); return ret; }
-        while (am_nextentry(&tmp.terms, (am_Entry**)&term))
-            if (am_ispivotable(am_key(term))) { entry = am_key(term); break; }
-        if (entry.id == 0) { am_freerow(solver, &tmp); return AM_UNBOUND; }
-        am_solvefor(solver, &tmp, entry, a);
-        am_substitute_rows(solver, entry, &tmp);
-        am_putrow(solver, entry, &tmp);
-    }
-    while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
-        term = (am_Term*)am_gettable(&row->terms, a);
-        if (term) am_delkey(&row->terms, &term->entry);
+        it = am_iter(solver, &tmp);
+        while (am_nextterm(&it) && !am_ispivotable(it.key))
+            ;
+        if (it.key.id == 0) { am_freerow(solver, &tmp); return AM_UNBOUND; }
+        am_sdt4(pivot, solver, (unsigned)it.key.id, (unsigned)a.id, 0);
+        am_solvefor(solver, &tmp, it.key, a);
+        am_substitute_rows(solver, it.key, &tmp);
+        am_putrow(solver, it.key, &tmp);
     }
-    term = (am_Term*)am_gettable(&solver->objective.terms, a);
-    if (term) am_delkey(&solver->objective.terms, &term->entry);
-    if (ret != AM_OK) am_remove(cons);
+    while (am_nextentry(&solver->rows, (am_Entry**)&row))
+        am_delterm(row, a);
+    am_delterm(&solver->objective, a);
+    if (ret != AM_OK) am_remove_constraint(cons);
     return ret;
 }
 
+static int am_hinted(am_Solver *solver, unsigned key, int kind) {
+    am_HintEntry *he;
+    am_Symbol sym;
+    if (key == 0 || solver->hints.count == 0) return 0;
+    sym.id = key, sym.type = AM_EXTERNAL;
+    he = (am_HintEntry*)am_gettable(&solver->hints, sym);
+    return he != NULL && (he->kinds & (1u << kind)) != 0;
+}
+
+static void am_hintsymbols(am_Solver *solver, am_Constraint *cons) {
+    if (!am_hinted(solver, cons->key,
+                am_key(cons).id ? AM_HINT_CONS : AM_HINT_EDIT))
+        return;
+    if (am_ispivotable(cons->marker))
+        am_settable(solver, &solver->hinted, cons->marker);
+    if (am_ispivotable(cons->other))
+        am_settable(solver, &solver->hinted, cons->other);
+}
+
+/* solving row for sym leaves the restricted rows mentioning it feasible */
+static int am_hintfits(am_Solver *solver, am_Row *row, am_Symbol sym, am_Float multiplier) {
+    am_Float value = row->constant / -multiplier, *term;
+    am_Row *r = NULL;
+    while (am_nextentry(&solver->rows, (am_Entry**)&r))
+        if (!am_isexternal(am_key(r)) && (term = am_getterm(r, sym)) != NULL
+                && r->constant + *term * value < 0.0f)
+            return 0;
+    return 1;
+}
+
+/* a symbol basic in the am_setbasis() layout, if one may be the subject */
+static am_Symbol am_hintedsubject(am_Solver *solver, am_Row *row, am_Constraint *cons, int *fresh) {
+    am_Iter it = am_iter(solver, row);
+    while (am_nextterm(&it)) {
+        if (am_isexternal(it.key)) {
+            am_Variable *var = am_sym2var(solver, it.key);
+            if (!am_hinted(solver, var->key, AM_HINT_VAR)) continue;
+            *fresh = !var->placed;
+        }
+        else if (it.multiplier < 0.0f && am_ispivotable(it.key)
+                && am_gettable(&solver->hinted, it.key) != NULL)
+            *fresh = it.key.id == cons->marker.id || it.key.id == cons->other.id;
+        else continue;
+        if (*fresh || am_hintfits(solver, row, it.key, it.multiplier))
+            return it.key;
+    }
+    return *fresh = 0, am_null();
+}
+
 static int am_try_addrow(am_Solver *solver, am_Row *row, am_Constraint *cons) {
-    am_Symbol subject = am_null();
-    am_Term *term = NULL;
-    while (am_nextentry(&row->terms, (am_Entry**)&term))
-        if (am_isexternal(am_key(term))) { subject = am_key(term); break; }
-    if (subject.id == 0 && am_ispivotable(cons->marker)) {
-        am_Term *mterm = (am_Term*)am_gettable(&row->terms, cons->marker);
-        if (mterm->multiplier < 0.0f) subject = cons->marker;
+    am_Symbol subject = am_null(), hinted = am_null();
+    am_Iter it;
+    int fresh = 0;
+    if (solver->hints.count != 0) {
+        am_hintsymbols(solver, cons);
+        subject = hinted = am_hintedsubject(solver, row, cons, &fresh);
     }
-    if (subject.id == 0 && am_ispivotable(cons->other)) {
-        am_Term *mterm = (am_Term*)am_gettable(&row->terms, cons->other);
-        if (mterm->multiplier < 0.0f) subject = cons->other;
+    it = am_iter(solver, row);
+    while (am_nextterm(&it)) {
+        am_Variable *var;
+        if (!am_isexternal(it.key)) continue;
+        var = am_sym2var(solver, it.key);
+        if (hinted.id == 0 && (subject.id == 0 || (!fresh && !var->placed)))
+            subject = it.key, fresh = !var->placed;
+        am_place(solver, it.key);
     }
+    if (subject.id == 0 && am_ispivotable(cons->marker)
+            && *am_getterm(row, cons->marker) < 0.0f)
+        subject = cons->marker, fresh = 1;
+    if (subject.id == 0 && am_ispivotable(cons->other)
+            && *am_getterm(row, cons->other) < 0.0f)
+        subject = cons->other, fresh = 1;
     if (subject.id == 0) {
-        while (am_nextentry(&row->terms, (am_Entry**)&term))
-            if (!am_isdummy(am_key(term))) break;
-        if (term == NULL) {
+        it = am_iter(solver, row);
+        while (am_nextterm(&it) && am_isdummy(it.key))
+            ;
+        if (it.key.id == 0) {
             if (am_nearzero(row->constant))
                 subject = cons->marker;
             else {
@@ -800,7 +2003,9 @@ static int am_try_addrow(am_Solver *solver, am_Row *row, am_Constraint *cons) {
     if (subject.id == 0)
         return am_add_with_artificial(solver, row, cons);
     am_solvefor(solver, row, subject, am_null());
-    am_substitute_rows(solver, subject, row);
+    if (!fresh) am_substitute_rows(solver, subject, row);
+    else /* a new symbol: only the objective may mention it */
+        am_substitute(solver, &solver->objective, subject, row);
     am_putrow(solver, subject, row);
     return AM_OK;
 }
@@ -810,15 +2015,15 @@ static am_Symbol am_get_leaving_row(am_Solver *solver, am_Symbol marker) {
     am_Float r1 = AM_FLOAT_MAX, r2 = AM_FLOAT_MAX;
     am_Row *row = NULL;
     while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
-        am_Term *term = (am_Term*)am_gettable(&row->terms, marker);
-        if (term == NULL) continue;
+        am_Float *multiplier = am_getterm(row, marker);
+        if (multiplier == NULL) continue;
         if (am_isexternal(am_key(row))) third = am_key(row);
-        else if (term->multiplier < 0.0f) {
-            am_Float r = -row->constant / term->multiplier;
+        else if (*multiplier < 0.0f) {
+            am_Float r = -row->constant / *multiplier;
             if (r < r1) r1 = r, first = am_key(row);
         }
         else {
-            am_Float r = row->constant / term->multiplier;
+            am_Float r = row->constant / *multiplier;
             if (r < r2) r2 = r, second = am_key(row);
         }
     }
@@ -832,9 +2037,9 @@ static void am_delta_edit_constant(am_Solver *solver, am_Float delta, am_Constra
     if ((row = (am_Row*)am_gettable(&solver->rows, cons->other)) != NULL)
     { if ((row->constant += delta) < 0.0f) am_infeasible(solver, row); return; }
     while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
-        am_Term *term = (am_Term*)am_gettable(&row->terms, cons->marker);
-        if (term == NULL) continue;
-        row->constant += term->multiplier*delta;
+        am_Float *multiplier = am_getterm(row, cons->marker);
+        if (multiplier == NULL) continue;
+        row->constant += *multiplier*delta;
         if (am_isexternal(am_key(row)))
             am_markdirty(solver, am_sym2var(solver, am_key(row)));
         else if (row->constant < 0.0f)
@@ -842,31 +2047,117 @@ static void am_delta_edit_constant(am_Solver *solver, am_Float delta, am_Constra
     }
 }
 
-static void am_dual_optimize(am_Solver *solver) {
+static void am_heappush(am_Solver *solver, am_Symbol sym, am_Float constant) {
+    am_Infeasible *heap = solver->dual_heap;
+    size_t i = solver->dual_count;
+    if (i == solver->dual_size) {
+        size_t size = solver->dual_size ? solver->dual_size*2 : 64;
+        heap = (am_Infeasible*)solver->allocf(solver->ud, NULL,
+                size*sizeof(am_Infeasible), 0);
+        if (i) memcpy(heap, solver->dual_heap, i*sizeof(am_Infeasible));
+        if (solver->dual_heap) solver->allocf(solver->ud, solver->dual_heap, 0,
+                solver->dual_size*sizeof(am_Infeasible));
+        solver->dual_heap = heap, solver->dual_size = size;
+    }
+    ++solver->dual_count;
+    for (; i > 0 && heap[(i-1)/2].constant > constant; i = (i-1)/2)
+        heap[i] = heap[(i-1)/2];
+    heap[i].row = sym, heap[i].constant = constant;
+}
+
+static am_Infeasible am_heappop(am_Solver *solver) {
+    am_Infeasible *heap = solver->dual_heap, top = heap[0];
+    am_Infeasible last = heap[--solver->dual_count];
+    size_t i = 0, child, n = solver->dual_count;
+    while ((child = i*2 + 1) < n) {
+        if (child + 1 < n && heap[child+1].constant < heap[child].constant)
+            ++child;
+        if (last.constant <= heap[child].constant) break;
+        heap[i] = heap[child], i = child;
+    }
+    if (n) heap[i] = last;
+    return top;
+}
+
+/* pivots move constants of queued rows, so a popped entry whose key
+ * went stale goes back in with the current one */
+static am_Row *am_worstinfeasible(am_Solver *solver) {
+    am_Row *row;
     while (solver->infeasible_rows.id != 0) {
-        am_Row tmp, *row =
-            (am_Row*)am_gettable(&solver->rows, solver->infeasible_rows);
-        am_Symbol enter = am_null(), exit = am_key(row), curr;
-        am_Term *objterm, *term = NULL;
-        am_Float r, min_ratio = AM_FLOAT_MAX;
+        row = (am_Row*)am_gettable(&solver->rows, solver->infeasible_rows);
         solver->infeasible_rows = row->infeasible_next;
+        row->infeasible_next.id = 0; /* still queued, in the heap */
+        am_heappush(solver, am_key(row), row->constant);
+    }
+    while (solver->dual_count != 0) {
+        am_Infeasible top = am_heappop(solver);
+        if ((row = (am_Row*)am_gettable(&solver->rows, top.row)) == NULL
+                || !am_isdummy(row->infeasible_next))
+            continue; /* pivoted out of the basis meanwhile */
+        if (row->constant < 0.0f && row->constant != top.constant)
+        { am_heappush(solver, top.row, row->constant); continue; }
         row->infeasible_next = am_null();
+        return row;
+    }
+    return NULL;
+}
+
+static am_Row *am_nextinfeasible(am_Solver *solver) {
+    am_Row *row;
+    if (solver->dual_policy == AM_DUAL_WORST || solver->dual_count != 0)
+        return am_worstinfeasible(solver);
+    if (solver->infeasible_rows.id == 0) return NULL;
+    row = (am_Row*)am_gettable(&solver->rows, solver->infeasible_rows);
+    solver->infeasible_rows = row->infeasible_next;
+    row->infeasible_next = am_null();
+    return row;
+}
+
+static void am_dual_optimize(am_Solver *solver) {
+    size_t pivots = solver->dual_pivots;
+    am_Row *row;
+    am_sdt1(dual__optimize__entry, solver);
+    while (solver->budget != 0 && (row = am_nextinfeasible(solver)) != NULL) {
+        am_Row tmp;
+        am_Symbol enter = am_null(), exit = am_key(row);
+        am_Iter it = am_iter(solver, row);
+        am_Float r, *objterm, min_ratio = AM_FLOAT_MAX;
         if (row->constant >= 0.0f) continue;
-        while (am_nextentry(&row->terms, (am_Entry**)&term)) {
-            if (am_isdummy(curr = am_key(term)) || term->multiplier <= 0.0f)
-                continue;
-            objterm = (am_Term*)am_gettable(&solver->objective.terms, curr);
-            r = objterm ? objterm->multiplier / term->multiplier : 0.0f;
-            if (min_ratio > r) min_ratio = r, enter = curr;
+        while (am_nextterm(&it)) {
+            if (am_isdummy(it.key) || it.multiplier <= 0.0f) continue;
+            objterm = am_getterm(&solver->objective, it.key);
+            r = objterm ? *objterm / it.multiplier : 0.0f;
+            if (min_ratio > r) min_ratio = r, enter = it.key;
         }
         assert(enter.id != 0);
+        ++solver->dual_pivots, --solver->budget;
+        am_sdt4(pivot, solver, (unsigned)enter.id, (unsigned)exit.id, 1);
         am_getrow(solver, exit, &tmp);
         am_solvefor(solver, &tmp, enter, exit);
         am_substitute_rows(solver, enter, &tmp);
         am_putrow(solver, enter, &tmp);
     }
+    am_sdt2(dual__optimize__return, solver, solver->dual_pivots - pivots);
 }
 
+/* am_defer(): rows change at once, pivots wait for am_step().  Either
+ * primal (unoptimized) or dual (am_hasinfeasible()) work is pending, never
+ * both: each kind is finished before the other may start */
+
+static void am_primal(am_Solver *solver) {
+    if (solver->defer) { solver->unoptimized = 1; return; }
+    am_optimize(solver, &solver->objective);
+    solver->unoptimized = 0;
+}
+
+static void am_optimal(am_Solver *solver) {
+    if (solver->unoptimized) am_optimize(solver, &solver->objective);
+    solver->unoptimized = 0;
+}
+
+static void am_dual(am_Solver *solver)
+{ if (!solver->defer) am_dual_optimize(solver); }
+
 static void *am_default_allocf(void *ud, void *ptr, size_t nsize, size_t osize) {
     void *newptr;
     (void)ud, (void)osize;
@@ -876,163 +2167,1485 @@ static void *am_default_allocf(void *ud, void *ptr, size_t nsize, size_t osize)
     return newptr;
 }
 
-AM_API am_Solver *am_newsolver(am_Allocf *allocf, void *ud) {
-    am_Solver *solver;
-    if (allocf == NULL) allocf = am_default_allocf;
-    if ((solver = (am_Solver*)allocf(ud, NULL, sizeof(am_Solver), 0)) == NULL)
-        return NULL;
+static am_Solver *am_setupsolver(am_Solver *solver, am_Allocf *allocf, void *ud) {
     memset(solver, 0, sizeof(*solver));
+#ifdef AM_STATIC_CAPACITY
+    solver->owner = allocf, solver->owner_ud = ud;
+    allocf = am_static_allocf, ud = solver;
+#endif
     solver->allocf = allocf;
     solver->ud     = ud;
-    am_initrow(&solver->objective);
+    am_initarena(&solver->arena);
+    am_inittableau(solver, &solver->objective);
+    solver->dense = am_densefits(solver);
+    solver->budget = AM_MAX_SIZET;
     am_inittable(&solver->vars, sizeof(am_VarEntry));
     am_inittable(&solver->constraints, sizeof(am_ConsEntry));
     am_inittable(&solver->rows, sizeof(am_Row));
+    am_inittable(&solver->shared, sizeof(am_ConsEntry));
+    am_inittable(&solver->hints, sizeof(am_HintEntry));
+    am_inittable(&solver->hinted, sizeof(am_Entry));
+    am_inittable(&solver->costs, sizeof(am_CostEntry));
+    am_inittable(&solver->costsyms, sizeof(am_SymEntry));
     am_initpool(&solver->varpool, sizeof(am_Variable));
     am_initpool(&solver->conspool, sizeof(am_Constraint));
+    am_initpool(&solver->linkpool, sizeof(am_Link));
     return solver;
 }
 
+AM_API am_Solver *am_newsolver(am_Allocf *allocf, void *ud) {
+    am_Solver *solver;
+    if (allocf == NULL) allocf = am_default_allocf;
+    if ((solver = (am_Solver*)allocf(ud, NULL, sizeof(am_Solver), 0)) == NULL)
+        return NULL;
+    return am_setupsolver(solver, allocf, ud);
+}
+
+#ifdef AM_STATIC_CAPACITY
+/* storage from the caller, e.g. a static am_Solver next to AM_IMPLEMENTATION */
+AM_API am_Solver *am_initsolver(am_Solver *solver)
+{ return solver ? am_setupsolver(solver, NULL, NULL) : NULL; }
+#endif
+
+AM_API int am_error(am_Solver *solver) {
+#ifdef AM_STATIC_CAPACITY
+    return solver->error;
+#else
+    (void)solver;
+    return AM_OK;
+#endif
+}
+
 AM_API void am_delsolver(am_Solver *solver) {
     am_ConsEntry *ce = NULL;
-    am_Row *row = NULL;
+    am_nest(solver, NULL);
+    while (solver->children) am_nest(solver->children, NULL);
+    if (solver->tracef) am_traceop(solver, AM_OP_END, "");
     while (am_nextentry(&solver->constraints, (am_Entry**)&ce))
         am_freerow(solver, &ce->constraint->expression);
-    while (am_nextentry(&solver->rows, (am_Entry**)&row))
-        am_freerow(solver, row);
-    am_freerow(solver, &solver->objective);
+    am_freearena(solver, &solver->arena); /* all tableau rows */
     am_freetable(solver, &solver->vars);
     am_freetable(solver, &solver->constraints);
     am_freetable(solver, &solver->rows);
+    am_freetable(solver, &solver->shared);
+    am_freetable(solver, &solver->hints);
+    am_freetable(solver, &solver->hinted);
+    am_freetable(solver, &solver->costs);
+    am_freetable(solver, &solver->costsyms);
     am_freepool(solver, &solver->varpool);
     am_freepool(solver, &solver->conspool);
+    am_freepool(solver, &solver->linkpool);
+    if (solver->dual_heap) solver->allocf(solver->ud, solver->dual_heap, 0,
+            solver->dual_size*sizeof(am_Infeasible));
+#ifdef AM_STATIC_CAPACITY
+    if (solver->owner) solver->owner(solver->owner_ud, solver, 0, sizeof(*solver));
+#else
     solver->allocf(solver->ud, solver, 0, sizeof(*solver));
+#endif
 }
 
-AM_API void am_resetsolver(am_Solver *solver, int clear_constraints) {
+static void am_clearsolver(am_Solver *solver) {
     am_Entry *entry = NULL;
-    if (!solver->auto_update) am_updatevars(solver);
-    while (am_nextentry(&solver->vars, &entry)) {
-        am_Constraint **cons = &((am_VarEntry*)entry)->variable->constraint;
-        am_remove(*cons);
-        *cons = NULL;
-    }
-    assert(am_nearzero(solver->objective.constant));
-    assert(solver->infeasible_rows.id == 0);
-    assert(solver->dirty_vars.id == 0);
-    if (!clear_constraints) return;
-    am_resetrow(&solver->objective);
     while (am_nextentry(&solver->constraints, &entry)) {
         am_Constraint *cons = ((am_ConsEntry*)entry)->constraint;
-        if (cons->marker.id == 0) continue;
         cons->marker = cons->other = am_null();
+        cons->shared = NULL, cons->hash = 0;
     }
-    while (am_nextentry(&solver->rows, &entry)) {
-        am_delkey(&solver->rows, entry);
-        am_freerow(solver, (am_Row*)entry);
+    while (am_nextentry(&solver->vars, &entry)) {
+        am_Variable *var = ((am_VarEntry*)entry)->variable;
+        if (var->constraint == NULL) continue;
+        var->constraint->marker = am_null(); /* nothing to pivot */
+        am_delete_edit(var);
     }
+    if (solver->rows.size != 0) am_resettable(&solver->rows);
+    if (solver->shared.size != 0) am_resettable(&solver->shared);
+    if (solver->hinted.size != 0) am_resettable(&solver->hinted);
+    if (solver->costsyms.size != 0) am_resettable(&solver->costsyms);
+    am_rewindarena(&solver->arena);
+    am_inittableau(solver, &solver->objective);
+    solver->infeasible_rows = am_null();
+    solver->dual_count = 0;
+    solver->unoptimized = 0;
+#ifdef AM_STATIC_CAPACITY
+    solver->error = AM_OK; /* the tableau is empty and consistent again */
+#endif
+}
+
+AM_API void am_resetsolver(am_Solver *solver, int clear_constraints) {
+    am_Entry *entry = NULL;
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_RESETSOLVER, "i", clear_constraints);
+    if (!solver->auto_update) am_update_vars(solver);
+    if (clear_constraints) { am_clearsolver(solver); return; }
+    while (am_nextentry(&solver->vars, &entry))
+        am_remove_edit(((am_VarEntry*)entry)->variable);
+    if (am_error(solver)) return;
+    assert(!am_hasinfeasible(solver));
+    assert(solver->dirty_vars.id == 0);
 }
 
 AM_API void am_updatevars(am_Solver *solver) {
+    if (solver->tracef) am_traceop(solver, AM_OP_UPDATEVARS, "");
+    am_update_vars(solver);
+}
+
+static void am_update_vars(am_Solver *solver) {
+    volatile am_Float *slots = solver->published;
+    unsigned count = solver->published_count;
+    am_Entry *entry = NULL;
+    if (solver->dirty_vars.id == 0 && !solver->republish) return;
+    if (slots) ++*solver->generation, am_fence(); /* odd: being written */
     while (solver->dirty_vars.id != 0) {
         am_Variable *var = am_sym2var(solver, solver->dirty_vars);
         am_Row *row = (am_Row*)am_gettable(&solver->rows, var->sym);
         solver->dirty_vars = var->dirty_next;
         var->dirty_next = am_null();
         var->value = row ? row->constant : 0.0f;
+        if (slots && var->sym.id < count) slots[var->sym.id] = var->value;
     }
+    if (slots == NULL) return;
+    while (solver->republish && am_nextentry(&solver->vars, &entry)) {
+        am_Variable *var = ((am_VarEntry*)entry)->variable;
+        if (var->sym.id < count) slots[var->sym.id] = am_value(var);
+    }
+    solver->republish = 0;
+    am_fence(), ++*solver->generation;
 }
 
-AM_API int am_add(am_Constraint *cons) {
-    am_Solver *solver = cons ? cons->solver : NULL;
-    int ret, oldsym = solver ? solver->symbol_count : 0;
+AM_API void am_publish(am_Solver *solver, am_Float *values, int count, unsigned *generation) {
+    solver->published = generation && count > 0 ? values : NULL;
+    solver->generation = generation;
+    solver->published_count = solver->published ? (unsigned)count : 0;
+    solver->republish = solver->published != NULL;
+    am_update_vars(solver);
+}
+
+AM_API int am_step(am_Solver *solver, int max_pivots) {
+    if (solver->tracef) am_traceop(solver, AM_OP_STEP, "i", max_pivots);
+    solver->budget = max_pivots < 0 ? AM_MAX_SIZET : (size_t)max_pivots;
+    am_try(solver) {
+        am_dual_optimize(solver);
+        if (!am_hasinfeasible(solver) && solver->unoptimized
+                && am_optimize(solver, &solver->objective) == AM_OK)
+            solver->unoptimized = 0;
+    } am_catch(solver) { /* not solved: the tableau waits for a reset */
+        solver->budget = AM_MAX_SIZET;
+        return 0;
+    } am_end;
+    solver->budget = AM_MAX_SIZET;
+    if (solver->auto_update) am_update_vars(solver);
+    return !am_hasinfeasible(solver) && !solver->unoptimized;
+}
+
+/* batch solving */
+
+static int am_finish(am_Solver *solver) {
+    int done = am_step(solver, -1);
+    return am_error(solver) != AM_OK ? am_error(solver) : done ? AM_OK : AM_FAILED;
+}
+
+#ifdef AM_USE_THREADS
+# ifdef _WIN32
+typedef CRITICAL_SECTION am_Mutex;
+typedef HANDLE           am_Thread;
+#   define am_initlock(m) InitializeCriticalSection(m)
+#   define am_freelock(m) DeleteCriticalSection(m)
+#   define am_lock(m)     EnterCriticalSection(m)
+#   define am_unlock(m)   LeaveCriticalSection(m)
+# else
+typedef pthread_mutex_t  am_Mutex;
+typedef pthread_t        am_Thread;
+#   define am_initlock(m) pthread_mutex_init(m, NULL)
+#   define am_freelock(m) pthread_mutex_destroy(m)
+#   define am_lock(m)     pthread_mutex_lock(m)
+#   define am_unlock(m)   pthread_mutex_unlock(m)
+# endif
+
+typedef struct am_Worker {
+    am_Mutex   lock;
+    int        next, end; /* solvers[next..end) are still this worker's */
+    int        started;
+    am_Thread  thread;
+    struct am_Batch *batch;
+} am_Worker;
+
+typedef struct am_Batch {
+    am_Solver **solvers;
+    int        *status;
+    int         result;
+    int         count;    /* workers */
+    am_Mutex    lock;     /* of result */
+    am_Worker   workers[AM_MAX_THREADS];
+} am_Batch;
+
+static int am_popsolver(am_Worker *w) {
+    int i = -1;
+    am_lock(&w->lock);
+    if (w->next < w->end) i = w->next++;
+    am_unlock(&w->lock);
+    return i;
+}
+
+/* take the back half of the first worker found with solvers left */
+static int am_stealsolvers(am_Worker *w) {
+    am_Batch *b = w->batch;
+    int i, self = (int)(w - b->workers);
+    for (i = 1; i < b->count; ++i) {
+        am_Worker *v = &b->workers[(self + i) % b->count];
+        int begin = 0, end = 0;
+        am_lock(&v->lock);
+        if (v->next < v->end) {
+            end = v->end;
+            begin = v->end -= (v->end - v->next + 1) / 2;
+        }
+        am_unlock(&v->lock);
+        if (begin == end) continue;
+        am_lock(&w->lock);
+        w->next = begin, w->end = end;
+        am_unlock(&w->lock);
+        return 1;
+    }
+    return 0;
+}
+
+static void am_work(am_Worker *w) {
+    am_Batch *b = w->batch;
+    int i, ret;
+    do {
+        while ((i = am_popsolver(w)) >= 0) {
+            ret = am_finish(b->solvers[i]);
+            if (b->status) b->status[i] = ret;
+            if (ret == AM_OK) continue;
+            am_lock(&b->lock);
+            if (b->result == AM_OK) b->result = ret;
+            am_unlock(&b->lock);
+        }
+    } while (am_stealsolvers(w));
+}
+
+# ifdef _WIN32
+static DWORD WINAPI am_workthread(LPVOID ud)
+{ am_work((am_Worker*)ud); return 0; }
+
+static int am_startthread(am_Worker *w)
+{ return (w->thread = CreateThread(NULL, 0, am_workthread, w, 0, NULL)) != NULL; }
+
+static void am_jointhread(am_Worker *w)
+{ WaitForSingleObject(w->thread, INFINITE), CloseHandle(w->thread); }
+# else
+static void *am_workthread(void *ud)
+{ am_work((am_Worker*)ud); return NULL; }
+
+static int am_startthread(am_Worker *w)
+{ return pthread_create(&w->thread, NULL, am_workthread, w) == 0; }
+
+static void am_jointhread(am_Worker *w)
+{ pthread_join(w->thread, NULL); }
+# endif
+
+/* solvers share nothing, so each one is solved by whichever worker
+ * pops it; a worker that runs dry steals from the others */
+AM_API int am_solveall(am_Solver **solvers, int count, int threads, int *status) {
+    am_Batch b;
+    int i;
+    if (threads > count) threads = count;
+    if (threads > AM_MAX_THREADS) threads = AM_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    b.solvers = solvers, b.status = status;
+    b.result = AM_OK, b.count = threads;
+    am_initlock(&b.lock);
+    for (i = 0; i < threads; ++i) {
+        am_Worker *w = &b.workers[i];
+        am_initlock(&w->lock);
+        w->batch = &b, w->started = 0;
+        w->next = (int)((long)count * i / threads);
+        w->end  = (int)((long)count * (i + 1) / threads);
+    }
+    for (i = 1; i < threads; ++i) /* unstarted ones get robbed */
+        b.workers[i].started = am_startthread(&b.workers[i]);
+    am_work(&b.workers[0]);
+    for (i = 0; i < threads; ++i) {
+        if (b.workers[i].started) am_jointhread(&b.workers[i]);
+        am_freelock(&b.workers[i].lock);
+    }
+    am_freelock(&b.lock);
+    return b.result;
+}
+#else
+AM_API int am_solveall(am_Solver **solvers, int count, int threads, int *status) {
+    int i, ret, result = AM_OK;
+    (void)threads;
+    for (i = 0; i < count; ++i) {
+        ret = am_finish(solvers[i]);
+        if (status) status[i] = ret;
+        if (result == AM_OK) result = ret;
+    }
+    return result;
+}
+#endif /* AM_USE_THREADS */
+
+/* nested solvers */
+
+static void am_droplinks(am_Solver *solver, am_Solver *peer) {
+    am_Link **pl = &solver->links;
+    while (*pl != NULL) {
+        am_Link *link = *pl;
+        if (link->to->solver != peer)
+        { pl = &link->next; continue; }
+        *pl = link->next;
+        am_deledit(link->to);
+        am_delvariable(link->to);
+        am_delvariable(link->from);
+        am_free(&solver->linkpool, link);
+    }
+}
+
+AM_API int am_nest(am_Solver *child, am_Solver *parent) {
+    am_Solver *old = child ? child->parent : NULL, **ps, *s;
+    if (child == NULL) return AM_FAILED;
+    for (s = parent; s != NULL; s = s->parent)
+        if (s == child) return AM_FAILED;
+    if (old == parent) return AM_OK;
+    if (old != NULL) {
+        am_droplinks(child, old);
+        am_droplinks(old, child);
+        for (ps = &old->children; *ps != child; ps = &(*ps)->sibling)
+            ;
+        *ps = child->sibling;
+        child->sibling = NULL;
+    }
+    child->parent = parent;
+    if (parent != NULL)
+        child->sibling = parent->children, parent->children = child;
+    return AM_OK;
+}
+
+AM_API int am_link(am_Variable *from, am_Variable *to, am_Float strength) {
+    am_Solver *solver = from ? from->solver : NULL;
+    am_Link *volatile link = NULL;
+    int up, ret;
+    if (from == NULL || to == NULL || to->constraint != NULL) return AM_FAILED;
+    up = solver->parent != NULL && to->solver == solver->parent;
+    if (!up && to->solver->parent != solver) return AM_FAILED;
+    if ((ret = am_addedit(to, strength)) != AM_OK) return ret;
+    am_try(solver) {
+        link = (am_Link*)am_alloc(solver, &solver->linkpool);
+    } am_catch(solver) {
+        am_deledit(to);
+        return AM_OVERFLOW;
+    } am_end;
+    am_usevariable(from);
+    am_usevariable(to);
+    am_update_vars(solver);
+    link->from = from, link->to = to;
+    link->value = am_value(from);
+    link->strength = strength;
+    link->up = up;
+    link->next = solver->links, solver->links = link;
+    am_suggest(to, link->value);
+    return AM_OK;
+}
+
+AM_API void am_unlink(am_Variable *from, am_Variable *to) {
+    am_Link **pl;
+    if (from == NULL) return;
+    for (pl = &from->solver->links; *pl != NULL; pl = &(*pl)->next) {
+        am_Link *link = *pl;
+        if (link->from != from || link->to != to) continue;
+        *pl = link->next;
+        am_deledit(to);
+        am_delvariable(to);
+        am_delvariable(from);
+        am_free(&from->solver->linkpool, link);
+        return;
+    }
+}
+
+static int am_pushlinks(am_Solver *solver, int up) {
+    am_Link *link;
+    int count = 0;
+    am_update_vars(solver);
+    for (link = solver->links; link != NULL; link = link->next) {
+        am_Float value = am_value(link->from);
+        if (link->up != up || (link->to->constraint != NULL
+                    && am_approx(value, link->value)))
+            continue;
+        if (link->to->constraint == NULL) /* deleted behind our back */
+            am_addedit(link->to, link->strength);
+        am_suggest(link->to, value);
+        link->value = value, ++count;
+        if (!up) link->to->solver->stale = 1;
+    }
+    return count;
+}
+
+static int am_pushdown(am_Solver *solver) {
+    am_Solver *child;
+    int count = am_pushlinks(solver, 0);
+    solver->stale = 0;
+    for (child = solver->children; child != NULL; child = child->sibling)
+        if (child->stale) count += am_pushdown(child);
+    return count;
+}
+
+AM_API int am_propagate(am_Solver *solver) {
+    int count = 0, pushed;
+    if (solver == NULL) return 0;
+    for (;;) { /* the way back down passes the solvers climbed from */
+        count += pushed = am_pushlinks(solver, 1);
+        if (pushed == 0 || solver->parent == NULL) break;
+        solver->stale = 1, solver = solver->parent;
+    }
+    return count + am_pushdown(solver);
+}
+
+/* constraint sharing */
+
+static am_Symbol am_hashkey(unsigned hash)
+{ am_Symbol key; key.id = hash, key.type = AM_EXTERNAL; return key; }
+
+static unsigned am_mixhash(unsigned h)
+{ h ^= h >> 16; h *= 0x45d9f3bu; return h ^ (h >> 16); }
+
+static unsigned am_hashfloat(am_Float f) {
+    if (f > 2e9f || f < -2e9f) return ~0u;
+    return (unsigned)(long)(f < 0.0f ? f - 0.5f : f + 0.5f);
+}
+
+static am_Float am_leadcoef(am_Constraint *cons) {
+    am_Term *term = NULL, *lead = NULL;
+    while (am_nextentry(&cons->expression.terms, (am_Entry**)&term))
+        if (lead == NULL || am_key(term).id < am_key(lead).id) lead = term;
+    if (lead == NULL) return 1.0f;
+    if (cons->relation != AM_EQUAL && lead->multiplier < 0.0f)
+        return -lead->multiplier; /* inequalities scale by positive only */
+    return lead->multiplier;
+}
+
+static unsigned am_hashconstraint(am_Constraint *cons) {
+    am_Float scale = 256.0f / am_leadcoef(cons);
+    am_Term *term = NULL;
+    unsigned h = (cons->relation == AM_EQUAL) + am_hashfloat(cons->strength);
+    h += am_mixhash(~am_hashfloat(cons->expression.constant*scale));
+    while (am_nextentry(&cons->expression.terms, (am_Entry**)&term))
+        h += am_mixhash(am_key(term).id*0x9e3779b1u
+                + am_hashfloat(term->multiplier*scale));
+    h = am_mixhash(h) & 0x3fffffffu;
+    return h ? h : 1;
+}
+
+static int am_sameconstraint(am_Constraint *a, am_Constraint *b) {
+    am_Term *term = NULL;
+    am_Float sa, sb;
+    if ((a->relation == AM_EQUAL) != (b->relation == AM_EQUAL)
+            || a->strength != b->strength
+            || a->expression.terms.count != b->expression.terms.count)
+        return 0;
+    sa = am_leadcoef(a), sb = am_leadcoef(b);
+    if (!am_approx(a->expression.constant/sa, b->expression.constant/sb))
+        return 0;
+    while (am_nextentry(&a->expression.terms, (am_Entry**)&term)) {
+        am_Term *other = (am_Term*)am_gettable(&b->expression.terms, am_key(term));
+        if (other == NULL || !am_approx(term->multiplier/sa, other->multiplier/sb))
+            return 0;
+    }
+    return 1;
+}
+
+static void am_share(am_Constraint *cons, am_Constraint *owner) {
+    cons->marker = owner->marker;
+    cons->other  = owner->other;
+    cons->hash   = owner->hash;
+    cons->shared = owner->shared ? owner->shared : owner;
+    owner->shared = cons;
+}
+
+static int am_unshare(am_Solver *solver, am_Constraint *cons) {
+    am_ConsEntry *ce = (am_ConsEntry*)am_gettable(&solver->shared,
+            am_hashkey(cons->hash));
+    am_Constraint *prev = cons->shared;
+    cons->hash = 0;
+    if (prev == NULL) { /* last reference, row goes away */
+        if (ce && ce->constraint == cons) am_delkey(&solver->shared, &ce->entry);
+        return 0;
+    }
+    while (prev->shared != cons) prev = prev->shared;
+    prev->shared = cons->shared == prev ? NULL : cons->shared;
+    if (ce && ce->constraint == cons) ce->constraint = prev;
+    cons->shared = NULL;
+    cons->marker = cons->other = am_null();
+    return 1;
+}
+
+static int am_insert_constraint(am_Constraint *cons) {
+    am_Solver *solver = cons->solver;
+    int ret, oldsym = solver->symbol_count;
+    unsigned hash = 0;
     am_Row row;
-    if (solver == NULL || cons->marker.id != 0) return AM_FAILED;
+    if (cons->marker.id != 0) return AM_FAILED;
+    am_dual_optimize(solver); /* new rows need a feasible tableau */
+    if (solver->dedup) {
+        am_ConsEntry *ce;
+        hash = am_hashconstraint(cons);
+        ce = (am_ConsEntry*)am_gettable(&solver->shared, am_hashkey(hash));
+        if (ce && am_sameconstraint(cons, ce->constraint))
+        { am_share(cons, ce->constraint); return AM_OK; }
+        if (ce) hash = 0; /* collision, keep a row of its own */
+    }
     row = am_makerow(solver, cons);
     if ((ret = am_try_addrow(solver, &row, cons)) != AM_OK) {
         am_remove_errors(solver, cons);
         solver->symbol_count = oldsym;
     }
     else {
-        am_optimize(solver, &solver->objective);
-        if (solver->auto_update) am_updatevars(solver);
+        if (hash != 0) {
+            ((am_ConsEntry*)am_settable(solver, &solver->shared,
+                am_hashkey(hash)))->constraint = cons;
+            cons->hash = hash;
+        }
     }
     return ret;
 }
 
-AM_API void am_remove(am_Constraint *cons) {
-    am_Solver *solver;
-    am_Symbol marker;
+/* am_profile(): a record for cons, found again through its markers */
+static void am_watch(am_Solver *solver, am_Constraint *cons) {
+    am_Symbol syms[2];
+    int i;
+    if (am_key(cons).id == 0) return;
+    ((am_CostEntry*)am_settable(solver, &solver->costs,
+        am_key(cons)))->profile.constraint = cons;
+    syms[0] = cons->marker, syms[1] = cons->other;
+    for (i = 0; i < 2; ++i)
+        if (syms[i].id != 0)
+            ((am_SymEntry*)am_settable(solver, &solver->costsyms,
+                syms[i]))->sym = am_key(cons);
+}
+
+static double am_blame(am_Solver *solver, am_Constraint *cons) {
+    am_watch(solver, cons);
+    solver->blame = cons;
+    return am_clock();
+}
+
+static void am_unblame(am_Solver *solver, am_Constraint *cons, am_Constraint *outer, double t0) {
+    am_CostEntry *ce = (am_CostEntry*)am_gettable(&solver->costs, am_key(cons));
+    if (ce) ce->profile.seconds += am_clock() - t0;
+    if (cons->marker.id != 0) am_watch(solver, cons);
+    solver->blame = outer;
+}
+
+static int am_add_constraint(am_Constraint *cons) {
+    am_Solver *solver = cons->solver;
+    am_Constraint *outer = solver->blame;
+    double t0 = solver->profiling ? am_blame(solver, cons) : 0.0;
+    int ret = am_insert_constraint(cons);
+    if (ret == AM_OK) {
+        am_primal(solver);
+        if (solver->auto_update) am_update_vars(solver);
+    }
+    if (solver->profiling) am_unblame(solver, cons, outer, t0);
+    return ret;
+}
+
+AM_API int am_add(am_Constraint *cons) {
+    volatile int ret = AM_FAILED;
+    if (cons == NULL) return AM_FAILED;
+    if (cons->solver->tracef) am_traceop(cons->solver, AM_OP_ADD, "c", cons);
+    am_sdt2(add__entry, cons->solver, (unsigned)am_key(cons).id);
+    am_try(cons->solver) {
+        ret = am_add_constraint(cons);
+    } am_catch(cons->solver) {
+        ret = AM_OVERFLOW;
+    } am_end;
+    am_sdt3(add__return, cons->solver, (unsigned)am_key(cons).id, ret);
+    return ret;
+}
+
+static void am_drop_constraint(am_Constraint *cons) {
+    am_Solver *solver = cons->solver;
+    am_Symbol marker = cons->marker;
     am_Row tmp;
-    if (cons == NULL || cons->marker.id == 0) return;
-    solver = cons->solver, marker = cons->marker;
+    if (cons->hash != 0 && am_unshare(solver, cons)) return;
+#ifdef AM_STATIC_CAPACITY
+    if (solver->error != AM_OK) { /* the tableau goes on reset, just forget */
+        cons->marker = cons->other = am_null();
+        cons->shared = NULL, cons->hash = 0;
+        return;
+    }
+#endif
+    am_dual_optimize(solver);
     am_remove_errors(solver, cons);
     if (am_getrow(solver, marker, &tmp) != AM_OK) {
         am_Symbol exit = am_get_leaving_row(solver, marker);
         assert(exit.id != 0);
+        am_sdt4(pivot, solver, (unsigned)marker.id, (unsigned)exit.id, 0);
         am_getrow(solver, exit, &tmp);
         am_solvefor(solver, &tmp, marker, exit);
         am_substitute_rows(solver, marker, &tmp);
     }
     am_freerow(solver, &tmp);
-    am_optimize(solver, &solver->objective);
-    if (solver->auto_update) am_updatevars(solver);
+    am_primal(solver);
+    if (solver->auto_update) am_update_vars(solver);
 }
 
-AM_API int am_setstrength(am_Constraint *cons, am_Float strength) {
-    if (cons == NULL) return AM_FAILED;
-    strength = am_nearzero(strength) ? AM_REQUIRED : strength;
+static void am_remove_constraint(am_Constraint *cons) {
+    am_Solver *solver;
+    am_Constraint *outer;
+    double t0;
+    if (cons == NULL || cons->marker.id == 0) return;
+    solver = cons->solver, outer = solver->blame;
+    if (!solver->profiling || am_error(solver) != AM_OK)
+    { am_drop_constraint(cons); return; }
+    t0 = am_blame(solver, cons);
+    am_drop_constraint(cons);
+    am_unblame(solver, cons, outer, t0);
+}
+
+AM_API void am_remove(am_Constraint *cons) {
+    if (cons == NULL) return;
+    if (cons->solver->tracef) am_traceop(cons->solver, AM_OP_REMOVE, "c", cons);
+    am_sdt2(remove__entry, cons->solver, (unsigned)am_key(cons).id);
+    am_try(cons->solver) {
+        am_remove_constraint(cons);
+    } am_catch(cons->solver) {
+        am_remove_constraint(cons);
+    } am_end;
+    am_sdt2(remove__return, cons->solver, (unsigned)am_key(cons).id);
+}
+
+static void am_watchall(am_Solver *solver) {
+    am_Entry *entry = NULL;
+    while (am_nextentry(&solver->constraints, &entry)) {
+        am_Constraint *cons = ((am_ConsEntry*)entry)->constraint;
+        if (cons->marker.id != 0) am_watch(solver, cons);
+    }
+}
+
+AM_API void am_profile(am_Solver *solver, int enable) {
+    if (solver->tracef) am_traceop(solver, AM_OP_PROFILE, "i", enable);
+    if (!enable) {
+        am_freetable(solver, &solver->costs);
+        am_freetable(solver, &solver->costsyms);
+        solver->profiling = 0, solver->blame = NULL;
+        return;
+    }
+    if (solver->profiling) return;
+    am_try(solver) {
+        am_watchall(solver);
+    } am_catch(solver) {
+        return;
+    } am_end;
+    solver->profiling = 1;
+}
+
+/* by work done, which repeats from run to run; time breaks ties */
+static int am_costlier(const am_Profile *a, const am_Profile *b) {
+    if (a->pivots != b->pivots) return a->pivots > b->pivots;
+    if (a->substitutions != b->substitutions)
+        return a->substitutions > b->substitutions;
+    return a->seconds > b->seconds;
+}
+
+AM_API int am_topcosts(am_Solver *solver, am_Profile *profiles, int count) {
+    am_Entry *entry = NULL;
+    int i, n = 0;
+    if (profiles == NULL) count = 0;
+    while (am_nextentry(&solver->costs, &entry)) {
+        const am_Profile *p = &((am_CostEntry*)entry)->profile;
+        if (n < count) i = n++;
+        else if (count > 0 && am_costlier(p, &profiles[count-1])) i = count-1;
+        else continue;
+        for (; i > 0 && am_costlier(p, &profiles[i-1]); --i)
+            profiles[i] = profiles[i-1];
+        profiles[i] = *p;
+    }
+    return (int)solver->costs.count;
+}
+
+/* strength changes across AM_REQUIRED, done in place */
+
+static void am_delcolumn(am_Solver *solver, am_Symbol sym) {
+    am_Row *row = NULL;
+    while (am_nextentry(&solver->rows, (am_Entry**)&row))
+        am_delterm(row, sym);
+    am_delterm(&solver->objective, sym);
+}
+
+/* give sym the column of old times k, as if both were in the rows added */
+static void am_addcolumn(am_Solver *solver, am_Symbol sym, am_Symbol old, am_Float k) {
+    am_Row *row = (am_Row*)am_gettable(&solver->rows, old);
+    am_Float *multiplier, value;
+    if (row != NULL) { am_addvar(solver, row, sym, -k); return; }
+    while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
+        if ((multiplier = am_getterm(row, old)) == NULL) continue;
+        value = *multiplier*k;
+        am_addvar(solver, row, sym, value);
+    }
+    if ((multiplier = am_getterm(&solver->objective, old)) != NULL) {
+        value = *multiplier*k;
+        am_addvar(solver, &solver->objective, sym, value);
+    }
+}
+
+static void am_renamecolumn(am_Solver *solver, am_Symbol old, am_Symbol sym) {
+    am_Row tmp;
+    if (am_getrow(solver, old, &tmp) == AM_OK)
+    { am_putrow(solver, sym, &tmp); return; }
+    am_addcolumn(solver, sym, old, 1.0f);
+    am_delcolumn(solver, old);
+}
+
+/* pivot a zero-valued sym out of the basis, not for one of the others */
+static void am_unbasic(am_Solver *solver, am_Symbol sym, am_Symbol other) {
+    am_Iter it;
+    am_Row tmp;
+    if (am_getrow(solver, sym, &tmp) != AM_OK) return;
+    it = am_iter(solver, &tmp);
+    while (am_nextterm(&it) && (am_isdummy(it.key) || it.key.id == other.id))
+        ;
+    if (it.key.id == 0) { am_freerow(solver, &tmp); return; } /* sym == 0 */
+    am_sdt4(pivot, solver, (unsigned)it.key.id, (unsigned)sym.id, 0);
+    am_solvefor(solver, &tmp, it.key, sym);
+    am_substitute_rows(solver, it.key, &tmp);
+    am_putrow(solver, it.key, &tmp);
+}
+
+/* the errors of cons must reach zero: minimize them, then drop them; an
+ * equality keeps its other error's column as the dummy marker */
+static int am_require(am_Solver *solver, am_Constraint *cons) {
+    am_Symbol marker = cons->marker, other = cons->other;
+    am_Row errors;
+    int ret;
+    am_dual_optimize(solver);
+    am_inittableau(solver, &errors);
+    if (am_iserror(marker)) am_mergerow(solver, &errors, marker, 1.0f);
+    am_mergerow(solver, &errors, other, 1.0f);
+    am_optimize(solver, &errors);
+    ret = am_nearzero(errors.constant) ? AM_OK : AM_UNSATISFIED;
+    am_freerow(solver, &errors);
+    if (ret != AM_OK) { am_primal(solver); return ret; }
+    if (am_iserror(marker)) {
+        am_unbasic(solver, marker, other);
+        am_delcolumn(solver, marker);
+        am_mergerow(solver, &solver->objective, other, -cons->strength);
+        cons->marker = am_newsymbol(solver, AM_DUMMY);
+        am_renamecolumn(solver, other, cons->marker);
+    }
+    else {
+        am_unbasic(solver, other, am_null());
+        am_delcolumn(solver, other);
+    }
+    cons->other = am_null();
+    if (am_isconstant(&solver->objective))
+        solver->objective.constant = 0.0f;
+    am_primal(solver);
+    return AM_OK;
+}
+
+/* the reverse: give cons the error columns am_makerow() would have */
+static void am_unrequire(am_Solver *solver, am_Constraint *cons, am_Float strength) {
+    am_dual_optimize(solver);
+    if (am_isdummy(cons->marker)) {
+        cons->other = am_newsymbol(solver, AM_ERROR);
+        am_renamecolumn(solver, cons->marker, cons->other);
+        cons->marker = am_newsymbol(solver, AM_ERROR);
+        am_addcolumn(solver, cons->marker, cons->other, -1.0f);
+        am_mergerow(solver, &solver->objective, cons->marker, strength);
+    }
+    else {
+        cons->other = am_newsymbol(solver, AM_ERROR);
+        am_addcolumn(solver, cons->other, cons->marker, -1.0f);
+    }
+    am_mergerow(solver, &solver->objective, cons->other, strength);
+    am_primal(solver);
+}
+
+static int am_set_strength(am_Constraint *cons, am_Float strength) {
+    int ret = AM_OK;
     if (cons->strength == strength) return AM_OK;
-    if (cons->strength >= AM_REQUIRED || strength >= AM_REQUIRED)
-    { am_remove(cons), cons->strength = strength; return am_add(cons); }
+    if (cons->hash != 0) {
+        am_remove_constraint(cons);
+        cons->strength = strength;
+        return am_add_constraint(cons);
+    }
+    if (cons->marker.id != 0
+            && (cons->strength >= AM_REQUIRED) != (strength >= AM_REQUIRED)) {
+        am_Solver *solver = cons->solver;
+        am_checkdense(solver);
+        if (strength < AM_REQUIRED) am_unrequire(solver, cons, strength);
+        else ret = am_require(solver, cons);
+        if (solver->profiling) am_watch(solver, cons);
+        if (solver->auto_update) am_update_vars(solver);
+        if (ret != AM_OK) return ret;
+        cons->strength = strength;
+        return AM_OK;
+    }
+    if (cons->strength >= AM_REQUIRED || strength >= AM_REQUIRED) {
+        cons->strength = strength; /* not in the solver */
+        return AM_OK;
+    }
     if (cons->marker.id != 0) {
         am_Solver *solver = cons->solver;
         am_Float diff = strength - cons->strength;
+        am_dual_optimize(solver);
         am_mergerow(solver, &solver->objective, cons->marker, diff);
         am_mergerow(solver, &solver->objective, cons->other,  diff);
-        am_optimize(solver, &solver->objective);
-        if (solver->auto_update) am_updatevars(solver);
+        am_primal(solver);
+        if (solver->auto_update) am_update_vars(solver);
     }
     cons->strength = strength;
+    return ret;
+}
+
+AM_API int am_setstrength(am_Constraint *cons, am_Float strength) {
+    volatile int ret = AM_OK;
+    if (cons == NULL) return AM_FAILED;
+    if (cons->solver->tracef)
+        am_traceop(cons->solver, AM_OP_SETSTRENGTH, "cf", cons, strength);
+    am_try(cons->solver) {
+        ret = am_set_strength(cons,
+                am_nearzero(strength) ? AM_REQUIRED : strength);
+    } am_catch(cons->solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    return ret;
+}
+
+/* coefficient changes: the row of cons gains delta*var.  Only rows built
+ * from it mention its marker (coefficient k in am_makerow()), so writing
+ * the marker as marker' - f*var, f = -delta/k, updates them in place */
+
+static void am_setterm(am_Constraint *cons, am_Variable *var, am_Float delta) {
+    am_Float *term = am_getterm(&cons->expression, var->sym);
+    int gone = term != NULL && am_nearzero(*term + delta);
+    if (term == NULL) ++var->refcount;
+    am_addvar(cons->solver, &cons->expression, var->sym, delta);
+    if (gone) am_release_variable(var);
+}
+
+/* would the rank-one update keep every restricted row feasible? */
+static int am_rankonefits(am_Solver *solver, am_Constraint *cons, am_Symbol var, am_Float f) {
+    am_Row *row = (am_Row*)am_gettable(&solver->rows, cons->marker);
+    am_Row *vrow = (am_Row*)am_gettable(&solver->rows, var);
+    am_Float *t, c = vrow ? vrow->constant : 0.0f;
+    if (row != NULL) /* a basic dummy would be left to float */
+        return !am_isdummy(cons->marker) && row->constant + f*c >= 0.0f;
+    if (vrow != NULL) {
+        am_Float d = 1.0f + ((t = am_getterm(vrow, cons->marker)) ? *t*f : 0.0f);
+        if (am_nearzero(d)) return 0; /* var would leave the basis */
+        c /= d;
+    }
+    if (c == 0.0f) return 1;
+    row = NULL;
+    while (am_nextentry(&solver->rows, (am_Entry**)&row))
+        if (row != vrow && !am_isexternal(am_key(row))
+                && (t = am_getterm(row, cons->marker)) != NULL
+                && row->constant - *t*f*c < 0.0f)
+            return 0;
+    return 1;
+}
+
+static void am_rankone(am_Solver *solver, am_Constraint *cons, am_Symbol var, am_Float f) {
+    am_Symbol marker = cons->marker;
+    am_Float *t, cost = am_iserror(marker) ? cons->strength : 0.0f;
+    am_Row tmp, *row = (am_Row*)am_gettable(&solver->rows, marker);
+    if (row != NULL) am_mergecolumn(solver, row, var, f);
+    else {
+        if (am_getrow(solver, var, &tmp) == AM_OK) {
+            t = am_getterm(&tmp, marker);
+            am_addvar(solver, &tmp, var, -1.0f - (t ? *t*f : 0.0f));
+            am_sdt4(pivot, solver, (unsigned)var.id, (unsigned)var.id, 0);
+            am_solvefor(solver, &tmp, var, am_null());
+            am_putrow(solver, var, &tmp);
+        }
+        while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
+            if (am_key(row).id == var.id
+                    || (t = am_getterm(row, marker)) == NULL) continue;
+            am_mergecolumn(solver, row, var, -*t*f);
+            if (am_isexternal(am_key(row)))
+                am_markdirty(solver, am_sym2var(solver, am_key(row)));
+        }
+        if ((t = am_getterm(&solver->objective, marker)) != NULL)
+            cost -= *t;
+    }
+    if (cost != 0.0f) am_mergecolumn(solver, &solver->objective, var, cost*f);
+    if (am_isexternal(var)) am_markdirty(solver, am_sym2var(solver, var));
+}
+
+static int am_set_coefficient(am_Constraint *cons, am_Variable *var, am_Float delta) {
+    am_Solver *solver = cons->solver;
+    am_Float f = am_isdummy(cons->marker) ? -delta : delta;
+    if (cons->marker.id == 0) { am_setterm(cons, var, delta); return AM_OK; }
+    am_checkdense(solver);
+    am_dual_optimize(solver);
+    am_optimal(solver);
+    if (cons->hash != 0 || !am_rankonefits(solver, cons, var->sym, f)) {
+        am_remove_constraint(cons); /* shared row, or a bound starts to bite */
+        am_setterm(cons, var, delta);
+        return am_add_constraint(cons);
+    }
+    am_setterm(cons, var, delta);
+    am_rankone(solver, cons, var->sym, f);
+    am_primal(solver);
+    if (solver->auto_update) am_update_vars(solver);
+    return AM_OK;
+}
+
+AM_API int am_setcoefficient(am_Constraint *cons, am_Variable *var, am_Float multiplier) {
+    am_Solver *solver = cons ? cons->solver : NULL;
+    am_Float *term, delta;
+    volatile int ret = AM_OK;
+    if (cons == NULL || var == NULL || var->solver != solver) return AM_FAILED;
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_SETCOEF, "cvf", cons, var, multiplier);
+    if (cons->relation == AM_GREATEQUAL) multiplier = -multiplier;
+    term = am_getterm(&cons->expression, var->sym);
+    delta = multiplier - (term ? *term : 0.0f);
+    if (am_nearzero(delta)) return AM_OK;
+    am_try(solver) {
+        ret = am_set_coefficient(cons, var, delta);
+    } am_catch(solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    return ret;
+}
+
+static int am_insertedit(am_Solver *solver, am_Variable *var, am_Float strength) {
+    am_Constraint *cons = (am_Constraint*)am_alloc(solver, &solver->conspool);
+    int optimize = 1;
+    am_Row row;
+    am_checkdense(solver);
+    am_dual_optimize(solver);
+    memset(cons, 0, sizeof(*cons)); /* not registered in solver->constraints */
+    cons->solver   = solver;
+    cons->strength = strength;
+    cons->relation = AM_EQUAL;
+    am_initrow(&cons->expression);
+    cons->key    = var->key;
+    cons->marker = am_newsymbol(solver, AM_ERROR);
+    cons->other  = am_newsymbol(solver, AM_ERROR);
+    am_addvar(solver, &solver->objective, cons->marker, strength);
+    am_addvar(solver, &solver->objective, cons->other,  strength);
+    am_inittableau(solver, &row);
+    am_value(var); /* lazy values: var->value is read below */
+    if (am_gettable(&solver->rows, var->sym) == NULL
+            && am_getterm(&solver->objective, var->sym) == NULL
+            && am_nearzero(var->value)) {
+        /* var is parametric and already at its value: var = marker - other
+         * keeps the tableau feasible and the objective optimal */
+        var->value = 0.0f;
+        am_addvar(solver, &row, cons->marker,  1.0f);
+        am_addvar(solver, &row, cons->other,  -1.0f);
+        am_substitute_rows(solver, var->sym, &row);
+        am_putrow(solver, var->sym, &row);
+        am_place(solver, var->sym);
+        optimize = 0;
+    }
+    else {
+        row.constant = -var->value;
+        am_mergerow(solver, &row, var->sym, 1.0f);
+        am_addvar(solver, &row, cons->marker, -1.0f);
+        am_addvar(solver, &row, cons->other,   1.0f);
+        if (row.constant < 0.0f) am_multiply(&row, -1.0f);
+        if (am_try_addrow(solver, &row, cons) != AM_OK) assert(0);
+    }
+    am_markdirty(solver, var);
+    ++var->refcount;
+    var->constraint = cons;
+    var->edit_value = var->value;
+    return optimize;
+}
+
+static int am_reoptimize(am_Solver *solver) {
+    am_try(solver) {
+        am_primal(solver);
+    } am_catch(solver) {
+        return AM_OVERFLOW;
+    } am_end;
     return AM_OK;
 }
 
+/* am_insertedit() for the API: <0 on overflow, else whether to optimize */
+static int am_newedit(am_Solver *solver, am_Variable *var, am_Float strength) {
+    volatile int optimize = -1;
+    am_try(solver) {
+        optimize = am_insertedit(solver, var, strength);
+    } am_catch(solver) {
+        optimize = -1;
+    } am_end;
+    return optimize;
+}
+
+/* required edits are clamped: an impossible suggestion must stay feasible */
+static am_Float am_editstrength(am_Float strength)
+{ return am_nearzero(strength) || strength >= AM_STRONG ? AM_STRONG : strength; }
+
 AM_API int am_addedit(am_Variable *var, am_Float strength) {
     am_Solver *solver = var ? var->solver : NULL;
-    am_Constraint *cons;
-    if (var == NULL || var->constraint != NULL) return AM_FAILED;
+    if (var == NULL) return AM_FAILED;
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_ADDEDIT, "vf", var, strength);
+    if (var->constraint != NULL) return AM_FAILED;
     assert(var->sym.id != 0);
-    if (strength >= AM_STRONG) strength = AM_STRONG;
-    cons = am_newconstraint(solver, strength);
-    am_setrelation(cons, AM_EQUAL);
-    am_addterm(cons, var, 1.0f); /* var must have positive signture */
-    am_addconstant(cons, -var->value);
-    if (am_add(cons) != AM_OK) assert(0);
-    var->constraint = cons;
-    var->edit_value = var->value;
+    am_try(solver) {
+        if (am_insertedit(solver, var, am_editstrength(strength)))
+            am_primal(solver);
+    } am_catch(solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    if (solver->auto_update) am_update_vars(solver);
     return AM_OK;
 }
 
-AM_API void am_deledit(am_Variable *var) {
-    if (var == NULL || var->constraint == NULL) return;
-    am_delconstraint(var->constraint);
+AM_API int am_addedits(am_Variable **vars, int count, am_Float strength) {
+    am_Solver *solver = NULL;
+    int i, ret = AM_OK, optimize = 0;
+    if (vars == NULL) return AM_FAILED;
+    for (i = 0; i < count && solver == NULL; ++i)
+        if (vars[i] != NULL) solver = vars[i]->solver;
+    if (solver != NULL && solver->tracef)
+        am_traceop(solver, AM_OP_ADDEDITS, "fV", strength, count, vars);
+    solver = NULL;
+    strength = am_editstrength(strength);
+    for (i = 0; i < count; ++i) {
+        am_Variable *var = vars[i];
+        int inserted;
+        if (var == NULL || var->constraint != NULL
+                || (solver != NULL && var->solver != solver))
+        { ret = AM_FAILED; continue; }
+        solver = var->solver;
+        if ((inserted = am_newedit(solver, var, strength)) < 0)
+            return AM_OVERFLOW;
+        optimize |= inserted;
+    }
+    if (solver == NULL) return ret;
+    if (optimize && am_reoptimize(solver) != AM_OK) return AM_OVERFLOW;
+    if (solver->auto_update) am_update_vars(solver);
+    return ret;
+}
+
+static void am_delete_edit(am_Variable *var) {
+    am_Constraint *cons = var->constraint;
+    if (cons == NULL) return;
+    am_remove_constraint(cons); /* first, may overflow */
     var->constraint = NULL;
     var->edit_value = 0.0f;
+    am_free(&var->solver->conspool, cons);
+    am_release_variable(var); /* may release var */
+}
+
+static void am_remove_edit(am_Variable *var) {
+    am_try(var->solver) {
+        am_delete_edit(var);
+    } am_catch(var->solver) { /* sticky now: nothing allocates */
+        am_delete_edit(var);
+    } am_end;
+}
+
+AM_API void am_deledit(am_Variable *var) {
+    if (var == NULL) return;
+    if (var->solver->tracef)
+        am_traceop(var->solver, AM_OP_DELEDIT, "v", var);
+    am_remove_edit(var);
 }
 
 AM_API void am_suggest(am_Variable *var, am_Float value) {
     am_Solver *solver = var ? var->solver : NULL;
     am_Float delta;
     if (var == NULL) return;
-    if (var->constraint == NULL) {
-        am_addedit(var, AM_MEDIUM);
-        assert(var->constraint != NULL);
+    if (solver->tracef) am_traceop(solver, AM_OP_SUGGEST, "vf", var, value);
+    am_sdt2(suggest__entry, solver, am_variableid(var));
+    am_try(solver) {
+        if (var->constraint == NULL && am_insertedit(solver, var, AM_MEDIUM))
+            solver->unoptimized = 1;
+        am_optimal(solver); /* the dual simplex starts from optimal */
+        delta = value - var->edit_value;
+        var->edit_value = value;
+        am_delta_edit_constant(solver, delta, var->constraint);
+        am_dual(solver);
+    } am_catch(solver) {
+        am_sdt2(suggest__return, solver, am_variableid(var));
+        return;
+    } am_end;
+    if (solver->auto_update) am_update_vars(solver);
+    am_sdt2(suggest__return, solver, am_variableid(var));
+}
+
+static int am_suggest_values(am_Solver *solver, am_Variable **vars, const am_Float *values, int count) {
+    am_try(solver) {
+        int i;
+        am_optimal(solver);
+        for (i = 0; i < count; ++i) { /* infeasible rows queue up for one pass */
+            am_Variable *var = vars[i];
+            am_Float delta;
+            if (var == NULL || var->solver != solver) continue;
+            delta = values[i] - var->edit_value;
+            var->edit_value = values[i];
+            am_delta_edit_constant(solver, delta, var->constraint);
+        }
+        am_dual(solver);
+    } am_catch(solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    return AM_OK;
+}
+
+AM_API void am_suggestmany(am_Variable **vars, const am_Float *values, int count) {
+    am_Solver *solver = NULL;
+    int i, inserted, optimize = 0;
+    if (vars == NULL || values == NULL) return;
+    for (i = 0; i < count && solver == NULL; ++i)
+        if (vars[i] != NULL) solver = vars[i]->solver;
+    if (solver == NULL) return;
+    if (solver->tracef)
+        am_traceop(solver, AM_OP_SUGGESTMANY, "VF", count, vars, count, values);
+    for (i = 0; i < count; ++i) {
+        am_Variable *var = vars[i];
+        if (var != NULL && var->solver == solver && var->constraint == NULL) {
+            if ((inserted = am_newedit(solver, var, AM_MEDIUM)) < 0) return;
+            optimize |= inserted;
+        }
     }
-    delta = value - var->edit_value;
-    var->edit_value = value;
-    am_delta_edit_constant(solver, delta, var->constraint);
-    am_dual_optimize(solver);
-    if (solver->auto_update) am_updatevars(solver);
+    if (optimize) solver->unoptimized = 1;
+    if (am_suggest_values(solver, vars, values, count) != AM_OK) return;
+    if (solver->auto_update) am_update_vars(solver);
+}
+
+
+/* text constraints: one per line or ';', '#' comments to end of line
+ *   expr ('<=' | '==' | '>=') expr ['|' (required|strong|medium|weak|number)]
+ * expr is linear: numbers, names, + - * / and parentheses; names go
+ * through the resolver.  Rows are added as parsed and optimized once. */
+
+typedef struct am_Parser {
+    am_Solver     *solver;
+    am_Resolver   *resolver;
+    void          *ud;
+    am_Constraint *cons;
+    const char    *p;
+} am_Parser;
+
+#define am_isdigit(ch)  ((ch) >= '0' && (ch) <= '9')
+#define am_isalpha(ch)  ((((ch)|0x20) >= 'a' && ((ch)|0x20) <= 'z') || (ch) == '_')
+#define am_isident(ch)  (am_isalpha(ch) || am_isdigit(ch) || (ch) == '.')
+#define am_isend(ch)    ((ch) == '\0' || (ch) == '\n' || (ch) == ';')
+
+static int am_parseexpr(am_Parser *P, am_Float multiplier, int nested);
+
+static void am_skipspace(am_Parser *P) {
+    for (;;) {
+        while (*P->p == ' ' || *P->p == '\t' || *P->p == '\r') ++P->p;
+        if (*P->p != '#') return;
+        while (*P->p != '\0' && *P->p != '\n') ++P->p;
+    }
+}
+
+static int am_parsenumber(am_Parser *P, am_Float *value) {
+    char *end;
+    if (!am_isdigit(*P->p) && !(*P->p == '.' && am_isdigit(P->p[1])))
+        return AM_FAILED;
+    *value = (am_Float)strtod(P->p, &end);
+    P->p = end;
+    return AM_OK;
+}
+
+static int am_parseterm(am_Parser *P, am_Float multiplier) {
+    const char *name = NULL, *group = NULL, *end = NULL;
+    int div = 0;
+    for (;;) {
+        am_Float value;
+        am_skipspace(P);
+        if (*P->p == '(' || am_isalpha(*P->p)) {
+            if (name || group || div) return AM_FAILED;
+            if (*P->p != '(') {
+                for (name = P->p; am_isident(*P->p); ++P->p)
+                    ;
+                end = P->p;
+            }
+            else {
+                int depth = 1;
+                for (group = ++P->p; depth != 0; ++P->p) {
+                    if (am_isend(*P->p)) return AM_FAILED;
+                    depth += (*P->p == '(') - (*P->p == ')');
+                }
+            }
+        }
+        else if (am_parsenumber(P, &value) != AM_OK)
+            return AM_FAILED;
+        else if (!div)
+            multiplier *= value;
+        else if (am_nearzero(value))
+            return AM_FAILED;
+        else
+            multiplier /= value;
+        am_skipspace(P);
+        if (*P->p != '*' && *P->p != '/') break;
+        div = *P->p++ == '/';
+    }
+    if (group != NULL) { /* scale the group by the factors around it */
+        int ret;
+        end = P->p, P->p = group;
+        ret = am_parseexpr(P, multiplier, 1);
+        P->p = end;
+        return ret;
+    }
+    if (name != NULL) {
+        am_Variable *var = P->resolver(P->ud, name, (size_t)(end - name));
+        if (var == NULL || var->solver != P->solver) return AM_FAILED;
+        return am_addterm(P->cons, var, multiplier);
+    }
+    return am_addconstant(P->cons, multiplier);
+}
+
+static int am_parseexpr(am_Parser *P, am_Float multiplier, int nested) {
+    am_Float sign = 1.0f;
+    int ret;
+    am_skipspace(P);
+    if (*P->p == '+' || *P->p == '-') sign = *P->p++ == '-' ? -1.0f : 1.0f;
+    for (;;) {
+        if ((ret = am_parseterm(P, sign*multiplier)) != AM_OK) return ret;
+        if (*P->p != '+' && *P->p != '-') break;
+        sign = *P->p++ == '-' ? -1.0f : 1.0f;
+    }
+    return nested && *P->p != ')' ? AM_FAILED : AM_OK;
+}
+
+static int am_parsestrength(am_Parser *P) {
+    static const struct { const char *name; am_Float strength; } names[] = {
+        { "required", AM_REQUIRED }, { "strong", AM_STRONG },
+        { "medium", AM_MEDIUM }, { "weak", AM_WEAK },
+    };
+    am_Float strength;
+    size_t i, len;
+    am_skipspace(P);
+    if (am_parsenumber(P, &strength) == AM_OK)
+        return am_setstrength(P->cons, strength);
+    for (len = 0; am_isident(P->p[len]); ++len)
+        ;
+    for (i = 0; i < sizeof(names)/sizeof(names[0]); ++i) {
+        if (strlen(names[i].name) == len
+                && memcmp(names[i].name, P->p, len) == 0) {
+            P->p += len;
+            return am_setstrength(P->cons, names[i].strength);
+        }
+    }
+    return AM_FAILED;
+}
+
+static int am_parseconstraint(am_Parser *P) {
+    const char *p;
+    int ret, relation;
+    if ((ret = am_parseexpr(P, 1.0f, 0)) != AM_OK) return ret;
+    p = P->p;
+    if (p[0] == '<' && p[1] == '=')      relation = AM_LESSEQUAL;
+    else if (p[0] == '>' && p[1] == '=') relation = AM_GREATEQUAL;
+    else if (p[0] == '=' && p[1] == '=') relation = AM_EQUAL;
+    else return AM_FAILED;
+    P->p += 2;
+    am_setrelation(P->cons, relation);
+    if ((ret = am_parseexpr(P, 1.0f, 0)) != AM_OK) return ret;
+    if (*P->p == '|') {
+        ++P->p;
+        if ((ret = am_parsestrength(P)) != AM_OK) return ret;
+        am_skipspace(P);
+    }
+    if (!am_isend(*P->p)) return AM_FAILED;
+    if (P->cons->solver->tracef)
+        am_traceop(P->cons->solver, AM_OP_ADD, "c", P->cons);
+    return am_insert_constraint(P->cons);
+}
+
+AM_API int am_parse(am_Solver *solver, const char *text, am_Resolver *resolver, void *ud, const char **errpos) {
+    unsigned first;
+    am_Parser P;
+    volatile int ret = AM_OK;
+    if (solver == NULL || text == NULL || resolver == NULL) return AM_FAILED;
+    first = solver->constraint_count + 1;
+    P.solver = solver, P.resolver = resolver, P.ud = ud, P.p = text;
+    for (;;) {
+        const char *start;
+        am_skipspace(&P);
+        if (*P.p == '\0') break;
+        if (am_isend(*P.p)) { ++P.p; continue; }
+        start = P.p;
+        P.cons = am_newconstraint(solver, AM_REQUIRED);
+        if (P.cons == NULL) ret = am_error(solver) ? AM_OVERFLOW : AM_FAILED;
+        else {
+            am_try(solver) {
+                ret = am_parseconstraint(&P);
+            } am_catch(solver) {
+                ret = AM_OVERFLOW;
+            } am_end;
+            if (ret != AM_OK) am_delconstraint(P.cons);
+        }
+        if (ret != AM_OK) { if (errpos) *errpos = start; break; }
+    }
+    solver->parsed_first = ret == AM_OK ? first : 0;
+    solver->parsed_last  = ret == AM_OK ? solver->constraint_count : 0;
+    if (ret != AM_OK) { /* all or nothing: drop what this text added */
+        am_Symbol key;
+        key.type = AM_EXTERNAL;
+        for (key.id = first; key.id <= solver->constraint_count; ++key.id) {
+            am_ConsEntry *ce = (am_ConsEntry*)am_gettable(&solver->constraints, key);
+            if (ce) am_delconstraint(ce->constraint);
+        }
+    }
+    am_try(solver) {
+        am_primal(solver);
+    } am_catch(solver) {
+        return AM_OVERFLOW;
+    } am_end;
+    if (solver->auto_update) am_update_vars(solver);
+    return ret;
+}
+
+AM_API int am_parsed(am_Solver *solver, am_Constraint **conss, int count) {
+    am_Symbol key;
+    int n = 0;
+    if (solver == NULL || solver->parsed_first == 0) return 0;
+    key.type = AM_EXTERNAL;
+    for (key.id = solver->parsed_first; key.id <= solver->parsed_last; ++key.id) {
+        am_ConsEntry *ce = (am_ConsEntry*)am_gettable(&solver->constraints, key);
+        if (ce == NULL) continue;
+        if (conss != NULL && n < count) conss[n] = ce->constraint;
+        ++n;
+    }
+    return n;
+}
+
+/* symbol compaction */
+
+typedef struct am_Compact {
+    am_Solver *solver;
+    am_Table   map;     /* old symbol -> SymEntry of new symbol */
+    am_Symbol *order;   /* old symbols by new id */
+    unsigned   count;
+} am_Compact;
+
+static am_Symbol am_renumber(am_Compact *c, am_Symbol sym) {
+    am_SymEntry *e;
+    if (sym.id == 0) return sym;
+    if ((e = (am_SymEntry*)am_gettable(&c->map, sym)) != NULL) return e->sym;
+    e = (am_SymEntry*)am_settable(c->solver, &c->map, sym);
+    e->sym.id = ++c->count, e->sym.type = sym.type;
+    c->order[c->count-1] = sym;
+    return e->sym;
+}
+
+static void am_visitrows(am_Compact *c, unsigned start) {
+    for (; start < c->count; ++start) { /* breadth first over basic symbols */
+        am_Row *row = (am_Row*)am_gettable(&c->solver->rows, c->order[start]);
+        am_Term *term = NULL;
+        if (row == NULL) continue;
+        while (am_nextentry(&row->terms, (am_Entry**)&term))
+            am_renumber(c, am_key(term));
+    }
+}
+
+static void am_remaptable(am_Compact *c, am_Table *t, am_Arena *arena) {
+    size_t i, size = t->size*t->entry_size;
+    am_Table nt = *t;
+    if (size == 0) return;
+    nt.arena = t->arena ? arena : NULL;
+    am_allochash(c->solver, &nt, am_hashsize(t, t->count));
+    for (i = 0; i < size; i += t->entry_size) {
+        am_Entry *e = am_index(t->hash, i);
+        if (e->key.id != 0) {
+            am_Entry *ne = am_newkey(c->solver, &nt, am_renumber(c, e->key));
+            if (t->entry_size > sizeof(am_Entry))
+                memcpy(ne + 1, e + 1, t->entry_size-sizeof(am_Entry));
+        }
+    }
+    if (t->arena == NULL) am_freehash(c->solver, t);
+    nt.arena = t->arena; /* old arena is dropped as a whole */
+    *t = nt;
+}
+
+static void am_remapcons(am_Compact *c, am_Constraint *cons) {
+    cons->marker = am_renumber(c, cons->marker);
+    cons->other  = am_renumber(c, cons->other);
+    am_remaptable(c, &cons->expression.terms, NULL);
+}
+
+static void am_compact_symbols(am_Solver *solver) {
+    size_t size = sizeof(am_Symbol)*solver->symbol_count;
+    am_Entry *entry = NULL;
+    am_Arena arena;
+    am_Compact c;
+    unsigned i;
+    if (solver->symbol_count == 0) return;
+    assert(!am_hasinfeasible(solver));
+    am_setdense(solver, 0); /* remapped as hashed rows */
+    if (solver->hinted.size != 0) am_resettable(&solver->hinted);
+    c.solver = solver, c.count = 0;
+    c.order = (am_Symbol*)solver->allocf(solver->ud, NULL, size, 0);
+    am_inittable(&c.map, sizeof(am_SymEntry));
+
+    /* number symbols so rows reached from one another sit together */
+    while (am_nextentry(&solver->objective.terms, &entry))
+        am_renumber(&c, am_key(entry));
+    am_visitrows(&c, 0);
+    while (am_nextentry(&solver->rows, &entry)) {
+        unsigned start = c.count;
+        am_renumber(&c, am_key(entry));
+        am_visitrows(&c, start);
+    }
+    while (am_nextentry(&solver->vars, &entry))
+        am_renumber(&c, am_key(entry));
+
+    /* rebuild the tableau into a fresh arena, in new symbol order */
+    am_initarena(&arena);
+    am_remaptable(&c, &solver->rows, NULL);
+    for (i = 0; i < c.count; ++i) {
+        am_Symbol sym = am_renumber(&c, c.order[i]);
+        am_Row *row = (am_Row*)am_gettable(&solver->rows, sym);
+        if (row != NULL) am_remaptable(&c, &row->terms, &arena);
+    }
+    am_remaptable(&c, &solver->objective.terms, &arena);
+    am_freearena(solver, &solver->arena);
+    solver->arena = arena;
+
+    am_remaptable(&c, &solver->vars, NULL);
+    while (am_nextentry(&solver->vars, &entry)) {
+        am_Variable *var = ((am_VarEntry*)entry)->variable;
+        var->sym = am_key(entry);
+        var->dirty_next = am_renumber(&c, var->dirty_next);
+        if (var->constraint) am_remapcons(&c, var->constraint);
+    }
+    solver->dirty_vars = am_renumber(&c, solver->dirty_vars);
+    while (am_nextentry(&solver->constraints, &entry))
+        am_remapcons(&c, ((am_ConsEntry*)entry)->constraint);
+    solver->symbol_count = c.count;
+    solver->republish = solver->published != NULL; /* slots follow the ids */
+
+    /* shared constraints hash their (renumbered) terms */
+    if (solver->shared.size != 0) am_resettable(&solver->shared);
+    while (am_nextentry(&solver->constraints, &entry)) {
+        am_Constraint *cons = ((am_ConsEntry*)entry)->constraint;
+        am_ConsEntry *ce;
+        if (cons->hash == 0) continue;
+        cons->hash = am_hashconstraint(cons);
+        ce = (am_ConsEntry*)am_settable(solver, &solver->shared,
+                am_hashkey(cons->hash));
+        if (ce->constraint == NULL) ce->constraint = cons;
+    }
+    if (solver->costsyms.size != 0) am_resettable(&solver->costsyms);
+    while (am_nextentry(&solver->costs, &entry))
+        am_watch(solver, ((am_CostEntry*)entry)->profile.constraint);
+
+    am_freetable(solver, &c.map);
+    solver->allocf(solver->ud, c.order, 0, size);
+    am_setdense(solver, am_densefits(solver));
+}
+
+AM_API void am_compact(am_Solver *solver) {
+    if (solver->tracef) am_traceop(solver, AM_OP_COMPACT, "");
+    am_try(solver) {
+        am_dual_optimize(solver);
+        am_compact_symbols(solver);
+    } am_catch(solver) {
+        return;
+    } am_end;
 }
 
 AM_NS_END
@@ -0,0 +1,270 @@
+#ifndef amoeba_hpp
+#define amoeba_hpp
+
+/* C++11 wrapper over amoeba.h: move-only handles and expression templates.
+ *
+ *   amoeba::Solver solver;
+ *   amoeba::Variable x(solver), y(solver), z(solver);
+ *   amoeba::Constraint c(solver, x + 2*y - 10 <= z, AM_STRONG);
+ *   solver.add(c);
+ *
+ * A relation is flattened at compile time into one fixed-size array of
+ * terms and a constant, and given to am_addterms() in one call.  Define
+ * AM_IMPLEMENTATION in one translation unit as with amoeba.h.  Handles
+ * must not outlive their solver. */
+
+#include "amoeba.h"
+
+#include <type_traits>
+#include <utility>
+
+namespace amoeba {
+
+class Solver;
+class Variable;
+class Constraint;
+
+namespace detail {
+
+struct VarTerm {
+    static const int size = 1;
+    am_Variable *var;
+    void fill(am_Variable **vars, am_Float *ms, am_Float k, am_Float &) const
+    { *vars = var, *ms = k; }
+};
+
+struct ConstTerm {
+    static const int size = 0;
+    am_Float value;
+    void fill(am_Variable **, am_Float *, am_Float k, am_Float &c) const
+    { c += k*value; }
+};
+
+template <class E> struct Scaled {
+    static const int size = E::size;
+    E expr;
+    am_Float k;
+    void fill(am_Variable **vars, am_Float *ms, am_Float k2, am_Float &c) const
+    { expr.fill(vars, ms, k*k2, c); }
+};
+
+template <class L, class R> struct Sum {
+    static const int size = L::size + R::size;
+    L lhs;
+    R rhs;
+    am_Float sign; /* -1 for a difference */
+    void fill(am_Variable **vars, am_Float *ms, am_Float k, am_Float &c) const {
+        lhs.fill(vars, ms, k, c);
+        rhs.fill(vars + L::size, ms + L::size, k*sign, c);
+    }
+};
+
+template <class L, class R> struct Relation {
+    L lhs;
+    R rhs;
+    int op;
+};
+
+template <class T> struct Node { typedef T type; };
+template <> struct Node<Variable> { typedef VarTerm type; };
+
+template <class T> struct IsNode : std::false_type {};
+template <> struct IsNode<VarTerm> : std::true_type {};
+template <> struct IsNode<ConstTerm> : std::true_type {};
+template <class E> struct IsNode<Scaled<E> > : std::true_type {};
+template <class L, class R> struct IsNode<Sum<L, R> > : std::true_type {};
+
+template <class T> struct IsTerm
+    : std::integral_constant<bool, IsNode<T>::value
+        || std::is_same<T, Variable>::value> {};
+
+template <class T> struct IsOperand
+    : std::integral_constant<bool, IsTerm<T>::value
+        || std::is_arithmetic<T>::value> {};
+
+/* at least one side is a term, so plain numbers keep their operators */
+template <class A, class B, class T> struct EnableOp
+    : std::enable_if<IsOperand<A>::value && IsOperand<B>::value
+        && (IsTerm<A>::value || IsTerm<B>::value), T> {};
+
+template <class A> struct NodeOf {
+    typedef typename std::conditional<std::is_arithmetic<A>::value,
+            ConstTerm, typename Node<A>::type>::type type;
+};
+
+template <class E> typename std::enable_if<IsNode<E>::value,
+    const E &>::type node(const E &e) { return e; }
+inline VarTerm node(const Variable &v);
+template <class T> typename std::enable_if<std::is_arithmetic<T>::value,
+    ConstTerm>::type node(T value)
+{ ConstTerm t = { (am_Float)value }; return t; }
+
+template <class A, class B> struct Op {
+    typedef typename NodeOf<A>::type L;
+    typedef typename NodeOf<B>::type R;
+    typedef Sum<L, R> sum;
+    typedef Relation<L, R> relation;
+};
+
+} /* namespace detail */
+
+class Solver {
+public:
+    explicit Solver(am_Allocf *allocf = nullptr, void *ud = nullptr)
+        : solver_(am_newsolver(allocf, ud)) {}
+    Solver(Solver &&other) : solver_(other.solver_) { other.solver_ = nullptr; }
+    Solver &operator=(Solver &&other)
+    { std::swap(solver_, other.solver_); return *this; }
+    Solver(const Solver &) = delete;
+    Solver &operator=(const Solver &) = delete;
+    ~Solver() { if (solver_) am_delsolver(solver_); }
+
+    am_Solver *get() const { return solver_; }
+
+    int  add(const Constraint &cons);
+    void remove(const Constraint &cons);
+
+    int  addedit(const Variable &var, am_Float strength = AM_MEDIUM);
+    void suggest(const Variable &var, am_Float value);
+    void deledit(const Variable &var);
+
+    void updatevars()             { am_updatevars(solver_); }
+    void autoupdate(bool enable)  { am_autoupdate(solver_, enable); }
+    void lazyvalues(bool enable)  { am_lazyvalues(solver_, enable); }
+    void reset(bool clear = false) { am_resetsolver(solver_, clear); }
+
+private:
+    am_Solver *solver_;
+};
+
+class Variable {
+public:
+    explicit Variable(Solver &solver) : var_(am_newvariable(solver.get())) {}
+    Variable(Variable &&other) : var_(other.var_) { other.var_ = nullptr; }
+    Variable &operator=(Variable &&other)
+    { std::swap(var_, other.var_); return *this; }
+    Variable(const Variable &) = delete;
+    Variable &operator=(const Variable &) = delete;
+    ~Variable() { if (var_) am_delvariable(var_); }
+
+    am_Variable *get() const { return var_; }
+    int          id() const { return am_variableid(var_); }
+    am_Float     value() const { return am_value(var_); }
+
+private:
+    am_Variable *var_;
+};
+
+class Constraint {
+public:
+    explicit Constraint(Solver &solver, am_Float strength = AM_REQUIRED)
+        : cons_(am_newconstraint(solver.get(), strength)) {}
+
+    template <class L, class R>
+    Constraint(Solver &solver, const detail::Relation<L, R> &rel,
+            am_Float strength = AM_REQUIRED)
+        : cons_(am_newconstraint(solver.get(), strength)) {
+        const int n = L::size + R::size;
+        am_Variable *vars[n > 0 ? n : 1];
+        am_Float ms[n > 0 ? n : 1], constant = 0.0f;
+        rel.lhs.fill(vars, ms, 1.0f, constant);
+        rel.rhs.fill(vars + L::size, ms + L::size, -1.0f, constant);
+        am_addterms(cons_, vars, ms, n);
+        am_addconstant(cons_, constant);
+        am_setrelation(cons_, rel.op);
+    }
+
+    Constraint(Constraint &&other) : cons_(other.cons_) { other.cons_ = nullptr; }
+    Constraint &operator=(Constraint &&other)
+    { std::swap(cons_, other.cons_); return *this; }
+    Constraint(const Constraint &) = delete;
+    Constraint &operator=(const Constraint &) = delete;
+    ~Constraint() { if (cons_) am_delconstraint(cons_); }
+
+    am_Constraint *get() const { return cons_; }
+    bool added() const { return am_hasconstraint(cons_) != 0; }
+    int  strength(am_Float strength) { return am_setstrength(cons_, strength); }
+    int  coefficient(const Variable &var, am_Float multiplier)
+    { return am_setcoefficient(cons_, var.get(), multiplier); }
+
+private:
+    am_Constraint *cons_;
+};
+
+inline int  Solver::add(const Constraint &cons) { return am_add(cons.get()); }
+inline void Solver::remove(const Constraint &cons) { am_remove(cons.get()); }
+
+inline int Solver::addedit(const Variable &var, am_Float strength)
+{ return am_addedit(var.get(), strength); }
+inline void Solver::suggest(const Variable &var, am_Float value)
+{ am_suggest(var.get(), value); }
+inline void Solver::deledit(const Variable &var)
+{ am_deledit(var.get()); }
+
+inline detail::VarTerm detail::node(const Variable &v)
+{ VarTerm t = { v.get() }; return t; }
+
+/* expression operators */
+
+template <class A, class B>
+typename detail::EnableOp<A, B, typename detail::Op<A, B>::sum>::type
+operator+(const A &a, const B &b)
+{ typename detail::Op<A, B>::sum s = { detail::node(a), detail::node(b), 1.0f }; return s; }
+
+template <class A, class B>
+typename detail::EnableOp<A, B, typename detail::Op<A, B>::sum>::type
+operator-(const A &a, const B &b)
+{ typename detail::Op<A, B>::sum s = { detail::node(a), detail::node(b), -1.0f }; return s; }
+
+template <class A>
+typename std::enable_if<detail::IsTerm<A>::value,
+    detail::Scaled<typename detail::NodeOf<A>::type> >::type
+operator*(const A &a, am_Float k)
+{ detail::Scaled<typename detail::NodeOf<A>::type> s = { detail::node(a), k }; return s; }
+
+template <class A>
+typename std::enable_if<detail::IsTerm<A>::value,
+    detail::Scaled<typename detail::NodeOf<A>::type> >::type
+operator*(am_Float k, const A &a) { return a * k; }
+
+template <class A>
+typename std::enable_if<detail::IsTerm<A>::value,
+    detail::Scaled<typename detail::NodeOf<A>::type> >::type
+operator/(const A &a, am_Float k) { return a * (1.0f/k); }
+
+template <class A>
+typename std::enable_if<detail::IsTerm<A>::value,
+    detail::Scaled<typename detail::NodeOf<A>::type> >::type
+operator-(const A &a) { return a * -1.0f; }
+
+/* relations */
+
+template <class A, class B>
+typename detail::EnableOp<A, B, typename detail::Op<A, B>::relation>::type
+operator<=(const A &a, const B &b)
+{ typename detail::Op<A, B>::relation r = { detail::node(a), detail::node(b), AM_LESSEQUAL }; return r; }
+
+template <class A, class B>
+typename detail::EnableOp<A, B, typename detail::Op<A, B>::relation>::type
+operator==(const A &a, const B &b)
+{ typename detail::Op<A, B>::relation r = { detail::node(a), detail::node(b), AM_EQUAL }; return r; }
+
+template <class A, class B>
+typename detail::EnableOp<A, B, typename detail::Op<A, B>::relation>::type
+operator>=(const A &a, const B &b)
+{ typename detail::Op<A, B>::relation r = { detail::node(a), detail::node(b), AM_GREATEQUAL }; return r; }
+
+/* the nodes live in detail, let argument lookup find the operators there */
+namespace detail {
+using amoeba::operator+;
+using amoeba::operator-;
+using amoeba::operator*;
+using amoeba::operator/;
+using amoeba::operator<=;
+using amoeba::operator==;
+using amoeba::operator>=;
+} /* namespace detail */
+
+} /* namespace amoeba */
+
+#endif /* amoeba_hpp */
@@ -272,20 +272,58 @@ local SimplexSolver = meta "SimplexSolver" do
 
 -- implements
 
+local function mark_dirty(self, var)
+   if var.is_external then self.dirty_vars[var] = true end
+end
+
 local function update_external_variables(self)
-   for var in pairs(self.vars) do
-      local row = self.rows[var]
+   local rows, dirty = self.rows, self.dirty_vars
+   for var in pairs(dirty) do
+      local row = rows[var]
       var.value = row and row.constant or 0.0
+      dirty[var] = nil
+   end
+end
+
+-- columns[var] is a superset of the basic variables whose rows contain
+-- var: keys are added whenever a row gains terms and dropped lazily
+local function add_column(self, key, row)
+   local columns = self.columns
+   for var in row:iter_vars() do
+      default(columns, var)[key] = true
+   end
+end
+
+local function column(self, var)
+   local col, rows = self.columns[var], self.rows
+   return function(_, key)
+      if not col then return end
+      while true do
+         key = next(col, key)
+         if key == nil then return end
+         local row = rows[key]
+         if row and row[var] then return key, row end
+         col[key] = nil
+      end
    end
 end
 
+local function set_row(self, key, row)
+   self.rows[key] = row
+   if row then add_column(self, key, row) end
+   mark_dirty(self, key)
+end
+
 local function substitute_out(self, var, expr)
-   for k, row in pairs(self.rows) do
+   for k, row in column(self, var) do
       row:substitute_out(var, expr)
+      add_column(self, k, expr)
+      mark_dirty(self, k)
       if k.is_restricted and row.constant < 0.0 then
          self.infeasible_rows[#self.infeasible_rows+1] = k
       end
    end
+   self.columns[var] = nil
    self.objective:substitute_out(var, expr)
 end
 
@@ -303,9 +341,9 @@ local function optimize(self, objective)
 
       local r = 0.0
       local min_ratio = math.huge
-      for var, row in pairs(self.rows) do
+      for var, row in column(self, entry) do
          local multiplier = row[entry]
-         if multiplier and var.is_pivotable and multiplier < 0.0 then
+         if var.is_pivotable and multiplier < 0.0 then
             r = -row.constant / multiplier
             if r < min_ratio or (approx(r, min_ratio) and
                                  var.id < exit.id) then
@@ -317,13 +355,13 @@ local function optimize(self, objective)
 
       -- do pivot
       local row = self.rows[exit]
-      self.rows[exit] = nil
+      set_row(self, exit, nil)
       row:solve_for(entry, exit)
       substitute_out(self, entry, row)
       if objective ~= self.objective then
          objective:substitute_out(entry, row)
       end
-      self.rows[entry] = row
+      set_row(self, entry, row)
    end
 end
 
@@ -382,8 +420,8 @@ local function choose_subject(self, expr, var1, var2)
    for k, v in expr:iter_vars() do
       if k.is_external then return k end
    end
-   if var1 and var1.is_pivotable then return var1 end
-   if var2 and var2.is_pivotable then return var2 end
+   if var1 and var1.is_pivotable and expr[var1] < 0.0 then return var1 end
+   if var2 and var2.is_pivotable and expr[var2] < 0.0 then return var2 end
    for k, v in expr:iter_vars() do
       if not k.is_dummy then return nil end -- no luck
    end
@@ -397,10 +435,10 @@ local function add_with_artificial_variable(self, expr)
    local a = make_variable(self, 'artificial')
    self.last_varid = self.last_varid - 1
 
-   self.rows[a] = expr
+   set_row(self, a, expr)
    optimize(self, expr)
    local row = self.rows[a]
-   self.rows[a] = nil
+   set_row(self, a, nil)
 
    local success = near_zero(expr.constant)
    if row then
@@ -411,10 +449,11 @@ local function add_with_artificial_variable(self, expr)
       if not entering then return false end
 
       row:solve_for(entering, a)
-      self.rows[entering] = row
+      set_row(self, entering, row)
    end
    
-   for var, row in pairs(self.rows) do row[a] = nil end
+   for _, row in column(self, a) do row[a] = nil end
+   self.columns[a] = nil
    self.objective[a] = nil
    return success
 end
@@ -422,18 +461,16 @@ end
 local function get_marker_leaving_row(self, marker)
    local r1, r2 = math.huge, math.huge
    local first, second, third
-   for var, row in pairs(self.rows) do
+   for var, row in column(self, marker) do
       local multiplier = row[marker]
-      if multiplier then
-         if var.is_external then
-            third = var
-         elseif multiplier < 0.0 then
-            local r = -row.constant / multiplier
-            if r < r1 then r1 = r; first = var end
-         else
-            local r = row.constant / multiplier
-            if r < r2 then r2 = r; second = var end
-         end
+      if var.is_external then
+         third = var
+      elseif multiplier < 0.0 then
+         local r = -row.constant / multiplier
+         if r < r1 then r1 = r; first = var end
+      else
+         local r = row.constant / multiplier
+         if r < r2 then r2 = r; second = var end
       end
    end
    return first or second or third
@@ -456,8 +493,9 @@ local function delta_edit_constant(self, delta, var1, var2)
       end
       return
    end
-   for var, row in pairs(self.rows) do
-      row.constant = row.constant + (row[var1] or 0.0)*delta
+   for var, row in column(self, var1) do
+      row.constant = row.constant + row[var1]*delta
+      mark_dirty(self, var)
       if var.is_restricted and row.constant < 0.0 then
          self.infeasible_rows[#self.infeasible_rows+1] = var
       end
@@ -486,10 +524,10 @@ local function dual_optimize(self)
          assert(entry, "dual optimize failed")
 
          -- pivot
-         self.rows[exit] = nil
+         set_row(self, exit, nil)
          row:solve_for(entry, exit)
          substitute_out(self, entry, row)
-         self.rows[entry] = row
+         set_row(self, entry, row)
       end
    end
 end
@@ -512,6 +550,8 @@ function SimplexSolver.new()
 
    self.objective       = Expression.new()
    self.rows            = {}
+   self.columns         = {}
+   self.dirty_vars      = {}
    self.infeasible_rows = {}
 
    return setmetatable(self, SimplexSolver)
@@ -569,7 +609,7 @@ function SimplexSolver:addconstraint(cons, ...)
    if subject then
       expr:solve_for(subject)
       substitute_out(self, subject, expr)
-      self.rows[subject] = expr
+      set_row(self, subject, expr)
    elseif err then
       return nil, err
    elseif not add_with_artificial_variable(self, expr) then
@@ -602,12 +642,12 @@ function SimplexSolver:delconstraint(cons)
 
    local row = self.rows[info.marker]
    if row then
-      self.rows[info.marker] = nil
+      set_row(self, info.marker, nil)
    else
       local var = assert(get_marker_leaving_row(self, info.marker),
                          "failed to find leaving row")
       local row = self.rows[var]
-      self.rows[var] = nil
+      set_row(self, var, nil)
       row:solve_for(info.marker, var)
       substitute_out(self, info.marker, row)
    end
@@ -641,16 +681,38 @@ function SimplexSolver:deledit(var)
    end
 end
 
-function SimplexSolver:suggest(var, value)
+local function suggest_value(self, var, value)
    local info = self.edits[var]
-   if not info then self:addedit(var); info = self.edits[var] end
    local delta = value - info.prev_constant
    info.prev_constant = value
    delta_edit_constant(self, delta, info.plus, info.minus)
+end
+
+function SimplexSolver:suggest(var, value)
+   if not self.edits[var] then self:addedit(var) end
+   suggest_value(self, var, value)
    dual_optimize(self)
    update_external_variables(self)
 end
 
+-- { [var] = value, ... } or vars, values: one dual optimize for all
+function SimplexSolver:suggestmany(vars, values)
+   if values == nil then
+      for var in pairs(vars) do
+         if not self.edits[var] then self:addedit(var) end
+      end
+      for var, value in pairs(vars) do suggest_value(self, var, value) end
+   else
+      for i = 1, #vars do
+         if not self.edits[vars[i]] then self:addedit(vars[i]) end
+      end
+      for i = 1, #vars do suggest_value(self, vars[i], values[i]) end
+   end
+   dual_optimize(self)
+   update_external_variables(self)
+   return self
+end
+
 function SimplexSolver:setstrength(cons, strength)
    local info = self.constraints[cons]
    if not info then cons.weight = strength end
@@ -681,8 +743,9 @@ function SimplexSolver:set_constant(cons, constant)
    info.prev_constant = constant
 
    if info.marker.is_slack or cons.is_required then
-      for var, row in pairs(self.rows) do
-         row:add((row[info.marker] or 0.0) * -delta)
+      for var, row in column(self, info.marker) do
+         row:add(row[info.marker] * -delta)
+         mark_dirty(self, var)
          if var.is_restricted and row.constant < 0.0 then
             self.infeasible_rows[#self.infeasible_rows+1] = var
          end
@@ -0,0 +1,514 @@
+-- LuaJIT FFI binding for amoeba.h, same surface as the `amoeba` C module.
+-- Needs amoeba.h built as a shared library with the default (double)
+-- am_Float, e.g.:
+--    gcc -shared -fPIC -O2 -fno-strict-aliasing -DAM_IMPLEMENTATION \
+--        -xc amoeba.h -o libamoeba.so
+-- Set the AMOEBA_FFI_LIB environment variable to load it from elsewhere.
+local ffi = require "ffi"
+
+ffi.cdef [[
+typedef double am_Float;
+
+typedef struct am_Solver     am_Solver;
+typedef struct am_Variable   am_Variable;
+typedef struct am_Constraint am_Constraint;
+
+typedef am_Variable *am_Resolver (void *ud, const char *name, size_t len);
+
+am_Solver *am_newsolver   (void *allocf, void *ud);
+void       am_resetsolver (am_Solver *solver, int clear_constraints);
+void       am_delsolver   (am_Solver *solver);
+void       am_compact     (am_Solver *solver);
+void       am_updatevars  (am_Solver *solver);
+void       am_defer       (am_Solver *solver, int defer);
+int        am_step        (am_Solver *solver, int max_pivots);
+
+int  am_add    (am_Constraint *cons);
+void am_remove (am_Constraint *cons);
+
+int  am_addedit     (am_Variable *var, am_Float strength);
+void am_suggest     (am_Variable *var, am_Float value);
+void am_suggestmany (am_Variable **vars, const am_Float *values, int count);
+void am_deledit     (am_Variable *var);
+
+am_Variable *am_newvariable (am_Solver *solver);
+void         am_delvariable (am_Variable *var);
+int          am_variableid  (am_Variable *var);
+am_Float     am_value       (am_Variable *var);
+
+am_Constraint *am_newconstraint (am_Solver *solver, am_Float strength);
+void am_resetconstraint (am_Constraint *cons);
+void am_delconstraint   (am_Constraint *cons);
+
+int am_addterm     (am_Constraint *cons, am_Variable *var, am_Float multiplier);
+int am_setrelation (am_Constraint *cons, int relation);
+int am_addconstant (am_Constraint *cons, am_Float constant);
+int am_setstrength (am_Constraint *cons, am_Float strength);
+
+int am_mergeconstraint (am_Constraint *cons, am_Constraint *other, am_Float multiplier);
+int am_setcoefficient  (am_Constraint *cons, am_Variable *var, am_Float multiplier);
+
+int am_parse  (am_Solver *solver, const char *text, am_Resolver *resolver, void *ud, const char **errpos);
+int am_parsed (am_Solver *solver, am_Constraint **conss, int count);
+]]
+
+local C = ffi.load(os.getenv "AMOEBA_FFI_LIB" or "amoeba")
+
+local AM_OK, AM_UNSATISFIED, AM_UNBOUND = 0, -2, -3
+
+local relations = {
+   ["<="] = 1, ["=="] = 2, [">="] = 3,
+   le     = 1, eq     = 2, ge     = 3,
+}
+
+local strengths = {
+   required = 1000000000.0,
+   strong   = 1000000.0,
+   medium   = 1000.0,
+   weak     = 1.0,
+}
+
+local function meta(name)
+   local t = {}
+   t.__name  = name
+   t.__index = t
+   return t
+end
+
+local function checkstrength(s, default)
+   if s == nil then return default end
+   return strengths[s] or tonumber(s)
+       or error(("invalid strength value '%s'"):format(tostring(s)), 3)
+end
+
+local function checkrelation(op)
+   return relations[op]
+       or error(("invalid relation operator: '%s'"):format(tostring(op)), 3)
+end
+
+local Solver, Variable, Constraint, Expression do
+
+Solver     = meta "amoeba.Solver"
+Variable   = meta "amoeba.Variable"
+Constraint = meta "amoeba.Constraint"
+Expression = meta "amoeba.Expression"
+
+-- Expressions are plain Lua arrays of (item, multiplier) pairs plus a
+-- constant; nothing is allocated on the C side until a relation is made.
+
+local function solverof(a, b)
+   return type(a) == "table" and a.S or type(b) == "table" and b.S
+       or error("variable/constraint/expression expected", 3)
+end
+
+local function lookup(S, name)
+   return S.vars[name]
+       or error(("variable named '%s' not exists"):format(tostring(name)), 4)
+end
+
+local function checkvar(S, var)
+   if type(var) ~= "table" then var = lookup(S, var) end
+   return var.var or error("invalid variable", 3)
+end
+
+local function append(e, item, m)
+   if type(item) == "string" then item = lookup(e.S, item) end
+   if type(item) == "number" then
+      e.constant = e.constant + item*m
+      return e
+   end
+   local mt = getmetatable(item)
+   if mt == Expression then
+      e.constant = e.constant + item.constant*m
+      for i = 1, #item, 2 do
+         e[#e+1] = item[i]
+         e[#e+1] = item[i+1]*m
+      end
+   elseif mt == Variable or mt == Constraint then
+      e[#e+1] = item
+      e[#e+1] = m
+   else
+      error("number/variable/constraint/expression expected", 3)
+   end
+   return e
+end
+
+local function newexpr(S, a, ma, b, mb)
+   local e = setmetatable({ S = S, constant = 0.0 }, Expression)
+   append(e, a, ma)
+   if b ~= nil then append(e, b, mb) end
+   return e
+end
+
+local function perform(S, cons, item, m)
+   if type(item) == "string" then item = lookup(S, item) end
+   if type(item) == "number" then
+      return C.am_addconstant(cons, item*m)
+   end
+   local mt = getmetatable(item)
+   if mt == Variable then
+      return C.am_addterm(cons, item.var or error("invalid variable", 3), m)
+   elseif mt == Constraint then
+      return C.am_mergeconstraint(cons,
+         item.cons or error("invalid constraint", 3), m)
+   elseif mt == Expression then
+      local ret = C.am_addconstant(cons, item.constant*m)
+      for i = 1, #item, 2 do
+         if ret ~= AM_OK then break end
+         ret = perform(S, cons, item[i], item[i+1]*m)
+      end
+      return ret
+   end
+   error("number/variable/constraint/expression expected", 3)
+end
+
+local function makecons(S, op, a, b, strength)
+   local cons = Constraint.new(S, checkstrength(strength, strengths.required))
+   perform(S, cons.cons, a, 1.0)
+   C.am_setrelation(cons.cons, checkrelation(op))
+   perform(S, cons.cons, b, 1.0)
+   return cons
+end
+
+local function neg(a)       return newexpr(a.S, a, -1.0) end
+local function add(a, b)    return newexpr(solverof(a, b), a, 1.0, b, 1.0) end
+local function sub(a, b)    return newexpr(solverof(a, b), a, 1.0, b, -1.0) end
+local function mul(a, b)
+   if type(a) == "number" then return newexpr(b.S, b, a) end
+   if type(b) == "number" then return newexpr(a.S, a, b) end
+   error("attempt to multiply two expression", 2)
+end
+local function div(a, b)
+   if type(b) == "number" then return newexpr(a.S, a, 1.0/b) end
+   error("attempt to divide two expression", 2)
+end
+
+local function le(a, b) return makecons(solverof(a, b), "<=", a, b) end
+local function eq(a, b) return makecons(solverof(a, b), "==", a, b) end
+local function ge(a, b) return makecons(solverof(a, b), ">=", a, b) end
+
+for _, mt in ipairs { Variable, Constraint, Expression } do
+   mt.__unm, mt.__add, mt.__sub, mt.__mul, mt.__div = neg, add, sub, mul, div
+   mt.le, mt.eq, mt.ge = le, eq, ge
+end
+
+function Expression:__tostring()
+   local t = { ("amoeba.Expression: [%g"):format(self.constant) }
+   for i = 1, #self, 2 do
+      local item, m = self[i], self[i+1]
+      t[#t+1] = m < 0.0 and " - " or " + "
+      if math.abs(m) ~= 1.0 then t[#t+1] = ("%g*"):format(math.abs(m)) end
+      t[#t+1] = getmetatable(item) == Variable and item.name or tostring(item)
+   end
+   t[#t+1] = "]"
+   return table.concat(t)
+end
+
+-- variable
+
+function Variable.new(S, name)
+   if name ~= nil then
+      local var = S.vars[name]
+      if var then return var end
+      if type(name) == "number" then
+         error(("variable#%d not exists"):format(name), 2)
+      end
+   end
+   local ptr = C.am_newvariable(S.solver)
+   local id = C.am_variableid(ptr)
+   local self = setmetatable({
+      var  = ffi.gc(ptr, S.freevar),
+      S    = S,
+      name = name or "v"..id,
+   }, Variable)
+   S.vars[self.name] = self
+   S.vars[id] = self
+   return self
+end
+
+function Variable:delete()
+   local var = self.var
+   if var == nil then return end
+   self.var = nil
+   self.S.vars[self.name] = nil
+   self.S.vars[C.am_variableid(var)] = nil
+   self.S.freevar(ffi.gc(var, nil))
+end
+
+function Variable:value()
+   local var = self.var or error("invalid variable", 2)
+   C.am_updatevars(self.S.solver)
+   return C.am_value(var)
+end
+
+function Variable:__tostring()
+   if self.var == nil then return "amoeba.Variable: deleted" end
+   return ("amoeba.Variable: %s = %g"):format(self.name, self:value())
+end
+
+-- constraint
+
+local function wrapcons(S, ptr)
+   local self = setmetatable({ cons = ffi.gc(ptr, S.freecons), S = S },
+                             Constraint)
+   S.cons[self] = true
+   return self
+end
+
+function Constraint.new(S, strength)
+   return wrapcons(S, C.am_newconstraint(S.solver, strength))
+end
+
+function Constraint:delete()
+   local cons = self.cons
+   if cons == nil then return end
+   self.cons = nil
+   self.S.cons[self] = nil
+   self.S.freecons(ffi.gc(cons, nil))
+end
+
+function Constraint:reset()
+   C.am_resetconstraint(self.cons or error("invalid constraint", 2))
+   return self
+end
+
+function Constraint:add(other)
+   local cons, ret = self.cons or error("invalid constraint", 2)
+   if relations[other] and other:match "^[<>=]" then
+      ret = C.am_setrelation(cons, relations[other])
+   else
+      ret = perform(self.S, cons, other, 1.0)
+   end
+   if ret ~= AM_OK then error("constraint has been added to solver!", 2) end
+   return self
+end
+Constraint.__call = Constraint.add
+
+function Constraint:relation(op)
+   local cons = self.cons or error("invalid constraint", 2)
+   if C.am_setrelation(cons, checkrelation(op)) ~= AM_OK then
+      error("constraint has been added to solver!", 2)
+   end
+   return self
+end
+
+function Constraint:strength(strength)
+   local cons = self.cons or error("invalid constraint", 2)
+   strength = checkstrength(strength, strengths.required)
+   if C.am_setstrength(cons, strength) ~= AM_OK then
+      error("constraint has been added to solver!", 2)
+   end
+   return self
+end
+
+function Constraint:coefficient(var, multiplier)
+   local cons = self.cons or error("invalid constraint", 2)
+   local ret = C.am_setcoefficient(cons, checkvar(self.S, var),
+                                   tonumber(multiplier)
+                                   or error("number expected", 2))
+   if ret == AM_UNSATISFIED then error("constraint unsatisfied", 2) end
+   if ret ~= AM_OK then error("constraint coefficient not set", 2) end
+   return self
+end
+
+function Constraint:__tostring()
+   if self.cons == nil then return "amoeba.Constraint: deleted" end
+   return ("amoeba.Constraint: %s"):format(tostring(self.cons))
+end
+
+-- solver
+
+-- Variables and constraints hold solver-owned memory: their finalizers
+-- must not run after the solver is gone, whatever order the GC picks.
+-- The closures share a `state` table, never the solver cdata itself, so
+-- the finalizer table does not keep the solver alive.
+function Solver.new()
+   local state = { alive = true }
+   local self = setmetatable({
+      state  = state,
+      vars   = setmetatable({}, { __mode = "v" }),
+      cons   = setmetatable({}, { __mode = "k" }),
+      loaded = {}, -- S:load() constraints, kept until S:reset(true)
+      size   = 0,
+      freevar = function(var)
+         if state.alive then C.am_delvariable(var) end
+      end,
+      freecons = function(cons)
+         if state.alive then C.am_delconstraint(cons) end
+      end,
+   }, Solver)
+   self.solver = ffi.gc(C.am_newsolver(nil, nil), function(solver)
+      if state.alive then state.alive = false; C.am_delsolver(solver) end
+   end)
+   return self
+end
+
+function Solver:var(name) return Variable.new(self, name) end
+
+function Solver:constraint(a, b, c, d)
+   if b ~= nil then return makecons(self, a, b, c, d) end
+   return Constraint.new(self, checkstrength(a, strengths.required))
+end
+
+function Solver:delete()
+   if not self.state.alive then return end
+   for _, var in pairs(self.vars) do var.var = nil end
+   for cons in pairs(self.cons) do cons.cons = nil end
+   self.state.alive = false
+   C.am_delsolver(ffi.gc(self.solver, nil))
+end
+
+function Solver:__tostring()
+   return ("amoeba.Solver: %s"):format(tostring(self.solver))
+end
+
+function Solver:reset(clear)
+   C.am_resetsolver(self.solver, clear and 1 or 0)
+   if clear then self.loaded = {} end
+   return self
+end
+
+function Solver:compact()
+   local vars = {}
+   for k, var in pairs(self.vars) do
+      if type(k) == "number" then self.vars[k] = nil end
+      vars[var] = true
+   end
+   C.am_compact(self.solver)
+   for var in pairs(vars) do
+      if var.var ~= nil then self.vars[C.am_variableid(var.var)] = var end
+   end
+   return self
+end
+
+local function isopts(opts)
+   return type(opts) == "table" and getmetatable(opts) == nil
+end
+
+function Solver:addconstraint(cons, a, b, strength, opts)
+   if getmetatable(cons) == Constraint then opts = a
+   else
+      if isopts(strength) then opts, strength = strength, nil end
+      cons = makecons(self, cons, a, b, strength)
+   end
+   local defer = isopts(opts) and opts.defer
+   if defer then C.am_defer(self.solver, 1) end
+   local ret = C.am_add(cons.cons or error("invalid constraint", 2))
+   if defer then C.am_defer(self.solver, 0) end
+   if ret == AM_UNSATISFIED then error("constraint unsatisfied", 2) end
+   if ret == AM_UNBOUND then error("constraint unbound", 2) end
+   return self
+end
+
+function Solver:delconstraint(cons)
+   C.am_remove(cons.cons or error("invalid constraint", 2))
+   return self
+end
+
+function Solver:addedit(var, strength)
+   C.am_addedit(checkvar(self, var), checkstrength(strength, strengths.medium))
+   return self
+end
+
+function Solver:deledit(var)
+   C.am_deledit(checkvar(self, var))
+   return self
+end
+
+function Solver:suggest(var, value, opts)
+   local defer = isopts(opts) and opts.defer
+   if defer then C.am_defer(self.solver, 1) end
+   C.am_suggest(checkvar(self, var), value)
+   if defer then C.am_defer(self.solver, 0) end
+   return self
+end
+
+function Solver:solve_step(max_pivots)
+   return C.am_step(self.solver, max_pivots or -1) ~= 0
+end
+
+local function checkvalue(value)
+   if type(value) ~= "number" then
+      error(("number expected for value, got %s"):format(type(value)), 3)
+   end
+   return value
+end
+
+local function reserve(S, count)
+   if count > S.size then
+      S.size = math.max(count, S.size*2)
+      S.scratch_vars = ffi.new("am_Variable*[?]", S.size)
+      S.scratch_values = ffi.new("am_Float[?]", S.size)
+   end
+   return S.scratch_vars, S.scratch_values
+end
+
+function Solver:suggestmany(vars, values)
+   local count = 0
+   if values == nil then -- { [var] = value, ... }
+      for _ in pairs(vars) do count = count + 1 end
+      local pv, pf = reserve(self, count)
+      local i = 0
+      for var, value in pairs(vars) do
+         pv[i], pf[i], i = checkvar(self, var), checkvalue(value), i + 1
+      end
+      C.am_suggestmany(pv, pf, count)
+   else -- vars, values
+      count = #vars
+      local pv, pf = reserve(self, count)
+      for i = 1, count do
+         pv[i-1], pf[i-1] = checkvar(self, vars[i]), checkvalue(values[i])
+      end
+      C.am_suggestmany(pv, pf, count)
+   end
+   return self
+end
+
+function Solver:values(vars, out)
+   out = out or {}
+   C.am_updatevars(self.solver)
+   for i = 1, #vars do
+      out[i] = C.am_value(checkvar(self, vars[i]))
+   end
+   return out
+end
+
+-- Returns the variables by name and the constraints in text order; the
+-- solver keeps the constraints alive until deleted or S:reset(true).
+-- Errors must not unwind through the callback: the parse fails and rolls
+-- back instead, then the error is raised.
+function Solver:load(text)
+   local loaded, err = {}, nil
+   local resolve = ffi.cast("am_Resolver*", function(_, name, len)
+      local ok, var = pcall(function()
+         name = ffi.string(name, len)
+         return loaded[name] or Variable.new(self, name)
+      end)
+      if not ok then err = var; return nil end
+      loaded[name] = var
+      return var.var
+   end)
+   local errpos = ffi.new("const char*[1]")
+   local ret = C.am_parse(self.solver, text, resolve, nil, errpos)
+   resolve:free()
+   if err ~= nil then error(err, 2) end
+   if ret == AM_OK then
+      local count = C.am_parsed(self.solver, nil, 0)
+      local conss, list = ffi.new("am_Constraint*[?]", count), {}
+      C.am_parsed(self.solver, conss, count)
+      for i = 1, count do
+         list[i] = wrapcons(self, conss[i-1])
+         self.loaded[#self.loaded+1] = list[i]
+      end
+      return loaded, list
+   end
+   local offset = errpos[0] - ffi.cast("const char*", text)
+   local _, line = text:sub(1, offset):gsub("\n", "")
+   error(("%s at line %d"):format(ret == AM_UNSATISFIED and
+         "constraint unsatisfied" or ret == AM_UNBOUND and
+         "constraint unbound" or "syntax error", line + 1), 2)
+end
+
+end
+
+return Solver
@@ -0,0 +1,664 @@
+#define AM_IMPLEMENTATION
+#include "amoeba.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WIDGETS 200
+#define ROUNDS  200
+#define HANDLES 32
+
+typedef struct Layout {
+    am_Solver     *solver;
+    am_Variable   *x[WIDGETS], *w[WIDGETS];
+    am_Constraint *cons[WIDGETS*4];
+    int            count;
+} Layout;
+
+static double now(void)
+{ return (double)clock() / CLOCKS_PER_SEC; }
+
+static am_Constraint *add(Layout *l, am_Float strength,
+        am_Variable *a, am_Float ma, int relation, am_Float constant,
+        am_Variable *b, am_Float mb, am_Variable *c, am_Float mc)
+{
+    am_Constraint *cons = am_newconstraint(l->solver, strength);
+    am_addterm(cons, a, ma);
+    am_setrelation(cons, relation);
+    am_addconstant(cons, constant);
+    if (b) am_addterm(cons, b, mb);
+    if (c) am_addterm(cons, c, mc);
+    l->cons[l->count++] = cons;
+    return cons;
+}
+
+/* a row of widgets: x[i+1] >= x[i] + w[i] + 5, w[i] >= 10, w[i] == 50 */
+static void build_layout(Layout *l) {
+    int i;
+    l->count = 0;
+    for (i = 0; i < WIDGETS; ++i) {
+        l->x[i] = am_newvariable(l->solver);
+        l->w[i] = am_newvariable(l->solver);
+    }
+    add(l, AM_REQUIRED, l->x[0], 1.0f, AM_EQUAL, 0.0f, NULL, 0, NULL, 0);
+    for (i = 0; i < WIDGETS; ++i) {
+        add(l, AM_REQUIRED, l->w[i], 1.0f, AM_GREATEQUAL, 10.0f, NULL, 0, NULL, 0);
+        add(l, AM_WEAK, l->w[i], 1.0f, AM_EQUAL, 50.0f, NULL, 0, NULL, 0);
+        if (i + 1 < WIDGETS)
+            add(l, AM_REQUIRED, l->x[i+1], 1.0f, AM_GREATEQUAL, 5.0f,
+                    l->x[i], 1.0f, l->w[i], 1.0f);
+    }
+    add(l, AM_STRONG, l->x[WIDGETS-1], 1.0f, AM_LESSEQUAL, 8000.0f,
+            l->w[WIDGETS-1], -1.0f, NULL, 0);
+}
+
+static void add_layout(Layout *l) {
+    int i, ret = AM_OK;
+    for (i = 0; i < l->count; ++i)
+        ret |= am_add(l->cons[i]);
+    assert(ret == AM_OK);
+    (void)ret;
+}
+
+static void bench_reset(void) {
+    Layout l;
+    double t0, t_clear = 0.0, t_reset = 0.0, t_fresh = 0.0;
+    int i;
+
+    l.solver = am_newsolver(NULL, NULL);
+    build_layout(&l);
+    add_layout(&l);
+    for (i = 0; i < ROUNDS; ++i) {
+        t0 = now();
+        am_resetsolver(l.solver, 1);
+        t_clear += now() - t0;
+        add_layout(&l);
+        am_suggest(l.w[0], 80.0f);
+        t_reset += now() - t0;
+    }
+    am_delsolver(l.solver);
+
+    for (i = 0; i < ROUNDS; ++i) {
+        t0 = now();
+        l.solver = am_newsolver(NULL, NULL);
+        build_layout(&l);
+        add_layout(&l);
+        am_suggest(l.w[0], 80.0f);
+        am_delsolver(l.solver);
+        t_fresh += now() - t0;
+    }
+
+    printf("reset only:    %8.3f ms/round\n", t_clear * 1000.0 / ROUNDS);
+    printf("reset+rebuild: %8.3f ms/round\n", t_reset * 1000.0 / ROUNDS);
+    printf("fresh solver:  %8.3f ms/round\n", t_fresh * 1000.0 / ROUNDS);
+}
+
+static void bench_edits(void) {
+    Layout l;
+    double t0, t_single = 0.0, t_batch = 0.0;
+    int i, j;
+
+    l.solver = am_newsolver(NULL, NULL);
+    build_layout(&l);
+    add_layout(&l);
+    for (i = 0; i < ROUNDS; ++i) {
+        t0 = now();
+        for (j = 0; j < HANDLES; ++j)
+            am_addedit(l.x[j], AM_STRONG);
+        am_suggest(l.x[1], 60.0f + (i & 7));
+        for (j = 0; j < HANDLES; ++j)
+            am_deledit(l.x[j]);
+        t_single += now() - t0;
+    }
+    for (i = 0; i < ROUNDS; ++i) {
+        t0 = now();
+        am_addedits(l.x, HANDLES, AM_STRONG);
+        am_suggest(l.x[1], 60.0f + (i & 7));
+        for (j = 0; j < HANDLES; ++j)
+            am_deledit(l.x[j]);
+        t_batch += now() - t0;
+    }
+    am_delsolver(l.solver);
+
+    printf("edit cycle:    %8.3f ms/round (%d handles)\n",
+            t_single * 1000.0 / ROUNDS, HANDLES);
+    printf("batch edits:   %8.3f ms/round\n", t_batch * 1000.0 / ROUNDS);
+}
+
+static void bench_suggestmany(void) {
+    Layout l;
+    am_Float values[HANDLES];
+    double t0, t_single = 0.0, t_batch = 0.0;
+    int i, j;
+
+    l.solver = am_newsolver(NULL, NULL);
+    build_layout(&l);
+    add_layout(&l);
+    am_addedits(l.x, HANDLES, AM_STRONG);
+    for (i = 0; i < ROUNDS; ++i) {
+        t0 = now();
+        for (j = 0; j < HANDLES; ++j)
+            am_suggest(l.x[j], j*60.0f + (i & 7));
+        t_single += now() - t0;
+    }
+    for (i = 0; i < ROUNDS; ++i) {
+        t0 = now();
+        for (j = 0; j < HANDLES; ++j)
+            values[j] = j*60.0f + (i & 7);
+        am_suggestmany(l.x, values, HANDLES);
+        t_batch += now() - t0;
+    }
+    am_delsolver(l.solver);
+
+    printf("suggest loop:  %8.3f ms/round (%d handles)\n",
+            t_single * 1000.0 / ROUNDS, HANDLES);
+    printf("suggestmany:   %8.3f ms/round\n", t_batch * 1000.0 / ROUNDS);
+}
+
+static void bench_dedup(void) {
+    Layout l;
+    am_Constraint *copies[WIDGETS*4];
+    double t0, t_plain = 0.0, t_dedup = 0.0;
+    size_t rows[2];
+    int i, j, dedup;
+
+    for (dedup = 0; dedup < 2; ++dedup) {
+        l.solver = am_newsolver(NULL, NULL);
+        am_dedup(l.solver, dedup);
+        build_layout(&l);
+        for (j = 0; j < l.count; ++j) /* the generator emits each rule twice */
+            copies[j] = am_cloneconstraint(l.cons[j], 0.0f);
+        for (i = 0; i < ROUNDS/10; ++i) {
+            t0 = now();
+            add_layout(&l);
+            for (j = 0; j < l.count; ++j)
+                am_add(copies[j]);
+            am_suggest(l.w[0], 80.0f);
+            *(dedup ? &t_dedup : &t_plain) += now() - t0;
+            rows[dedup] = l.solver->rows.count;
+            am_resetsolver(l.solver, 1);
+        }
+        am_delsolver(l.solver);
+    }
+
+    printf("duplicated:    %8.3f ms/round (%d rows)\n",
+            t_plain * 1000.0 / (ROUNDS/10), (int)rows[0]);
+    printf("deduplicated:  %8.3f ms/round (%d rows)\n",
+            t_dedup * 1000.0 / (ROUNDS/10), (int)rows[1]);
+}
+
+static double edit_rounds(Layout *l) {
+    double t0 = now();
+    int i, j;
+    for (i = 0; i < ROUNDS; ++i) {
+        am_addedits(l->x, HANDLES, AM_STRONG);
+        for (j = 0; j < 8; ++j)
+            am_suggest(l->x[1], 60.0f + j*(i & 7));
+        for (j = 0; j < HANDLES; ++j)
+            am_deledit(l->x[j]);
+    }
+    return (now() - t0) * 1000.0 / ROUNDS;
+}
+
+static void bench_compact(void) {
+    Layout l;
+    double t_before, t_after;
+    unsigned symbols;
+    int i, j;
+
+    l.solver = am_newsolver(NULL, NULL);
+    build_layout(&l);
+    add_layout(&l);
+    srand(1);
+    for (i = 0; i < 20; ++i) { /* churn: scatter ids in use */
+        for (j = 0; j < l.count; ++j) {
+            am_Constraint *cons = l.cons[rand() % l.count];
+            am_remove(cons);
+            am_add(cons);
+        }
+    }
+    edit_rounds(&l); /* warm up */
+    symbols = l.solver->symbol_count;
+    t_before = edit_rounds(&l);
+    am_compact(l.solver);
+    printf("scattered:     %8.3f ms/round (%u symbols)\n", t_before, symbols);
+    symbols = l.solver->symbol_count;
+    t_after = edit_rounds(&l);
+    printf("compacted:     %8.3f ms/round (%u symbols)\n", t_after, symbols);
+    am_delsolver(l.solver);
+}
+
+#ifdef AM_USE_OPENHASH
+# define TABLES "open"
+#else
+# define TABLES "chained"
+#endif
+
+static void bench_tables(void) {
+    Layout l;
+    double t0, t_lookup, t_churn;
+    int i;
+
+    l.solver = am_newsolver(NULL, NULL);
+    build_layout(&l);
+    add_layout(&l);
+    edit_rounds(&l); /* warm up */
+    t_lookup = edit_rounds(&l);
+    srand(1);
+    t0 = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        am_Constraint *cons = l.cons[rand() % l.count];
+        am_remove(cons);
+        am_add(cons);
+    }
+    t_churn = (now() - t0) * 1000.0 / ROUNDS;
+    am_delsolver(l.solver);
+
+    printf("%-7s edits: %8.3f ms/round\n", TABLES, t_lookup);
+    printf("%-7s churn: %8.3f ms/readd (%d constraints)\n", TABLES, t_churn,
+            l.count);
+}
+
+/* drag HANDLES widgets together, squeezing and stretching their spacing */
+static void bench_dual(void) {
+    static const char *names[] = { "lifo", "worst" };
+    am_Variable *handles[HANDLES];
+    am_Float values[HANDLES];
+    am_Stats stats;
+    Layout l;
+    double t0;
+    int i, j, policy;
+
+    for (policy = AM_DUAL_LIFO; policy <= AM_DUAL_WORST; ++policy) {
+        l.solver = am_newsolver(NULL, NULL);
+        am_dualpolicy(l.solver, policy);
+        build_layout(&l);
+        add_layout(&l);
+        for (j = 0; j < HANDLES; ++j)
+            handles[j] = l.x[j*(WIDGETS/HANDLES)];
+        am_addedits(handles, HANDLES, AM_STRONG);
+        am_stats(l.solver, &stats);
+        t0 = now();
+        for (i = 0; i < ROUNDS; ++i) {
+            am_Float spacing = 30.0f + (i % 20)*20.0f;
+            for (j = 0; j < HANDLES; ++j)
+                values[j] = (i & 1)*100.0f + j*spacing;
+            am_suggestmany(handles, values, HANDLES);
+        }
+        t0 = now() - t0;
+        i = (int)stats.dual_pivots;
+        am_stats(l.solver, &stats);
+        printf("dual %-5s     %8.3f ms/drag (%.1f dual pivots)\n",
+                names[policy], t0 * 1000.0 / ROUNDS,
+                (double)((int)stats.dual_pivots - i) / ROUNDS);
+        am_delsolver(l.solver);
+    }
+}
+
+/* auto update on, only a few widgets are on screen and read back */
+static void bench_lazy(void) {
+    static const char *names[] = { "eager", "lazy" };
+    am_Float sum = 0.0f;
+    Layout l;
+    double t0;
+    int i, j, lazy;
+
+    for (lazy = 0; lazy < 2; ++lazy) {
+        l.solver = am_newsolver(NULL, NULL);
+        am_autoupdate(l.solver, 1);
+        am_lazyvalues(l.solver, lazy);
+        build_layout(&l);
+        add_layout(&l);
+        am_addedit(l.w[0], AM_STRONG);
+        t0 = now();
+        for (i = 0; i < ROUNDS*10; ++i) {
+            am_suggest(l.w[0], 20.0f + (i & 63));
+            for (j = 0; j < 8; ++j)
+                sum += am_value(l.x[j]);
+        }
+        printf("%-5s values:  %8.3f ms/round\n", names[lazy],
+                (now() - t0) * 1000.0 / (ROUNDS*10));
+        am_delsolver(l.solver);
+    }
+    (void)sum;
+}
+
+/* a "lock" toggled per frame: in place vs remove, setstrength, add */
+static void bench_lock(void) {
+    static const char *names[] = { "readd", "inplace" };
+    Layout l;
+    am_Constraint *lock;
+    double t0;
+    int i, inplace;
+
+    for (inplace = 0; inplace < 2; ++inplace) {
+        l.solver = am_newsolver(NULL, NULL);
+        build_layout(&l);
+        add_layout(&l);
+        lock = add(&l, AM_MEDIUM, l.w[WIDGETS/2], 1.0f, AM_EQUAL, 80.0f,
+                NULL, 0, NULL, 0);
+        am_add(lock);
+        t0 = now();
+        for (i = 0; i < ROUNDS*10; ++i) {
+            am_Float strength = (i & 1) ? AM_MEDIUM : AM_REQUIRED;
+            if (!inplace) am_remove(lock);
+            am_setstrength(lock, strength);
+            if (!inplace) am_add(lock);
+        }
+        printf("lock %-7s   %8.3f ms/toggle\n", names[inplace],
+                (now() - t0) * 1000.0 / (ROUNDS*10));
+        am_delsolver(l.solver);
+    }
+}
+
+/* an aspect ratio animates: in place vs remove, reset the term, add */
+static void bench_ratio(void) {
+    static const char *names[] = { "readd", "inplace" };
+    Layout l;
+    am_Constraint *ratio;
+    double t0;
+    int i, inplace;
+
+    for (inplace = 0; inplace < 2; ++inplace) {
+        l.solver = am_newsolver(NULL, NULL);
+        build_layout(&l);
+        add_layout(&l);
+        ratio = add(&l, AM_REQUIRED, l.w[WIDGETS/2], 1.0f, AM_EQUAL, 0.0f,
+                l.w[WIDGETS/2+1], 1.0f, NULL, 0);
+        am_add(ratio);
+        t0 = now();
+        for (i = 0; i < ROUNDS*10; ++i) {
+            am_Float r = 0.5f + (i % 64) / 32.0f;
+            if (!inplace) am_remove(ratio);
+            am_setcoefficient(ratio, l.w[WIDGETS/2+1], r);
+            if (!inplace) am_add(ratio);
+        }
+        printf("ratio %-7s  %8.3f ms/frame\n", names[inplace],
+                (now() - t0) * 1000.0 / (ROUNDS*10));
+        am_delsolver(l.solver);
+    }
+}
+
+/* a theme change: every cell's solver gets new widths, then all solve */
+#define CELLS 32
+
+static void bench_solveall(void) {
+    static Layout cells[CELLS];
+    am_Solver *solvers[CELLS];
+    double t0;
+    int i, j, threads;
+
+    for (threads = 1; threads <= 4; threads *= 4) {
+        for (i = 0; i < CELLS; ++i) {
+            cells[i].solver = solvers[i] = am_newsolver(NULL, NULL);
+            build_layout(&cells[i]);
+            add_layout(&cells[i]);
+            am_addedit(cells[i].w[0], AM_STRONG);
+            am_defer(solvers[i], 1);
+        }
+        t0 = now();
+        for (j = 0; j < ROUNDS/10; ++j) {
+            for (i = 0; i < CELLS; ++i)
+                am_suggest(cells[i].w[0], 20.0f + ((i + j) & 63));
+            am_solveall(solvers, CELLS, threads, NULL);
+        }
+        printf("solveall x%d:   %8.3f ms/round (%d solvers)\n", threads,
+                (now() - t0) * 1000.0 / (ROUNDS/10), CELLS);
+        for (i = 0; i < CELLS; ++i) am_delsolver(solvers[i]);
+    }
+}
+
+/* the next frame's layout built fresh: cold vs from the last frame's basis */
+static void build_keyed(Layout *l, int round) {
+    int i;
+    build_layout(l);
+    for (i = 0; i < WIDGETS; ++i) {
+        am_setvariablekey(l->x[i], 2*i + 1);
+        am_setvariablekey(l->w[i], 2*i + 2);
+    }
+    for (i = 0; i < l->count; ++i)
+        am_setconstraintkey(l->cons[i], 2*WIDGETS + i + 1);
+    am_addconstant(l->cons[l->count-1], (am_Float)-(round % 50));
+    add_layout(l);
+    am_step(l->solver, -1);
+}
+
+static void bench_warmstart(void) {
+    static const char *names[] = { "cold", "warm" };
+    am_Hint *hints;
+    am_Stats stats;
+    Layout l;
+    double t0;
+    size_t pivots;
+    int i, count, warm;
+
+    l.solver = am_newsolver(NULL, NULL);
+    am_defer(l.solver, 1);
+    build_keyed(&l, 0);
+    count = am_getbasis(l.solver, NULL, 0);
+    hints = (am_Hint*)malloc(sizeof(am_Hint)*count);
+    am_getbasis(l.solver, hints, count);
+    am_delsolver(l.solver);
+
+    for (warm = 0; warm < 2; ++warm) {
+        t0 = now(), pivots = 0;
+        for (i = 0; i < ROUNDS; ++i) {
+            l.solver = am_newsolver(NULL, NULL);
+            am_defer(l.solver, 1);
+            if (warm) am_setbasis(l.solver, hints, count);
+            build_keyed(&l, i);
+            am_stats(l.solver, &stats);
+            pivots += stats.pivots + stats.dual_pivots;
+            am_delsolver(l.solver);
+        }
+        printf("build %-7s   %8.3f ms/frame, %lu pivots\n", names[warm],
+                (now() - t0) * 1000.0 / ROUNDS, (unsigned long)(pivots / ROUNDS));
+    }
+    free(hints);
+}
+
+static int find(Layout *l, am_Constraint *cons) {
+    int i;
+    for (i = 0; i < l->count; ++i)
+        if (l->cons[i] == cons) return i;
+    return -1;
+}
+
+/* what am_profile() costs while building the layout */
+static void bench_profile(void) {
+    static const char *names[] = { "off", "on" };
+    am_Profile top;
+    Layout l;
+    double t0;
+    int i, on;
+
+    for (on = 0; on < 2; ++on) {
+        t0 = now();
+        for (i = 0; i < ROUNDS/10; ++i) {
+            l.solver = am_newsolver(NULL, NULL);
+            am_profile(l.solver, on);
+            build_layout(&l);
+            add_layout(&l);
+            am_remove(l.cons[l.count-1]);
+            am_add(l.cons[l.count-1]);
+            if (on && i == 0 && am_topcosts(l.solver, &top, 1) > 0)
+                printf("costliest: cons[%d], %lu pivots\n",
+                        find(&l, top.constraint), (unsigned long)top.pivots);
+            am_delsolver(l.solver);
+        }
+        printf("profile %-5s   %8.3f ms/build\n", names[on],
+                (now() - t0) * 1000.0 / (ROUNDS/10));
+    }
+}
+
+/* GROUPS rows of widgets side by side under a strong total width: one
+ * flat solver, or a parent placing the groups and a child per group */
+#define GROUPS 20
+
+static am_Variable *build_group(am_Solver *solver, am_Variable **w, int n) {
+    am_Variable *x = am_newvariable(solver), *next;
+    am_Constraint *cons = am_newconstraint(solver, AM_REQUIRED);
+    int i;
+    am_addterm(cons, x, 1.0f);
+    am_setrelation(cons, AM_EQUAL);
+    am_add(cons);
+    for (i = 0; i < n; ++i) {
+        w[i] = am_newvariable(solver);
+        next = am_newvariable(solver);
+        cons = am_newconstraint(solver, AM_REQUIRED);
+        am_addterm(cons, w[i], 1.0f);
+        am_setrelation(cons, AM_GREATEQUAL);
+        am_addconstant(cons, 10.0f);
+        am_add(cons);
+        cons = am_newconstraint(solver, AM_WEAK);
+        am_addterm(cons, w[i], 1.0f);
+        am_setrelation(cons, AM_EQUAL);
+        am_addconstant(cons, 50.0f);
+        am_add(cons);
+        cons = am_newconstraint(solver, AM_REQUIRED);
+        am_addterm(cons, next, 1.0f);
+        am_setrelation(cons, AM_GREATEQUAL);
+        am_addterm(cons, x, 1.0f);
+        am_addterm(cons, w[i], 1.0f);
+        am_addconstant(cons, 5.0f);
+        am_add(cons);
+        x = next;
+    }
+    return x; /* the group's extent */
+}
+
+static void bench_nested(void) {
+    static const char *names[] = { "flat", "nested" };
+    am_Solver *parent, *child[GROUPS];
+    am_Variable *w[GROUPS][WIDGETS/GROUPS], *end[GROUPS], *start[GROUPS];
+    am_Variable *pref[GROUPS], *width[GROUPS];
+    am_Constraint *cons;
+    size_t pivots;
+    double t0;
+    int i, j, nested;
+
+    for (nested = 0; nested < 2; ++nested) {
+        parent = am_newsolver(NULL, NULL);
+        for (j = 0; j < GROUPS; ++j) {
+            child[j] = nested ? am_newsolver(NULL, NULL) : parent;
+            if (nested) am_nest(child[j], parent);
+            end[j] = build_group(child[j], w[j], WIDGETS/GROUPS);
+            start[j] = am_newvariable(parent);
+            cons = am_newconstraint(parent, AM_REQUIRED);
+            am_addterm(cons, start[j], 1.0f);
+            am_setrelation(cons, AM_GREATEQUAL);
+            if (j > 0) {
+                am_addterm(cons, start[j-1], 1.0f);
+                am_addterm(cons, pref[j-1], 1.0f);
+            }
+            am_add(cons);
+            pref[j] = nested ? am_newvariable(parent) : end[j];
+            if (!nested) continue;
+            cons = am_newconstraint(parent, AM_REQUIRED); /* its minimum */
+            am_addterm(cons, pref[j], 1.0f);
+            am_setrelation(cons, AM_GREATEQUAL);
+            am_addconstant(cons, 15.0f * (WIDGETS/GROUPS));
+            am_add(cons);
+            width[j] = am_newvariable(child[j]);
+            cons = am_newconstraint(child[j], AM_STRONG);
+            am_addterm(cons, end[j], 1.0f);
+            am_setrelation(cons, AM_LESSEQUAL);
+            am_addterm(cons, width[j], 1.0f);
+            am_add(cons);
+            am_link(end[j], pref[j], AM_MEDIUM);
+            am_link(pref[j], width[j], AM_STRONG);
+        }
+        cons = am_newconstraint(parent, AM_STRONG);
+        am_addterm(cons, start[GROUPS-1], 1.0f);
+        am_addterm(cons, pref[GROUPS-1], 1.0f);
+        am_setrelation(cons, AM_LESSEQUAL);
+        am_addconstant(cons, (am_Float)WIDGETS * 50.0f);
+        am_add(cons);
+        am_propagate(parent); /* the squeeze, down to the children */
+        for (j = 0; j < GROUPS; ++j) am_addedit(w[j][0], AM_STRONG);
+
+        pivots = 0;
+        t0 = now();
+        for (i = 0; i < ROUNDS*10; ++i) {
+            am_Solver *s = child[i % GROUPS];
+            pivots -= s->pivots + s->dual_pivots;
+            if (nested) pivots -= parent->pivots + parent->dual_pivots;
+            am_suggest(w[i % GROUPS][0], (i / GROUPS) % 2 ? 20.0f : 80.0f);
+            if (nested) am_propagate(s);
+            am_updatevars(parent);
+            pivots += s->pivots + s->dual_pivots;
+            if (nested) pivots += parent->pivots + parent->dual_pivots;
+        }
+        printf("%-8s %8.3f us/drag, %5.1f pivots/drag\n", names[nested],
+                (now() - t0) * 1e6 / (ROUNDS*10), (double)pivots / (ROUNDS*10));
+        for (j = 0; nested && j < GROUPS; ++j) am_delsolver(child[j]);
+        am_delsolver(parent);
+    }
+}
+
+static am_Variable *resolve(void *ud, const char *name, size_t len) {
+    Layout *l = (Layout*)ud;
+    int i = atoi(name + 1);
+    (void)len;
+    return i < 0 || i >= WIDGETS ? NULL : name[0] == 'x' ? l->x[i] : l->w[i];
+}
+
+static void bench_parse(void) {
+    static char text[WIDGETS*64];
+    Layout l;
+    double t0, t_calls = 0.0, t_parse = 0.0;
+    char *p = text;
+    int i, ret;
+
+    p += sprintf(p, "x0 == 0\n");
+    for (i = 0; i < WIDGETS; ++i) {
+        p += sprintf(p, "w%d >= 10; w%d == 50 | weak\n", i, i);
+        if (i + 1 < WIDGETS)
+            p += sprintf(p, "x%d >= x%d + w%d + 5\n", i+1, i, i);
+    }
+    sprintf(p, "x%d + w%d <= 8000 | strong\n", WIDGETS-1, WIDGETS-1);
+    for (i = 0; i < ROUNDS/10; ++i) {
+        l.solver = am_newsolver(NULL, NULL);
+        t0 = now();
+        build_layout(&l);
+        add_layout(&l);
+        t_calls += now() - t0;
+        am_delsolver(l.solver);
+
+        l.solver = am_newsolver(NULL, NULL);
+        t0 = now();
+        build_layout(&l); /* same variables; its constraints stay unused */
+        ret = am_parse(l.solver, text, resolve, &l, NULL);
+        t_parse += now() - t0;
+        assert(ret == AM_OK);
+        am_delsolver(l.solver);
+    }
+    (void)ret;
+
+    printf("am_add calls:  %8.3f ms/layout\n", t_calls * 1000.0 / (ROUNDS/10));
+    printf("am_parse:      %8.3f ms/layout\n", t_parse * 1000.0 / (ROUNDS/10));
+}
+
+int main(void) {
+    printf("%d widgets, %d rounds\n", WIDGETS, ROUNDS);
+    bench_reset();
+    bench_edits();
+    bench_suggestmany();
+    bench_dedup();
+    bench_compact();
+    bench_tables();
+    bench_dual();
+    bench_lazy();
+    bench_lock();
+    bench_ratio();
+    bench_solveall();
+    bench_warmstart();
+    bench_profile();
+    bench_nested();
+    bench_parse();
+    return 0;
+}
+
+/* cc: flags='-O2 -fno-strict-aliasing -Wall -Wextra -pedantic -std=c89' output='bench' */
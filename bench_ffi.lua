@@ -0,0 +1,59 @@
+-- Compares the LuaJIT FFI binding (amoeba_ffi.lua) with the C API
+-- binding (lua_amoeba.c) on a drag loop; runs whichever of them loads:
+--    luajit bench_ffi.lua
+local N, FRAMES = 200, 20000
+
+local function clock(f, n)
+   local t0 = os.clock()
+   f(n)
+   return (os.clock() - t0) * 1e6 / n
+end
+
+local function bench(name, amoeba)
+   local S = amoeba.new()
+   local x, cons = {}, {}
+   for i = 1, N do x[i] = S:var("x"..i) end
+   cons[1] = x[1]:ge(0)
+   for i = 2, N do cons[i] = x[i]:ge(x[i-1] + 5) end
+   for i = 1, N do S:addconstraint(cons[i]) end -- keep cons alive: __gc removes
+   local handle = x[N/2]
+   S:addedit(handle, "strong")
+
+   local suggest = clock(function(n)
+      for f = 1, n do S:suggest(handle, 1000 + f % 64) end
+   end, FRAMES)
+   local value = clock(function(n)
+      local sum = 0
+      for f = 1, n do sum = sum + x[f % N + 1]:value() end
+      return sum
+   end, FRAMES*10)
+   local values = S.values and clock(function(n)
+      local out = {}
+      for f = 1, n do S:values(x, out) end
+   end, FRAMES/10)
+   local build = clock(function(n)
+      for f = 1, n do
+         local c = (x[1]*2 + 1):eq(x[2] + x[3] - 3*(x[2] - x[1])/2)
+      end
+   end, FRAMES/10)
+
+   print(("%-8s suggest %7.3f us  value %7.3f us  values(%d) %7.3f us  relation %7.3f us")
+         :format(name, suggest, value, N, values or 0/0, build))
+   S:delete()
+end
+
+local saved = package.path
+package.path = "" -- make `require "amoeba"` find the C module, not amoeba.lua
+local ok, amoeba = pcall(require, "amoeba")
+package.path = saved
+if ok then bench("C API", amoeba) else print("C API: "..amoeba) end
+
+ok, amoeba = pcall(require, "amoeba_ffi")
+if ok then
+   bench("FFI", amoeba)
+   if jit then
+      jit.off()
+      bench("FFI/-jit", amoeba)
+      jit.on()
+   end
+else print("FFI: "..amoeba) end
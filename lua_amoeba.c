@@ -10,13 +10,19 @@
 #define AML_SOLVER_TYPE "amoeba.Solver"
 #define AML_VAR_TYPE    "amoeba.Variable"
 #define AML_CONS_TYPE   "amoeba.Constraint"
+#define AML_EXPR_TYPE   "amoeba.Expression"
 
-enum aml_ItemType { AML_VAR, AML_CONS, AML_CONSTANT };
+enum aml_ItemType { AML_VAR, AML_CONS, AML_EXPR, AML_CONSTANT };
 
 typedef struct aml_Solver {
     am_Solver *solver;
     int        ref_vars;
     int        ref_cons;
+    int        ref_loaded; /* S:load() constraints, kept until S:reset(true) */
+    unsigned   compacts; /* variable ids change on each S:compact() */
+    am_Variable **scratch; /* S:suggestmany() arguments, then values;
+                              S:load() constraints */
+    int        scratch_size;
 } aml_Solver;
 
 typedef struct aml_Var {
@@ -30,10 +36,26 @@ typedef struct aml_Cons {
     aml_Solver    *S;
 } aml_Cons;
 
+typedef struct aml_Term {
+    unsigned id; /* variable id, resolved when a constraint is made */
+    am_Float multiplier;
+} aml_Term;
+
+/* plain linear expression: no am_Constraint, no refcounts, no __gc; its
+ * uservalue anchors the variables and constraints its ids came from */
+typedef struct aml_Expr {
+    aml_Solver *S;
+    unsigned    compacts;
+    am_Float    constant;
+    int         count;
+    aml_Term    terms[1];
+} aml_Expr;
+
 typedef struct aml_Item {
     int            type;
     am_Variable   *var;
     am_Constraint *cons;
+    aml_Expr      *expr;
     am_Float       value;
 } aml_Item;
 
@@ -69,7 +91,7 @@ static am_Variable *aml_checkvar(lua_State *L, aml_Solver *S, int idx) {
     }
     name = luaL_checkstring(L, idx);
     lua_rawgeti(L, LUA_REGISTRYINDEX, S->ref_vars);
-    if (lua_getfield(L, -2, name) == LUA_TUSERDATA) {
+    if (lua_getfield(L, -1, name) == LUA_TUSERDATA) {
         lua_remove(L, -2);
         return aml_checkvar(L, S, -1);
     }
@@ -79,9 +101,9 @@ static am_Variable *aml_checkvar(lua_State *L, aml_Solver *S, int idx) {
     return NULL;
 }
 
-static aml_Cons *aml_newcons(lua_State *L, aml_Solver *S, am_Float strength) {
+static aml_Cons *aml_wrapcons(lua_State *L, aml_Solver *S, am_Constraint *cons) {
     aml_Cons *lcons = (aml_Cons*)lua_newuserdata(L, sizeof(aml_Cons));
-    lcons->cons = am_newconstraint(S->solver, strength);
+    lcons->cons = cons;
     lcons->S    = S;
     luaL_setmetatable(L, AML_CONS_TYPE);
     lua_rawgeti(L, LUA_REGISTRYINDEX, S->ref_cons);
@@ -91,9 +113,31 @@ static aml_Cons *aml_newcons(lua_State *L, aml_Solver *S, am_Float strength) {
     return lcons;
 }
 
+static aml_Cons *aml_newcons(lua_State *L, aml_Solver *S, am_Float strength)
+{ return aml_wrapcons(L, S, am_newconstraint(S->solver, strength)); }
+
+static aml_Expr *aml_newexpr(lua_State *L, aml_Solver *S, int count) {
+    aml_Expr *e = (aml_Expr*)lua_newuserdata(L, sizeof(aml_Expr)
+            + sizeof(aml_Term)*(count > 0 ? count - 1 : 0));
+    e->S        = S;
+    e->compacts = S->compacts;
+    e->constant = 0.0f;
+    e->count    = 0;
+    luaL_setmetatable(L, AML_EXPR_TYPE);
+    return e;
+}
+
+static aml_Expr *aml_testexpr(lua_State *L, int idx) {
+    aml_Expr *e = (aml_Expr*)luaL_testudata(L, idx, AML_EXPR_TYPE);
+    if (e && e->compacts != e->S->compacts)
+        luaL_argerror(L, idx, "expression made before S:compact()");
+    return e;
+}
+
 static aml_Item aml_checkitem(lua_State *L, aml_Solver *S, int idx) {
     aml_Item item = { 0 };
     aml_Cons *lcons;
+    aml_Expr *e;
     aml_Var  *lvar;
     switch (lua_type(L, idx)) {
     case LUA_TSTRING:
@@ -112,6 +156,11 @@ static aml_Item aml_checkitem(lua_State *L, aml_Solver *S, int idx) {
             item.type  = AML_CONS;
             return item;
         }
+        if ((e = aml_testexpr(L, idx)) != NULL) {
+            item.expr = e;
+            item.type = AML_EXPR;
+            return item;
+        }
         lvar = luaL_testudata(L, idx, AML_VAR_TYPE);
         if (lvar) {
             if (lvar->var == NULL) luaL_argerror(L, idx, "invalid variable");
@@ -129,6 +178,17 @@ static aml_Item aml_checkitem(lua_State *L, aml_Solver *S, int idx) {
 static aml_Solver *aml_checkitems(lua_State *L, int start, aml_Item *items) {
     aml_Var *lvar;
     aml_Cons *lcons;
+    aml_Expr *e;
+    if ((e = aml_testexpr(L, start)) != NULL) {
+        items[0].type = AML_EXPR, items[0].expr = e;
+        items[1] = aml_checkitem(L, e->S, start+1);
+        return e->S;
+    }
+    if ((e = aml_testexpr(L, start+1)) != NULL) {
+        items[1].type = AML_EXPR, items[1].expr = e;
+        items[0] = aml_checkitem(L, e->S, start);
+        return e->S;
+    }
     if ((lcons = (aml_Cons*)luaL_testudata(L, start, AML_CONS_TYPE)) != NULL) {
         items[0].type = AML_CONS, items[0].cons = lcons->cons;
         items[1] = aml_checkitem(L, lcons->S, start+1);
@@ -151,19 +211,111 @@ static aml_Solver *aml_checkitems(lua_State *L, int start, aml_Item *items) {
         items[0] = aml_checkitem(L, lvar->S, start);
         return lvar->S;
     }
-    aml_typeerror(L, start, "variable/constraint");
+    aml_typeerror(L, start, "variable/constraint/expression");
     return NULL;
 }
 
-static int aml_performitem(am_Constraint *cons, aml_Item *item, am_Float multiplier) {
+static int aml_mergeexpr(lua_State *L, am_Constraint *cons, aml_Expr *e, am_Float multiplier) {
+    int i, ret = am_addconstant(cons, e->constant*multiplier);
+    for (i = 0; i < e->count && ret == AM_OK; ++i) {
+        am_VarEntry *ve;
+        am_Symbol sym;
+        sym.id = e->terms[i].id, sym.type = AM_EXTERNAL;
+        ve = (am_VarEntry*)am_gettable(&cons->solver->vars, sym);
+        if (ve == NULL) luaL_error(L, "variable#%d in expression deleted", sym.id);
+        ret = am_addterm(cons, ve->variable, e->terms[i].multiplier*multiplier);
+    }
+    return ret;
+}
+
+static int aml_performitem(lua_State *L, am_Constraint *cons, aml_Item *item, am_Float multiplier) {
     switch (item->type) {
     case AML_CONSTANT: return am_addconstant(cons, item->value*multiplier); break;
     case AML_VAR:      return am_addterm(cons, item->var, multiplier); break;
     case AML_CONS:     return am_mergeconstraint(cons, item->cons, multiplier); break;
+    case AML_EXPR:     return aml_mergeexpr(L, cons, item->expr, multiplier); break;
     }
     return AM_FAILED;
 }
 
+static int aml_itemsize(aml_Item *item) {
+    switch (item->type) {
+    case AML_VAR:  return 1;
+    case AML_CONS: return (int)item->cons->expression.terms.count;
+    case AML_EXPR: return item->expr->count;
+    }
+    return 0;
+}
+
+static void aml_addexpr(aml_Expr *e, aml_Item *item, am_Float multiplier) {
+    am_Term *term = NULL;
+    int i;
+    switch (item->type) {
+    case AML_CONSTANT:
+        e->constant += item->value*multiplier;
+        break;
+    case AML_VAR:
+        e->terms[e->count].id = item->var->sym.id;
+        e->terms[e->count++].multiplier = multiplier;
+        break;
+    case AML_CONS:
+        e->constant += item->cons->expression.constant*multiplier;
+        while (am_nextentry(&item->cons->expression.terms, (am_Entry**)&term)) {
+            e->terms[e->count].id = am_key(term).id;
+            e->terms[e->count++].multiplier = term->multiplier*multiplier;
+        }
+        break;
+    case AML_EXPR:
+        e->constant += item->expr->constant*multiplier;
+        for (i = 0; i < item->expr->count; ++i) {
+            e->terms[e->count].id = item->expr->terms[i].id;
+            e->terms[e->count++].multiplier =
+                item->expr->terms[i].multiplier*multiplier;
+        }
+        break;
+    }
+}
+
+static void aml_anchorexpr(lua_State *L, aml_Solver *S) {
+    int i, j, count, n = 0;
+    lua_createtable(L, 2, 0);
+    for (i = 1; i <= 2; ++i) { /* the operands */
+        switch (lua_type(L, i)) {
+        case LUA_TSTRING:
+            lua_rawgeti(L, LUA_REGISTRYINDEX, S->ref_vars);
+            lua_pushvalue(L, i);
+            lua_rawget(L, -2);
+            lua_rawseti(L, -3, ++n);
+            lua_pop(L, 1);
+            break;
+        case LUA_TUSERDATA:
+            if (luaL_testudata(L, i, AML_EXPR_TYPE) == NULL) {
+                lua_pushvalue(L, i);
+                lua_rawseti(L, -2, ++n);
+                break;
+            }
+            lua_getuservalue(L, i);
+            count = (int)lua_rawlen(L, -1);
+            for (j = 1; j <= count; ++j) {
+                lua_rawgeti(L, -1, j);
+                lua_rawseti(L, -3, ++n);
+            }
+            lua_pop(L, 1);
+            break;
+        }
+    }
+    lua_setuservalue(L, -2);
+}
+
+static aml_Expr *aml_makeexpr(lua_State *L, aml_Solver *S, aml_Item *items, am_Float m1, am_Float m2) {
+    aml_Expr *e = aml_newexpr(L, S, aml_itemsize(&items[0])
+            + (m2 != 0.0f ? aml_itemsize(&items[1]) : 0));
+    aml_addexpr(e, &items[0], m1);
+    if (m2 != 0.0f) aml_addexpr(e, &items[1], m2);
+    aml_anchorexpr(L, S);
+    return e;
+}
+
 static am_Float aml_checkstrength(lua_State *L, int idx, am_Float def) {
     int type = lua_type(L, idx);
     const char *s;
@@ -202,9 +354,9 @@ static aml_Cons *aml_makecons(lua_State *L, aml_Solver *S, int start) {
     aml_Item items[2];
     aml_checkitems(L, start+1, items);
     lcons = aml_newcons(L, S, strength);
-    aml_performitem(lcons->cons, &items[0], 1.0f);
+    aml_performitem(L, lcons->cons, &items[0], 1.0f);
     am_setrelation(lcons->cons, op);
-    aml_performitem(lcons->cons, &items[1], 1.0f);
+    aml_performitem(L, lcons->cons, &items[1], 1.0f);
     return lcons;
 }
 
@@ -228,13 +380,13 @@ static void aml_dumpkey(luaL_Buffer *B, int idx, am_Symbol sym) {
     }
 }
 
-static void aml_dumprow(luaL_Buffer *B, int idx, am_Row *row) {
+static void aml_dumprow(luaL_Buffer *B, int idx, am_Solver *solver, am_Row *row) {
     lua_State *L = B->L;
-    am_Term *term = NULL;
+    am_Iter it = am_iter(solver, row);
     lua_pushfstring(L, "%f", row->constant);
     luaL_addvalue(B);
-    while ((am_nextentry(&row->terms, (am_Entry**)&term))) {
-        am_Float multiplier = term->multiplier;
+    while (am_nextterm(&it)) {
+        am_Float multiplier = it.multiplier;
         lua_pushfstring(L, " %c ", multiplier > 0.0f ? '+' : '-');
         luaL_addvalue(B);
         if (multiplier < 0.0f) multiplier = -multiplier;
@@ -242,7 +394,7 @@ static void aml_dumprow(luaL_Buffer *B, int idx, am_Row *row) {
             lua_pushfstring(L, "%f*", multiplier);
             luaL_addvalue(B);
         }
-        aml_dumpkey(B, idx, am_key(term));
+        aml_dumpkey(B, idx, it.key);
     }
 }
 
@@ -250,29 +402,23 @@ static void aml_dumprow(luaL_Buffer *B, int idx, am_Row *row) {
 /* expression */
 
 static int Lexpr_neg(lua_State *L) {
-    aml_Cons *lcons = (aml_Cons*)luaL_checkudata(L, 1, AML_CONS_TYPE);
-    aml_Cons *newcons = aml_newcons(L, lcons->S, AM_REQUIRED);
-    am_mergeconstraint(newcons->cons, lcons->cons, -1.0f);
+    aml_Item items[2];
+    aml_Solver *S = aml_checkitems(L, 1, items);
+    aml_makeexpr(L, S, items, -1.0f, 0.0f);
     return 1;
 }
 
 static int Lexpr_add(lua_State *L) {
-    aml_Cons *lcons;
     aml_Item items[2];
     aml_Solver *S = aml_checkitems(L, 1, items);
-    lcons = aml_newcons(L, S, AM_REQUIRED);
-    aml_performitem(lcons->cons, &items[0], 1.0f);
-    aml_performitem(lcons->cons, &items[1], 1.0f);
+    aml_makeexpr(L, S, items, 1.0f, 1.0f);
     return 1;
 }
 
 static int Lexpr_sub(lua_State *L) {
-    aml_Cons *lcons;
     aml_Item items[2];
     aml_Solver *S = aml_checkitems(L, 1, items);
-    lcons = aml_newcons(L, S, AM_REQUIRED);
-    aml_performitem(lcons->cons, &items[0], 1.0f);
-    aml_performitem(lcons->cons, &items[1], -1.0f);
+    aml_makeexpr(L, S, items, 1.0f, -1.0f);
     return 1;
 }
 
@@ -280,13 +426,12 @@ static int Lexpr_mul(lua_State *L) {
     aml_Item items[2];
     aml_Solver *S = aml_checkitems(L, 1, items);
     if (items[0].type == AML_CONSTANT) {
-        aml_Cons *lcons = aml_newcons(L, S, AM_REQUIRED);
-        aml_performitem(lcons->cons, &items[1], items[0].value);
-    }
-    else if (items[1].type == AML_CONSTANT) {
-        aml_Cons *lcons = aml_newcons(L, S, AM_REQUIRED);
-        aml_performitem(lcons->cons, &items[0], items[1].value);
+        am_Float value = items[0].value;
+        items[0] = items[1];
+        aml_makeexpr(L, S, items, value, 0.0f);
     }
+    else if (items[1].type == AML_CONSTANT)
+        aml_makeexpr(L, S, items, items[1].value, 0.0f);
     else luaL_error(L, "attempt to multiply two expression");
     return 1;
 }
@@ -296,10 +441,8 @@ static int Lexpr_div(lua_State *L) {
     aml_Solver *S = aml_checkitems(L, 1, items);
     if (items[0].type == AML_CONSTANT)
         luaL_error(L, "attempt to divide a expression");
-    if (items[1].type == AML_CONSTANT) {
-        aml_Cons *lcons = aml_newcons(L, S, AM_REQUIRED);
-        aml_performitem(lcons->cons, &items[0], 1.0f/items[1].value);
-    }
+    if (items[1].type == AML_CONSTANT)
+        aml_makeexpr(L, S, items, 1.0f/items[1].value, 0.0f);
     else luaL_error(L, "attempt to divide two expression");
     return 1;
 }
@@ -308,9 +451,9 @@ static int Lexpr_cmp(lua_State *L, int op) {
     aml_Item items[2];
     aml_Solver *S = aml_checkitems(L, 1, items);
     aml_Cons *lcons = aml_newcons(L, S, AM_REQUIRED);
-    aml_performitem(lcons->cons, &items[0], 1.0f);
+    aml_performitem(L, lcons->cons, &items[0], 1.0f);
     am_setrelation(lcons->cons, op);
-    aml_performitem(lcons->cons, &items[1], 1.0f);
+    aml_performitem(L, lcons->cons, &items[1], 1.0f);
     return 1;
 }
 
@@ -318,6 +461,53 @@ static int Lexpr_le(lua_State *L) { return Lexpr_cmp(L, AM_LESSEQUAL); }
 static int Lexpr_eq(lua_State *L) { return Lexpr_cmp(L, AM_EQUAL); }
 static int Lexpr_ge(lua_State *L) { return Lexpr_cmp(L, AM_GREATEQUAL); }
 
+static int Lexpr_tostring(lua_State *L) {
+    aml_Expr *e = (aml_Expr*)luaL_checkudata(L, 1, AML_EXPR_TYPE);
+    luaL_Buffer B;
+    int i;
+    lua_settop(L, 1);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, e->S->ref_vars);
+    luaL_buffinit(L, &B);
+    lua_pushfstring(L, AML_EXPR_TYPE "(%p): [%f", e, e->constant);
+    luaL_addvalue(&B);
+    for (i = 0; i < e->count; ++i) {
+        am_Float multiplier = e->terms[i].multiplier;
+        am_Symbol sym;
+        lua_pushfstring(L, " %c ", multiplier > 0.0f ? '+' : '-');
+        luaL_addvalue(&B);
+        if (multiplier < 0.0f) multiplier = -multiplier;
+        if (!am_approx(multiplier, 1.0f)) {
+            lua_pushfstring(L, "%f*", multiplier);
+            luaL_addvalue(&B);
+        }
+        sym.id = e->terms[i].id, sym.type = AM_EXTERNAL;
+        aml_dumpkey(&B, 2, sym);
+    }
+    luaL_addchar(&B, ']');
+    luaL_pushresult(&B);
+    return 1;
+}
+
+static void open_expression(lua_State *L) {
+    luaL_Reg libs[] = {
+        { "__unm", Lexpr_neg },
+        { "__add", Lexpr_add },
+        { "__sub", Lexpr_sub },
+        { "__mul", Lexpr_mul },
+        { "__div", Lexpr_div },
+        { "le", Lexpr_le },
+        { "eq", Lexpr_eq },
+        { "ge", Lexpr_ge },
+        { "__tostring", Lexpr_tostring },
+        { NULL, NULL }
+    };
+    if (luaL_newmetatable(L, AML_EXPR_TYPE)) {
+        luaL_setfuncs(L, libs, 0);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -2, "__index");
+    }
+}
+
 
 /* variable */
 
@@ -369,6 +559,7 @@ static int Lvar_delete(lua_State *L) {
 static int Lvar_value(lua_State *L) {
     aml_Var *lvar = (aml_Var*)luaL_checkudata(L, 1, AML_VAR_TYPE);
     if (lvar->var == NULL) luaL_argerror(L, 1, "invalid variable");
+    am_updatevars(lvar->S->solver);
     lua_pushnumber(L, am_value(lvar->var));
     return 1;
 }
@@ -383,7 +574,7 @@ static int Lvar_tostring(lua_State *L) {
 
 static void open_variable(lua_State *L) {
     luaL_Reg libs[] = {
-        { "__neg", Lexpr_neg },
+        { "__unm", Lexpr_neg },
         { "__add", Lexpr_add },
         { "__sub", Lexpr_sub },
         { "__mul", Lexpr_mul },
@@ -448,7 +639,7 @@ static int Lcons_add(lua_State *L) {
         }
     }
     item = aml_checkitem(L, lcons->S, 2);
-    ret = aml_performitem(lcons->cons, &item, 1.0f);
+    ret = aml_performitem(L, lcons->cons, &item, 1.0f);
 out:
     if (ret != AM_OK) luaL_error(L, "constraint has been added to solver!");
     lua_settop(L, 1); return 1;
@@ -472,6 +663,18 @@ static int Lcons_strength(lua_State *L) {
     lua_settop(L, 1); return 1;
 }
 
+static int Lcons_coefficient(lua_State *L) {
+    aml_Cons *lcons = (aml_Cons*)luaL_checkudata(L, 1, AML_CONS_TYPE);
+    am_Variable *var;
+    int ret;
+    if (lcons->cons == NULL) luaL_argerror(L, 1, "invalid constraint");
+    var = aml_checkvar(L, lcons->S, 2);
+    ret = am_setcoefficient(lcons->cons, var, (am_Float)luaL_checknumber(L, 3));
+    if (ret == AM_UNSATISFIED) luaL_error(L, "constraint unsatisfied");
+    else if (ret != AM_OK) luaL_error(L, "constraint coefficient not set");
+    lua_settop(L, 1); return 1;
+}
+
 static int Lcons_tostring(lua_State *L) {
     aml_Cons *lcons = (aml_Cons*)luaL_checkudata(L, 1, AML_CONS_TYPE);
     luaL_Buffer B;
@@ -484,7 +687,7 @@ static int Lcons_tostring(lua_State *L) {
     luaL_buffinit(L, &B);
     lua_pushfstring(L, AML_CONS_TYPE "(%p): [", lcons->cons);
     luaL_addvalue(&B);
-    aml_dumprow(&B, 2, &lcons->cons->expression);
+    aml_dumprow(&B, 2, lcons->cons->solver, &lcons->cons->expression);
     if (lcons->cons->relation == AM_EQUAL)
         luaL_addstring(&B, " == 0.0]");
     else
@@ -503,7 +706,7 @@ static int Lcons_tostring(lua_State *L) {
 static void open_constraint(lua_State *L) {
     luaL_Reg libs[] = {
         { "__call", Lcons_add },
-        { "__neg", Lexpr_neg },
+        { "__unm", Lexpr_neg },
         { "__add", Lexpr_add },
         { "__sub", Lexpr_sub },
         { "__mul", Lexpr_mul },
@@ -521,6 +724,7 @@ static void open_constraint(lua_State *L) {
         ENTRY(add),
         ENTRY(relation),
         ENTRY(strength),
+        ENTRY(coefficient),
 #undef  ENTRY
         { NULL, NULL }
     };
@@ -538,16 +742,35 @@ static int Lnew(lua_State *L) {
     aml_Solver *S = lua_newuserdata(L, sizeof(aml_Solver));
     if ((S->solver = am_newsolver(NULL, NULL)) == NULL)
         return 0;
+    S->compacts = 0;
+    S->scratch = NULL;
+    S->scratch_size = 0;
     lua_createtable(L, 0, 4); aml_setweak(L, "v");
     S->ref_vars = luaL_ref(L, LUA_REGISTRYINDEX);
     lua_createtable(L, 0, 4); aml_setweak(L, "v");
     S->ref_cons = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newtable(L);
+    S->ref_loaded = luaL_ref(L, LUA_REGISTRYINDEX);
     luaL_setmetatable(L, AML_SOLVER_TYPE);
     return 1;
 }
 
+static void aml_reserve(lua_State *L, aml_Solver *S, int count) {
+    const size_t itemsize = sizeof(am_Variable*) + sizeof(am_Float);
+    void *ud, *scratch;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    if (count <= S->scratch_size) return;
+    if (count < S->scratch_size*2) count = S->scratch_size*2;
+    scratch = allocf(ud, S->scratch, S->scratch_size*itemsize, count*itemsize);
+    if (scratch == NULL) luaL_error(L, "not enough memory");
+    S->scratch = (am_Variable**)scratch;
+    S->scratch_size = count;
+}
+
 static int Ldelete(lua_State *L) {
     aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
+    lua_Alloc allocf;
+    void *ud;
     if (S->solver == NULL) return 0;
     lua_rawgeti(L, LUA_REGISTRYINDEX, S->ref_vars);
     lua_pushnil(L);
@@ -572,8 +795,13 @@ static int Ldelete(lua_State *L) {
     }
     luaL_unref(L, LUA_REGISTRYINDEX, S->ref_vars);
     luaL_unref(L, LUA_REGISTRYINDEX, S->ref_cons);
+    luaL_unref(L, LUA_REGISTRYINDEX, S->ref_loaded);
     am_delsolver(S->solver);
     S->solver = NULL;
+    allocf = lua_getallocf(L, &ud);
+    allocf(ud, S->scratch, S->scratch_size*
+            (sizeof(am_Variable*) + sizeof(am_Float)), 0);
+    S->scratch = NULL, S->scratch_size = 0;
     return 0;
 }
 
@@ -586,7 +814,7 @@ static int Ltostring(lua_State *L) {
     lua_pushfstring(L, AML_SOLVER_TYPE "(%p): {", S->solver);
     luaL_addvalue(&B);
     luaL_addstring(&B, "\n  objective = ");
-    aml_dumprow(&B, 2, &S->solver->objective);
+    aml_dumprow(&B, 2, S->solver, &S->solver->objective);
     if (S->solver->rows.count != 0) {
         am_Row *row = NULL;
         int idx = 0;
@@ -597,7 +825,7 @@ static int Ltostring(lua_State *L) {
             luaL_addvalue(&B);
             aml_dumpkey(&B, 2, am_key(row));
             luaL_addstring(&B, " = ");
-            aml_dumprow(&B, 2, row);
+            aml_dumprow(&B, 2, S->solver, row);
         }
     }
     if (S->solver->infeasible_rows.id != 0) {
@@ -620,16 +848,65 @@ static int Lreset(lua_State *L) {
     aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
     int clear = lua_toboolean(L, 2);
     am_resetsolver(S->solver, clear);
+    if (clear) { /* loaded constraints are collected like any other now */
+        lua_newtable(L);
+        lua_rawseti(L, LUA_REGISTRYINDEX, S->ref_loaded);
+    }
+    lua_settop(L, 1); return 1;
+}
+
+static int Lcompact(lua_State *L) {
+    aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
+    lua_settop(L, 1);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, S->ref_vars);
+    lua_newtable(L);
+    lua_pushnil(L);
+    while (lua_next(L, 2)) { /* move id keys aside, ids are renumbered */
+        if (lua_type(L, -2) == LUA_TNUMBER) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, 3);
+        }
+        else lua_pop(L, 1);
+    }
+    lua_pushnil(L);
+    while (lua_next(L, 3)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, 2);
+    }
+    am_compact(S->solver);
+    ++S->compacts;
+    lua_pushnil(L);
+    while (lua_next(L, 3)) {
+        aml_Var *lvar = (aml_Var*)luaL_testudata(L, -1, AML_VAR_TYPE);
+        if (lvar && lvar->var) lua_rawseti(L, 2, am_variableid(lvar->var));
+        else lua_pop(L, 1);
+    }
     lua_settop(L, 1); return 1;
 }
 
+static int aml_optdefer(lua_State *L, int nargs) {
+    int defer;
+    if (lua_gettop(L) <= nargs || lua_type(L, -1) != LUA_TTABLE)
+        return 0;
+    if (lua_getmetatable(L, -1)) { lua_pop(L, 1); return 0; }
+    lua_getfield(L, -1, "defer");
+    defer = lua_toboolean(L, -1);
+    lua_pop(L, 2); /* { defer = true } */
+    return defer;
+}
+
 static int Laddconstraint(lua_State *L) {
     aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
     aml_Cons *lcons = (aml_Cons*)luaL_testudata(L, 2, AML_CONS_TYPE);
-    int ret;
+    int ret, defer = aml_optdefer(L, lcons ? 2 : 4);
     if (lcons == NULL) lcons = aml_makecons(L, S, 2);
-    if ((ret = am_add(lcons->cons)) == AM_OK)
-    { lua_settop(L, 1); return 1; }
+    if (defer) am_defer(S->solver, 1);
+    ret = am_add(lcons->cons);
+    if (defer) am_defer(S->solver, 0);
+    if (ret == AM_OK) { lua_settop(L, 1); return 1; }
     switch (ret) {
     case AM_UNSATISFIED: luaL_argerror(L, 2, "constraint unsatisfied");
     case AM_UNBOUND:     luaL_argerror(L, 2, "constraint unbound");
@@ -663,10 +940,153 @@ static int Lsuggest(lua_State *L) {
     aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
     am_Variable *var = aml_checkvar(L, S, 2);
     am_Float value = (am_Float)luaL_checknumber(L, 3);
+    int defer = aml_optdefer(L, 3);
+    if (defer) am_defer(S->solver, 1);
     am_suggest(var, value);
+    if (defer) am_defer(S->solver, 0);
+    lua_settop(L, 1); return 1;
+}
+
+static am_Float aml_checkvalue(lua_State *L, int arg, int idx) {
+    if (lua_type(L, idx) != LUA_TNUMBER)
+        aml_argferror(L, arg, "number expected for value, got %s",
+                luaL_typename(L, idx));
+    return (am_Float)lua_tonumber(L, idx);
+}
+
+static int Lsuggestmany(lua_State *L) {
+    aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
+    am_Float *values;
+    int i, count = 0;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (lua_isnoneornil(L, 3)) { /* { [var] = value, ... } */
+        lua_settop(L, 2);
+        lua_pushnil(L);
+        while (lua_next(L, 2)) lua_pop(L, 1), ++count;
+        aml_reserve(L, S, count);
+        values = (am_Float*)(S->scratch + S->scratch_size);
+        for (i = 0, lua_pushnil(L); lua_next(L, 2); ++i) {
+            values[i] = aml_checkvalue(L, 2, 4);
+            lua_pushvalue(L, -2);
+            S->scratch[i] = aml_checkvar(L, S, 5);
+            lua_settop(L, 3);
+        }
+    }
+    else { /* vars, values */
+        luaL_checktype(L, 3, LUA_TTABLE);
+        lua_settop(L, 3);
+        count = (int)lua_rawlen(L, 2);
+        aml_reserve(L, S, count);
+        values = (am_Float*)(S->scratch + S->scratch_size);
+        for (i = 0; i < count; ++i) {
+            lua_rawgeti(L, 3, i+1);
+            values[i] = aml_checkvalue(L, 3, 4);
+            lua_rawgeti(L, 2, i+1);
+            S->scratch[i] = aml_checkvar(L, S, 5);
+            lua_settop(L, 3);
+        }
+    }
+    am_suggestmany(S->scratch, values, count);
     lua_settop(L, 1); return 1;
 }
 
+static int Lvalues(lua_State *L) {
+    aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
+    int i, count;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (lua_type(L, 3) != LUA_TTABLE) {
+        lua_settop(L, 2);
+        lua_createtable(L, (int)lua_rawlen(L, 2), 0);
+    }
+    lua_settop(L, 3);
+    am_updatevars(S->solver);
+    count = (int)lua_rawlen(L, 2);
+    for (i = 1; i <= count; ++i) {
+        lua_rawgeti(L, 2, i);
+        lua_pushnumber(L, am_value(aml_checkvar(L, S, 4)));
+        lua_rawseti(L, 3, i);
+        lua_settop(L, 3);
+    }
+    return 1;
+}
+
+static int Lsolve_step(lua_State *L) {
+    aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
+    int max_pivots = (int)luaL_optinteger(L, 2, -1);
+    lua_pushboolean(L, am_step(S->solver, max_pivots));
+    return 1;
+}
+
+static int aml_resolvename(lua_State *L) { /* (S, vars, name, len) */
+    lua_pushlstring(L, (const char*)lua_touserdata(L, 3),
+            (size_t)lua_tointeger(L, 4));
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, 2) != LUA_TNIL) return 1;
+    lua_pop(L, 1);
+    lua_pushcfunction(L, Lvar_new); /* S:var(name), kept in vars */
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 5);
+    lua_call(L, 2, 1);
+    lua_pushvalue(L, 5);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 2);
+    return 1;
+}
+
+/* runs inside am_parse(): a Lua error must not unwind through it, so it
+ * is kept in slot 4 and the parse fails and rolls back instead */
+static am_Variable *aml_resolve(void *ud, const char *name, size_t len) {
+    lua_State *L = (lua_State*)ud;
+    aml_Var *lvar;
+    lua_pushcfunction(L, aml_resolvename);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 3);
+    lua_pushlightuserdata(L, (void*)name);
+    lua_pushinteger(L, (lua_Integer)len);
+    if (lua_pcall(L, 4, 1, 0) != LUA_OK) {
+        lua_replace(L, 4);
+        return NULL;
+    }
+    lvar = (aml_Var*)luaL_testudata(L, -1, AML_VAR_TYPE);
+    lua_pop(L, 1);
+    return lvar ? lvar->var : NULL;
+}
+
+/* S:load(text) -> variables by name, constraints in text order; the
+ * solver keeps the constraints alive until deleted or S:reset(true) */
+static int Lload(lua_State *L) {
+    aml_Solver *S = (aml_Solver*)luaL_checkudata(L, 1, AML_SOLVER_TYPE);
+    const char *text = luaL_checkstring(L, 2), *errpos = text, *p;
+    am_Constraint **conss;
+    int i, ret, line = 1, count;
+    lua_settop(L, 2);
+    lua_newtable(L);
+    lua_pushnil(L);
+    ret = am_parse(S->solver, text, aml_resolve, L, &errpos);
+    if (!lua_isnil(L, 4)) return lua_error(L);
+    if (ret != AM_OK) {
+        for (p = text; p < errpos; ++p) line += *p == '\n';
+        return luaL_error(L, "%s at line %d", ret == AM_UNSATISFIED ?
+                "constraint unsatisfied" : ret == AM_UNBOUND ?
+                "constraint unbound" : "syntax error", line);
+    }
+    count = am_parsed(S->solver, NULL, 0);
+    aml_reserve(L, S, count);
+    conss = (am_Constraint**)S->scratch;
+    am_parsed(S->solver, conss, count);
+    lua_createtable(L, count, 0);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, S->ref_loaded);
+    for (i = 0; i < count; ++i) {
+        aml_wrapcons(L, S, conss[i]);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, 5, i + 1);
+        lua_rawsetp(L, 6, conss[i]);
+    }
+    lua_settop(L, 5);
+    lua_remove(L, 4);
+    return 2;
+}
+
 LUALIB_API int luaopen_amoeba(lua_State *L) {
     luaL_Reg libs[] = {
         { "var", Lvar_new },
@@ -676,16 +1096,22 @@ LUALIB_API int luaopen_amoeba(lua_State *L) {
         ENTRY(new),
         ENTRY(delete),
         ENTRY(reset),
+        ENTRY(compact),
         ENTRY(addconstraint),
         ENTRY(delconstraint),
         ENTRY(addedit),
         ENTRY(deledit),
         ENTRY(suggest),
+        ENTRY(suggestmany),
+        ENTRY(values),
+        ENTRY(solve_step),
+        ENTRY(load),
 #undef  ENTRY
         { NULL, NULL }
     };
     open_variable(L);
     open_constraint(L);
+    open_expression(L);
     if (luaL_newmetatable(L, AML_SOLVER_TYPE)) {
         luaL_setfuncs(L, libs, 0);
         lua_pushvalue(L, -1);
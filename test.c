@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <setjmp.h>
 #include <stdarg.h>
 
@@ -32,6 +33,18 @@ static void *debug_allocf(void *ud, void *ptr, size_t ns, size_t os) {
 static void *null_allocf(void *ud, void *ptr, size_t ns, size_t os)
 { (void)ud, (void)ptr, (void)ns, (void)os; return NULL; }
 
+typedef struct TraceBuf {
+    unsigned char data[1024];
+    size_t        len;
+} TraceBuf;
+
+static void trace_writef(void *ud, const void *data, size_t size) {
+    TraceBuf *buf = (TraceBuf*)ud;
+    assert(buf->len + size <= sizeof(buf->data));
+    memcpy(buf->data + buf->len, data, size);
+    buf->len += size;
+}
+
 static void am_dumpkey(am_Symbol sym) {
     int ch = 'v';
     switch (sym.type) {
@@ -43,16 +56,16 @@ static void am_dumpkey(am_Symbol sym) {
     printf("%c%d", ch, (int)sym.id);
 }
 
-static void am_dumprow(am_Row *row) {
-    am_Term *term = NULL;
+static void am_dumprow(am_Solver *solver, am_Row *row) {
+    am_Iter it = am_iter(solver, row);
     printf("%g", row->constant);
-    while (am_nextentry(&row->terms, (am_Entry**)&term)) {
-        am_Float multiplier = term->multiplier;
+    while (am_nextterm(&it)) {
+        am_Float multiplier = it.multiplier;
         printf(" %c ", multiplier > 0.0 ? '+' : '-');
         if (multiplier < 0.0) multiplier = -multiplier;
         if (!am_approx(multiplier, 1.0f))
             printf("%g*", multiplier);
-        am_dumpkey(am_key(term));
+        am_dumpkey(it.key);
     }
     printf("\n");
 }
@@ -62,13 +75,13 @@ static void am_dumpsolver(am_Solver *solver) {
     int idx = 0;
     printf("-------------------------------\n");
     printf("solver: ");
-    am_dumprow(&solver->objective);
+    am_dumprow(solver, &solver->objective);
     printf("rows(%d):\n", (int)solver->rows.count);
     while (am_nextentry(&solver->rows, (am_Entry**)&row)) {
         printf("%d. ", ++idx);
         am_dumpkey(am_key(row));
         printf(" = ");
-        am_dumprow(row);
+        am_dumprow(solver, row);
     }
     printf("-------------------------------\n");
 }
@@ -298,6 +311,658 @@ static void test_all(void) {
     maxmem = 0;
 }
 
+static void test_reset(void) {
+    am_Solver *solver;
+    am_Variable *xl, *xm, *xr;
+    am_Constraint *c1, *c2, *c3, *c4;
+    size_t mem = 0;
+    int i, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest reset\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    xl = am_newvariable(solver);
+    xm = am_newvariable(solver);
+    xr = am_newvariable(solver);
+
+    c1 = new_constraint(solver, AM_REQUIRED, xm, 2.0, AM_EQUAL, 0.0,
+            xl, 1.0, xr, 1.0, END);
+    c2 = new_constraint(solver, AM_REQUIRED, xl, 1.0, AM_LESSEQUAL, -10.0,
+            xr, 1.0, END);
+    c3 = new_constraint(solver, AM_REQUIRED, xr, 1.0, AM_LESSEQUAL, 100.0, END);
+    c4 = new_constraint(solver, AM_REQUIRED, xl, 1.0, AM_GREATEQUAL, 0.0, END);
+
+    for (i = 0; i < 8; ++i) {
+        am_suggest(xm, 70.0);
+        am_updatevars(solver);
+        printf("xl: %f, xm: %f, xr: %f\n",
+                am_value(xl), am_value(xm), am_value(xr));
+        assert(am_approx(am_value(xm), 70.0));
+        assert(am_approx(am_value(xl) + am_value(xr), 140.0));
+        assert(am_value(xl) + 10.0 <= am_value(xr) + AM_FLOAT_EPS);
+
+        am_resetsolver(solver, 1);
+        assert(!am_hasconstraint(c1) && !am_hasconstraint(c4));
+        assert(!am_hasedit(xm));
+        assert(solver->rows.count == 0);
+        if (i == 1) mem = allmem;
+        if (i > 1) assert(allmem == mem); /* storage reused, not grown */
+
+        ret  = am_add(c1);
+        ret |= am_add(c2);
+        ret |= am_add(c3);
+        ret |= am_add(c4);
+        assert(ret == AM_OK);
+    }
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_edits(void) {
+    am_Solver *solver;
+    am_Variable *h[4];
+    size_t count;
+    int i, round, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest edits\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    for (i = 0; i < 4; ++i) h[i] = am_newvariable(solver);
+    new_constraint(solver, AM_REQUIRED, h[0], 1.0, AM_GREATEQUAL, 0.0, END);
+    for (i = 0; i < 3; ++i)
+        new_constraint(solver, AM_REQUIRED, h[i+1], 1.0, AM_GREATEQUAL, 10.0,
+                h[i], 1.0, END);
+    count = solver->constraints.count;
+
+    /* parametric variable at its value: no pivoting needed */
+    assert(am_addedit(h[3], AM_MEDIUM) == AM_OK);
+    assert(am_addedit(h[3], AM_MEDIUM) == AM_FAILED);
+    assert(am_hasedit(h[3]));
+    assert(solver->constraints.count == count);
+    am_suggest(h[3], 50.0);
+    assert(am_approx(am_value(h[3]), 50.0));
+    am_deledit(h[3]);
+    assert(!am_hasedit(h[3]));
+
+    for (round = 0; round < 3; ++round) {
+        assert(am_addedits(h, 4, AM_STRONG) == AM_OK);
+        assert(solver->constraints.count == count);
+        for (i = 0; i < 4; ++i) assert(am_hasedit(h[i]));
+        assert(am_addedits(h, 2, AM_STRONG) == AM_FAILED);
+        am_suggest(h[1], 40.0 + round);
+        am_suggest(h[2], 45.0);
+        am_suggest(h[3], 100.0);
+        printf("h: %f, %f, %f, %f\n", am_value(h[0]), am_value(h[1]),
+                am_value(h[2]), am_value(h[3]));
+        assert(am_value(h[2]) >= am_value(h[1]) + 10.0 - AM_FLOAT_EPS);
+        assert(am_approx(am_value(h[3]), 100.0));
+        for (i = 0; i < 4; ++i) am_deledit(h[i]);
+        for (i = 0; i < 4; ++i) assert(!am_hasedit(h[i]));
+        am_suggest(h[3], 20.0);
+        assert(am_approx(am_value(h[3]), 30.0));
+        am_deledit(h[3]);
+    }
+
+    am_addedit(h[0], 0.0); /* 0 means strong for edits */
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_suggestmany(void) {
+    am_Solver *solver[2];
+    am_Variable *h[2][4];
+    am_Float values[4], error[2];
+    int i, j, round, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest suggestmany\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    for (j = 0; j < 2; ++j) {
+        solver[j] = am_newsolver(debug_allocf, NULL);
+        am_autoupdate(solver[j], 1);
+        for (i = 0; i < 4; ++i) h[j][i] = am_newvariable(solver[j]);
+        new_constraint(solver[j], AM_REQUIRED, h[j][0], 1.0, AM_GREATEQUAL, 0.0, END);
+        for (i = 0; i < 3; ++i)
+            new_constraint(solver[j], AM_REQUIRED, h[j][i+1], 1.0, AM_GREATEQUAL,
+                    10.0, h[j][i], 1.0, END);
+    }
+
+    /* one batch must reach the optimum the same suggestions one by one
+     * do; odd rounds conflict with the chain, so compare total error */
+    for (round = 0; round < 6; ++round) {
+        for (i = 0; i < 4; ++i)
+            values[i] = (am_Float)(round & 1 ? (round*37 + i*11) % 60
+                                             : round*5 + i*(10 + round));
+        am_suggestmany(h[0], values, 4);
+        for (i = 0; i < 4; ++i) am_suggest(h[1][i], values[i]);
+        printf("h: %f, %f, %f, %f\n", am_value(h[0][0]), am_value(h[0][1]),
+                am_value(h[0][2]), am_value(h[0][3]));
+        for (j = 0; j < 2; ++j)
+            for (error[j] = 0.0f, i = 0; i < 4; ++i)
+                error[j] += am_value(h[j][i]) > values[i] ?
+                    am_value(h[j][i]) - values[i] : values[i] - am_value(h[j][i]);
+        assert(am_approx(error[0], error[1]));
+        for (i = 0; i < 4; ++i) {
+            assert(am_hasedit(h[0][i]));
+            if (i > 0) assert(am_value(h[0][i]) >= am_value(h[0][i-1]) + 10.0
+                    - AM_FLOAT_EPS);
+            if (!(round & 1)) assert(am_approx(am_value(h[0][i]), values[i]));
+        }
+    }
+    am_suggestmany(h[0], values, 0);
+    am_suggestmany(NULL, values, 4);
+
+    for (j = 0; j < 2; ++j) am_delsolver(solver[j]);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_dedup(void) {
+    am_Solver *solver;
+    am_Variable *x, *y;
+    am_Constraint *c1, *c2, *c3, *c4;
+    size_t rows;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest dedup\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    x = am_newvariable(solver);
+    y = am_newvariable(solver);
+    new_constraint(solver, AM_REQUIRED, y, 1.0, AM_EQUAL, 20.0, END);
+    new_constraint(solver, AM_WEAK, x, 1.0, AM_EQUAL, 0.0, END);
+    am_dedup(solver, 1);
+
+    /* x >= y + 10 written three ways */
+    rows = solver->rows.count;
+    c1 = new_constraint(solver, AM_MEDIUM, x, 1.0, AM_GREATEQUAL, 10.0,
+            y, 1.0, END);
+    c2 = new_constraint(solver, AM_MEDIUM, y, 2.0, AM_LESSEQUAL, -20.0,
+            x, 2.0, END);
+    c3 = new_constraint(solver, AM_MEDIUM, x, -1.0, AM_LESSEQUAL, -10.0,
+            y, -1.0, END);
+    c4 = new_constraint(solver, AM_STRONG, x, 1.0, AM_GREATEQUAL, 10.0,
+            y, 1.0, END);
+    assert(am_hasconstraint(c2) && am_hasconstraint(c3));
+    assert(c1->marker.id == c2->marker.id && c1->marker.id == c3->marker.id);
+    assert(c4->marker.id != c1->marker.id);
+    assert(solver->rows.count == rows + 2);
+    assert(am_approx(am_value(x), 30.0));
+
+    am_delconstraint(c4);
+    am_remove(c1);
+    assert(!am_hasconstraint(c1) && am_hasconstraint(c2));
+    assert(am_approx(am_value(x), 30.0));
+    assert(am_setstrength(c3, AM_STRONG) == AM_OK); /* detaches c3 */
+    assert(c3->marker.id != c2->marker.id);
+    am_remove(c3);
+    assert(am_approx(am_value(x), 30.0));
+    am_remove(c2);
+    assert(am_approx(am_value(x), 0.0));
+    assert(solver->rows.count == rows);
+    assert(solver->shared.count == 0);
+
+    assert(am_add(c1) == AM_OK && am_add(c2) == AM_OK);
+    am_resetsolver(solver, 1);
+    assert(solver->shared.count == 0 && c2->shared == NULL);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_compact(void) {
+    am_Solver *solver;
+    am_Variable *x[8];
+    am_Constraint *cons[8];
+    am_Float values[8];
+    int i, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest compact\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    am_dedup(solver, 1);
+    for (i = 0; i < 8; ++i) x[i] = am_newvariable(solver);
+    new_constraint(solver, AM_REQUIRED, x[0], 1.0, AM_GREATEQUAL, 0.0, END);
+    for (i = 0; i < 7; ++i) {
+        cons[i] = new_constraint(solver, AM_STRONG, x[i+1], 1.0, AM_GREATEQUAL,
+                5.0, x[i], 1.0, END);
+        new_constraint(solver, AM_WEAK, x[i], 1.0, AM_EQUAL, i*3.0, END);
+    }
+    cons[7] = am_cloneconstraint(cons[3], 0.0);
+    assert(am_add(cons[7]) == AM_OK);
+    for (i = 0; i < 7; i += 2) { /* leave holes in the symbol space */
+        am_remove(cons[i]);
+        assert(am_add(cons[i]) == AM_OK);
+    }
+    am_addedit(x[5], AM_STRONG);
+    am_suggest(x[5], 40.0);
+    for (i = 0; i < 8; ++i) values[i] = am_value(x[i]);
+
+    am_compact(solver);
+    printf("symbols: %d\n", (int)solver->symbol_count);
+    for (i = 0; i < 8; ++i) {
+        assert(am_variableid(x[i]) <= (int)solver->symbol_count);
+        assert(am_approx(am_value(x[i]), values[i]));
+    }
+    am_updatevars(solver);
+    for (i = 0; i < 8; ++i) assert(am_approx(am_value(x[i]), values[i]));
+
+    am_suggest(x[5], 60.0);
+    assert(am_approx(am_value(x[5]), 60.0));
+    for (i = 0; i < 7; ++i)
+        assert(am_value(x[i+1]) >= am_value(x[i]) + 5.0 - AM_FLOAT_EPS);
+    am_remove(cons[3]);
+    assert(am_hasconstraint(cons[7]));
+    am_delconstraint(cons[7]);
+    am_deledit(x[5]);
+    am_compact(solver);
+    assert(am_add(cons[3]) == AM_OK);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_dense(void) {
+    am_Solver *solver;
+    am_Variable *x[8], *spare[AM_DENSE_MAX + 1];
+    int i, small, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest dense\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    /* x[i] >= x[i-1] + 10, pulled down weakly: dense rows if ids fit */
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    for (i = 0; i < 8; ++i) x[i] = am_newvariable(solver);
+    new_constraint(solver, AM_REQUIRED, x[0], 1.0, AM_EQUAL, 0.0, END);
+    for (i = 1; i < 8; ++i) {
+        new_constraint(solver, AM_REQUIRED, x[i], 1.0, AM_GREATEQUAL, 10.0,
+                x[i-1], 1.0, END);
+        new_constraint(solver, AM_WEAK, x[i], 1.0, AM_EQUAL, 0.0, END);
+    }
+    am_addedit(x[7], AM_STRONG);
+    am_suggest(x[7], 100.0);
+    small = solver->dense;
+    printf("dense: %d, symbols: %d\n", small, (int)solver->symbol_count);
+    assert(small == (solver->symbol_count + 4 <= AM_DENSE_MAX));
+    assert(am_value(x[7]) == 100.0 && am_value(x[6]) == 60.0);
+
+    /* ids past AM_DENSE_MAX turn the tableau back into hashed rows */
+    for (i = 0; i < AM_DENSE_MAX; ++i) spare[i] = am_newvariable(solver);
+    new_constraint(solver, AM_REQUIRED, x[7], 1.0, AM_LESSEQUAL, 1000.0, END);
+    assert(!solver->dense);
+    am_suggest(x[7], 120.0);
+    assert(am_value(x[7]) == 120.0 && am_value(x[6]) == 60.0);
+
+    /* and compaction brings the ids, and dense rows, back */
+    for (i = 0; i < AM_DENSE_MAX; ++i) am_delvariable(spare[i]);
+    am_compact(solver);
+    assert((int)solver->dense == small);
+    am_suggest(x[7], 90.0);
+    am_dumpsolver(solver);
+    assert(am_value(x[7]) == 90.0 && am_value(x[6]) == 60.0);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_step(void) {
+    am_Solver *solver;
+    am_Variable *x[20];
+    am_Constraint *cons;
+    size_t pivots;
+    int i, steps, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest step\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    for (i = 0; i < 20; ++i) x[i] = am_newvariable(solver);
+    for (i = 1; i < 20; ++i)
+        new_constraint(solver, AM_REQUIRED, x[i], 1.0, AM_GREATEQUAL, 10.0,
+                x[i-1], 1.0, END);
+    for (i = 0; i < 20; ++i)
+        new_constraint(solver, AM_WEAK, x[i], 1.0, AM_EQUAL, 0.0, END);
+    am_addedit(x[0], AM_STRONG);
+    am_suggest(x[0], 0.0);
+    for (i = 0; i < 20; ++i) assert(am_value(x[i]) == 10.0*i);
+
+    /* a deferred suggest leaves the dual simplex to am_step() */
+    am_defer(solver, 1);
+    pivots = solver->dual_pivots;
+    am_suggest(x[0], -500.0);
+    assert(solver->dual_pivots == pivots && solver->infeasible_rows.id != 0);
+    for (steps = 1; !am_step(solver, 2); ++steps) {
+        assert(solver->dual_pivots - pivots == 2*(size_t)steps);
+        assert(steps < 1000);
+    }
+    printf("steps: %d, dual pivots: %d\n", steps, (int)(solver->dual_pivots - pivots));
+    assert(steps > 1);
+    assert(am_value(x[0]) == -500.0);
+    for (i = 1; i < 20; ++i) assert(am_value(x[i]) == 10.0*i - 100.0);
+
+    /* pending work of the other kind is finished first */
+    am_suggest(x[0], 0.0);
+    cons = new_constraint(solver, AM_REQUIRED, x[10], 1.0, AM_GREATEQUAL, 200.0, END);
+    assert(solver->infeasible_rows.id == 0 && solver->unoptimized);
+    am_defer(solver, 0);
+    am_suggest(x[0], 0.0);
+    assert(am_step(solver, 0));
+    for (i = 0; i < 10; ++i) assert(am_value(x[i]) == 10.0*i);
+    for (i = 10; i < 20; ++i) assert(am_value(x[i]) == 100.0 + 10.0*i);
+    am_remove(cons);
+    assert(am_step(solver, 0));
+    for (i = 0; i < 20; ++i) assert(am_value(x[i]) == 10.0*i);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_dualpolicy(void) {
+    am_Solver *solvers[2];
+    am_Variable *x[2][16], *handles[2][4];
+    am_Float values[4];
+    int i, j, k, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest dualpolicy\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    for (k = 0; k < 2; ++k) {
+        solvers[k] = am_newsolver(debug_allocf, NULL);
+        am_autoupdate(solvers[k], 1);
+        am_dualpolicy(solvers[k], k ? AM_DUAL_WORST : AM_DUAL_LIFO);
+        for (i = 0; i < 16; ++i) x[k][i] = am_newvariable(solvers[k]);
+        for (i = 1; i < 16; ++i)
+            new_constraint(solvers[k], AM_REQUIRED, x[k][i], 1.0, AM_GREATEQUAL,
+                    10.0, x[k][i-1], 1.0, END);
+        for (i = 0; i < 16; ++i)
+            new_constraint(solvers[k], AM_WEAK, x[k][i], 1.0, AM_EQUAL, 0.0, END);
+        for (j = 0; j < 4; ++j) handles[k][j] = x[k][j*5];
+        am_addedits(handles[k], 4, AM_STRONG);
+    }
+
+    /* the order of dual pivots differs, the solution does not */
+    for (i = 0; i < 10; ++i) {
+        for (j = 0; j < 4; ++j) values[j] = (i & 1)*100.0 + j*(50.0 + i*15.0);
+        for (k = 0; k < 2; ++k) am_suggestmany(handles[k], values, 4);
+        for (j = 0; j < 16; ++j)
+            assert(am_approx(am_value(x[0][j]), am_value(x[1][j])));
+    }
+    printf("dual pivots: lifo %d, worst %d\n", (int)solvers[0]->dual_pivots,
+            (int)solvers[1]->dual_pivots);
+
+    /* deferred rows wait in the heap, and still drain after a switch back */
+    am_defer(solvers[1], 1);
+    for (j = 0; j < 4; ++j) values[j] = -600.0 + j*60.0;
+    am_suggestmany(handles[1], values, 4);
+    assert(!am_step(solvers[1], 1) && solvers[1]->dual_count != 0);
+    am_dualpolicy(solvers[1], AM_DUAL_LIFO);
+    assert(am_step(solvers[1], -1) && solvers[1]->dual_count == 0);
+    am_suggestmany(handles[0], values, 4);
+    for (j = 0; j < 16; ++j)
+        assert(am_approx(am_value(x[0][j]), am_value(x[1][j])));
+
+    for (k = 0; k < 2; ++k) am_delsolver(solvers[k]);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_lazy(void) {
+    am_Solver *solver;
+    am_Variable *x[10];
+    unsigned epoch;
+    int i, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest lazy\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    am_lazyvalues(solver, 1);
+    for (i = 0; i < 10; ++i) x[i] = am_newvariable(solver);
+    for (i = 1; i < 10; ++i)
+        new_constraint(solver, AM_REQUIRED, x[i], 1.0, AM_EQUAL, 10.0,
+                x[i-1], 1.0, END);
+    am_addedit(x[0], AM_STRONG);
+    am_suggest(x[0], 5.0);
+
+    /* nothing is queued for an update pass, values are read on demand */
+    assert(solver->dirty_vars.id == 0);
+    assert(am_value(x[9]) == 95.0 && x[9]->epoch == solver->epoch);
+    assert(x[5]->value == 0.0 && am_value(x[5]) == 55.0);
+    epoch = solver->epoch;
+    assert(am_value(x[9]) == 95.0 && solver->epoch == epoch);
+    am_suggest(x[0], 7.0);
+    assert(solver->epoch != epoch && x[9]->epoch != solver->epoch);
+    assert(solver->dirty_vars.id == 0);
+    for (i = 0; i < 10; ++i) assert(am_value(x[i]) == 7.0 + 10.0*i);
+
+    /* back to eager updates, every value is current again */
+    am_suggest(x[0], 9.0);
+    am_lazyvalues(solver, 0);
+    for (i = 0; i < 10; ++i) assert(x[i]->value == 9.0 + 10.0*i);
+    am_suggest(x[0], 11.0);
+    for (i = 0; i < 10; ++i) assert(x[i]->value == 11.0 + 10.0*i);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_solveall(void) {
+    am_Solver *solvers[12];
+    am_Variable *x[12][5];
+    int status[12];
+    int i, j, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest solveall\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    /* each solver queues its own suggestion, one call finishes them all */
+    for (i = 0; i < 12; ++i) {
+        solvers[i] = am_newsolver(debug_allocf, NULL);
+        am_autoupdate(solvers[i], 1);
+        for (j = 0; j < 5; ++j) x[i][j] = am_newvariable(solvers[i]);
+        for (j = 1; j < 5; ++j)
+            new_constraint(solvers[i], AM_REQUIRED, x[i][j], 1.0, AM_GREATEQUAL,
+                    10.0, x[i][j-1], 1.0, END);
+        for (j = 0; j < 5; ++j)
+            new_constraint(solvers[i], AM_WEAK, x[i][j], 1.0, AM_EQUAL, 0.0, END);
+        am_addedit(x[i][0], AM_STRONG);
+        am_defer(solvers[i], 1);
+        am_suggest(x[i][0], 100.0*i + 50.0);
+        assert(!am_step(solvers[i], 0)); /* pending */
+        status[i] = 1;
+    }
+    assert(am_solveall(solvers, 12, 4, status) == AM_OK);
+    for (i = 0; i < 12; ++i) {
+        assert(status[i] == AM_OK);
+        assert(am_value(x[i][0]) == 100.0*i + 50.0);
+        for (j = 1; j < 5; ++j)
+            assert(am_value(x[i][j]) == 100.0*i + 50.0 + 10.0*j);
+    }
+
+    /* nothing pending is not an error */
+    assert(am_solveall(solvers, 12, 0, NULL) == AM_OK);
+    assert(am_solveall(solvers, 0, 4, NULL) == AM_OK);
+
+    for (i = 0; i < 12; ++i) am_delsolver(solvers[i]);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static int read_published(const am_Float *slots, const unsigned *generation,
+        int id, am_Float *value) {
+    unsigned gen = *(volatile const unsigned*)generation;
+    if (gen & 1) return 0;
+    *value = ((volatile const am_Float*)slots)[id];
+    return gen == *(volatile const unsigned*)generation;
+}
+
+static void test_publish(void) {
+    am_Solver *solver;
+    am_Variable *x, *y, *z;
+    am_Float slots[16], value;
+    unsigned generation = 0;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest publish\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    memset(slots, 0, sizeof(slots));
+    solver = am_newsolver(debug_allocf, NULL);
+    x = am_newvariable(solver);
+    y = am_newvariable(solver);
+    new_constraint(solver, AM_MEDIUM, x, 1.0, AM_EQUAL, 10.0, END);
+    new_constraint(solver, AM_REQUIRED, y, 1.0, AM_EQUAL, 20.0, x, 1.0, END);
+    am_updatevars(solver);
+
+    /* publishing starts with all current values */
+    am_publish(solver, slots, 16, &generation);
+    assert(generation == 2);
+    assert(read_published(slots, &generation, am_variableid(x), &value) && value == 10.0);
+    assert(read_published(slots, &generation, am_variableid(y), &value) && value == 30.0);
+
+    /* only a changed solution bumps the generation */
+    am_updatevars(solver);
+    assert(generation == 2);
+    am_addedit(x, AM_STRONG);
+    am_suggest(x, 5.0);
+    assert(slots[am_variableid(y)] == 30.0);
+    am_updatevars(solver);
+    assert(generation == 4);
+    assert(slots[am_variableid(x)] == 5.0 && slots[am_variableid(y)] == 25.0);
+
+    /* new variables clear their slot, compacting moves the slots */
+    slots[15] = 1.0;
+    z = am_newvariable(solver);
+    am_updatevars(solver);
+    assert(slots[am_variableid(z)] == 0.0);
+    am_delvariable(z);
+    am_compact(solver);
+    am_updatevars(solver);
+    assert(generation % 2 == 0);
+    assert(slots[am_variableid(x)] == 5.0 && slots[am_variableid(y)] == 25.0);
+
+    am_publish(solver, NULL, 0, NULL);
+    am_suggest(x, 7.0);
+    am_updatevars(solver);
+    assert(am_value(y) == 27.0 && slots[am_variableid(y)] == 25.0);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_trace(void) {
+    am_Solver *solver;
+    am_Variable *x, *y, *vars[2];
+    am_Float values[2];
+    am_Constraint *c;
+    am_Stats stats;
+    TraceBuf buf;
+    size_t len;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest trace\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    buf.len = 0;
+    solver = am_newsolver(debug_allocf, NULL);
+    am_trace(solver, trace_writef, &buf);
+    assert(memcmp(buf.data, "AMTR", 4) == 0);
+    assert(buf.data[5] == sizeof(am_Float));
+    len = buf.len;
+
+    x = am_newvariable(solver);
+    assert(buf.len == len + 2);
+    assert(buf.data[len] == AM_OP_NEWVARIABLE);
+    assert(buf.data[len+1] == am_variableid(x));
+
+    len = buf.len; /* nested addedit is not recorded */
+    am_suggest(x, 10.0);
+    assert(buf.len == len + 2 + sizeof(am_Float));
+    assert(buf.data[len] == AM_OP_SUGGEST);
+
+    y = am_newvariable(solver);
+    c = new_constraint(solver, AM_REQUIRED, y, 1.0, AM_GREATEQUAL, 5.0,
+            x, 1.0, END);
+    len = buf.len;
+    am_delconstraint(c);
+    assert(buf.len == len + 2 && buf.data[len] == AM_OP_DELCONSTRAINT);
+
+    c = am_newconstraint(solver, AM_REQUIRED);
+    vars[0] = x, vars[1] = y;
+    values[0] = 1.0f, values[1] = 2.0f;
+    len = buf.len; /* cons, count, vars, multipliers */
+    assert(am_addterms(c, vars, values, 2) == AM_OK);
+    assert(buf.len == len + 5 + 2*sizeof(am_Float));
+    assert(buf.data[len] == AM_OP_ADDTERMS && buf.data[len+2] == 2);
+    am_delconstraint(c);
+    am_stats(solver, &stats);
+    printf("vars %d, rows %d, pivots %d, dual pivots %d\n",
+            (int)stats.vars, (int)stats.rows,
+            (int)stats.pivots, (int)stats.dual_pivots);
+    assert(stats.vars == 2 && stats.constraints == 0);
+
+    len = buf.len;
+    am_delsolver(solver);
+    assert(buf.len == len + 1 && buf.data[len] == AM_OP_END);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
 static void test_binarytree(void) {
     const int NUM_ROWS = 9;
     const int X_OFFSET = 0;
@@ -569,6 +1234,530 @@ static void test_strength(void) {
     maxmem = 0;
 }
 
+static void test_required(void) {
+    am_Solver *solver;
+    am_Variable *x, *y;
+    am_Constraint *lock, *atleast, *sum;
+    size_t pivots;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest required\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    x = am_newvariable(solver);
+    y = am_newvariable(solver);
+    new_constraint(solver, AM_REQUIRED, x, 1.0, AM_GREATEQUAL, 0.0, END);
+    new_constraint(solver, AM_REQUIRED, x, 1.0, AM_LESSEQUAL, 100.0, END);
+    sum = new_constraint(solver, AM_WEAK, y, 1.0, AM_EQUAL, 10.0, x, 1.0, END);
+    lock = new_constraint(solver, AM_MEDIUM, x, 1.0, AM_EQUAL, 40.0, END);
+    atleast = new_constraint(solver, AM_WEAK, x, 1.0, AM_GREATEQUAL, 60.0, END);
+    am_addedit(x, AM_STRONG);
+    am_suggest(x, 70.0);
+    assert(am_value(x) == 70.0 && am_value(y) == 80.0);
+
+    /* lock and unlock in place, the rows stay */
+    pivots = solver->pivots + solver->dual_pivots;
+    assert(am_setstrength(lock, AM_REQUIRED) == AM_OK);
+    assert(am_value(x) == 40.0 && am_value(y) == 50.0);
+    assert(am_isdummy(lock->marker) && lock->other.id == 0);
+    assert(am_setstrength(lock, AM_MEDIUM) == AM_OK);
+    assert(am_value(x) == 70.0 && am_value(y) == 80.0);
+    assert(am_iserror(lock->marker) && am_iserror(lock->other));
+    printf("pivots: %d\n", (int)(solver->pivots + solver->dual_pivots - pivots));
+
+    /* a conflict leaves the constraint as it was */
+    assert(am_setstrength(lock, AM_REQUIRED) == AM_OK);
+    assert(am_setstrength(atleast, AM_REQUIRED) == AM_UNSATISFIED);
+    assert(atleast->strength == AM_WEAK && am_iserror(atleast->other));
+    assert(am_value(x) == 40.0);
+    assert(am_setstrength(lock, AM_WEAK) == AM_OK);
+    assert(am_setstrength(atleast, AM_REQUIRED) == AM_OK);
+    assert(atleast->other.id == 0 && am_value(x) == 70.0);
+    am_suggest(x, 50.0);
+    assert(am_value(x) == 60.0 && am_value(y) == 70.0);
+
+    /* locked ones still remove, and go back to their old rows */
+    am_remove(atleast);
+    assert(am_value(x) == 50.0);
+    assert(am_setstrength(sum, AM_REQUIRED) == AM_OK);
+    am_remove(sum);
+    assert(am_add(sum) == AM_OK && am_value(y) == 60.0);
+    assert(am_setstrength(sum, AM_STRONG) == AM_OK);
+    am_suggest(x, 20.0);
+    assert(am_value(x) == 20.0 && am_value(y) == 30.0);
+
+    /* not added: only the strength changes */
+    am_remove(atleast);
+    assert(am_setstrength(atleast, AM_WEAK) == AM_OK);
+    assert(!am_hasconstraint(atleast));
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_coefficient(void) {
+    am_Solver *solver;
+    am_Variable *w, *h, *z;
+    am_Constraint *ratio, *cap, *half;
+    am_Symbol marker;
+    int i, readds = 0;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest coefficient\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    w = am_newvariable(solver);
+    h = am_newvariable(solver);
+    z = am_newvariable(solver);
+    ratio = new_constraint(solver, AM_REQUIRED, w, 1.0, AM_EQUAL, 0.0,
+            h, 2.0, END);
+    am_addedit(h, AM_STRONG);
+    am_suggest(h, 10.0);
+    assert(am_value(w) == 20.0);
+
+    /* the aspect ratio animates, the row stays */
+    marker = ratio->marker;
+    assert(am_addterm(ratio, h, 1.0) == AM_FAILED);
+    assert(am_setcoefficient(ratio, h, 3.0) == AM_OK);
+    assert(am_value(w) == 30.0 && am_value(h) == 10.0);
+    assert(ratio->marker.id == marker.id);
+
+    /* width driven instead: h is solved for */
+    am_deledit(h);
+    am_addedit(w, AM_STRONG);
+    am_suggest(w, 60.0);
+    assert(am_value(h) == 20.0);
+    assert(am_setcoefficient(ratio, h, 4.0) == AM_OK);
+    assert(am_value(w) == 60.0 && am_value(h) == 15.0);
+    assert(ratio->marker.id == marker.id);
+
+    /* a cap that starts to bite falls back to re-adding */
+    cap = new_constraint(solver, AM_REQUIRED, h, 1.0, AM_LESSEQUAL, 50.0, END);
+    for (i = 1; i <= 40; ++i) {
+        am_Float r = (am_Float)(i % 20 + 1) / 2.0f;
+        am_Float v = 60.0f / r > 50.0f ? 50.0f : 60.0f / r;
+        marker = ratio->marker;
+        assert(am_setcoefficient(ratio, h, r) == AM_OK);
+        assert(am_approx(am_value(h), v) && am_approx(am_value(w), r*v));
+        readds += ratio->marker.id != marker.id;
+    }
+    printf("re-added %d of 40\n", readds);
+    assert(readds < 10);
+    am_remove(cap);
+
+    /* >=, a weak pull down, and a term taken out */
+    half = new_constraint(solver, AM_REQUIRED, z, 1.0, AM_GREATEQUAL, 0.0,
+            w, 0.5, END);
+    new_constraint(solver, AM_WEAK, z, 1.0, AM_EQUAL, 0.0, END);
+    assert(am_value(z) == 30.0);
+    assert(am_setcoefficient(half, w, 0.25) == AM_OK && am_value(z) == 15.0);
+    assert(am_setcoefficient(half, w, 0.0) == AM_OK && am_value(z) == 0.0);
+    assert(half->expression.terms.count == 1);
+    assert(am_setcoefficient(half, w, 0.5) == AM_OK && am_value(z) == 30.0);
+
+    /* not added: only the expression changes */
+    am_remove(half);
+    assert(am_setcoefficient(half, w, 1.0) == AM_OK);
+    assert(!am_hasconstraint(half) && am_value(z) == 0.0);
+    assert(am_add(half) == AM_OK && am_value(z) == 60.0);
+
+    /* a variable first brought in by a coefficient is not fresh any more */
+    am_delsolver(solver);
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    w = am_newvariable(solver);
+    h = am_newvariable(solver);
+    ratio = new_constraint(solver, AM_REQUIRED, w, 1.0, AM_EQUAL, 10.0, END);
+    assert(am_setcoefficient(ratio, h, 1.0) == AM_OK);
+    new_constraint(solver, AM_REQUIRED, h, 1.0, AM_EQUAL, 3.0, END);
+    printf("w: %f, h: %f\n", am_value(w), am_value(h));
+    assert(am_value(w) == 13.0 && am_value(h) == 3.0);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void add_keyed(am_Solver *solver, unsigned key, double strength,
+        am_Variable *a, int relation, double constant,
+        am_Variable *b, am_Variable *c)
+{
+    am_Constraint *cons = am_newconstraint(solver, (am_Float)strength);
+    am_setconstraintkey(cons, key);
+    am_addterm(cons, a, 1.0);
+    am_setrelation(cons, relation);
+    am_addconstant(cons, (am_Float)constant);
+    if (b) am_addterm(cons, b, relation == AM_LESSEQUAL ? -1.0 : 1.0);
+    if (c) am_addterm(cons, c, 1.0);
+    assert(am_add(cons) == AM_OK);
+}
+
+/* x[i+1] >= x[i] + w[i] + 5, w[i] >= 10, w[i] == 50, x[n-1] + w[n-1] <= width */
+static void build_basis(am_Solver *solver, am_Variable **x, am_Variable **w,
+        int n, am_Float width)
+{
+    unsigned key = 1;
+    int i;
+    for (i = 0; i < n; ++i) {
+        x[i] = am_newvariable(solver), am_setvariablekey(x[i], key++);
+        w[i] = am_newvariable(solver), am_setvariablekey(w[i], key++);
+    }
+    add_keyed(solver, key++, AM_REQUIRED, x[0], AM_EQUAL, 0.0, NULL, NULL);
+    for (i = 0; i < n; ++i) {
+        add_keyed(solver, key++, AM_REQUIRED, w[i], AM_GREATEQUAL, 10.0,
+                NULL, NULL);
+        add_keyed(solver, key++, AM_WEAK, w[i], AM_EQUAL, 50.0, NULL, NULL);
+        if (i + 1 < n)
+            add_keyed(solver, key++, AM_REQUIRED, x[i+1], AM_GREATEQUAL, 5.0,
+                    x[i], w[i]);
+    }
+    add_keyed(solver, key++, AM_STRONG, x[n-1], AM_LESSEQUAL, width,
+            w[n-1], NULL);
+}
+
+static void test_basis(void) {
+    am_Solver *solver, *warm;
+    am_Variable *x[20], *w[20], *wx[20], *ww[20];
+    am_Hint hints[100];
+    am_Stats cold, hot;
+    int i, count, edits = 0, narrower = 0;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest basis\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    /* the previous frame, solved cold */
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    am_defer(solver, 1);
+    build_basis(solver, x, w, 20, 800.0);
+    assert(am_step(solver, -1));
+    am_stats(solver, &cold);
+    count = am_getbasis(solver, NULL, 0);
+    assert(count > 0 && count < 98);
+    assert(am_getbasis(solver, hints, 2) == count);
+    assert(am_getbasis(solver, hints, 100) == count);
+
+    /* the next frame, a little narrower, picks the same subjects */
+    warm = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(warm, 1);
+    am_defer(warm, 1);
+    assert(am_setbasis(warm, hints, count) == AM_OK);
+    build_basis(warm, wx, ww, 20, 780.0);
+    assert(am_step(warm, -1));
+    am_stats(warm, &hot);
+    printf("pivots: cold %d, warm %d\n", (int)cold.pivots,
+            (int)(hot.pivots + hot.dual_pivots));
+    assert(hot.pivots + hot.dual_pivots < cold.pivots);
+    assert(am_getbasis(warm, NULL, 0) == count);
+    for (i = 0; i < 20; ++i) {
+        if (am_approx(am_value(ww[i]), am_value(w[i]) - 20.0f)) ++narrower;
+        else assert(am_approx(am_value(ww[i]), am_value(w[i])));
+    }
+    assert(narrower == 1);
+    assert(am_approx(am_value(wx[19]) + am_value(ww[19]), 780.0));
+    am_delsolver(warm);
+
+    /* edits carry their own kind; unknown hints are ignored */
+    am_addedit(w[3], AM_MEDIUM);
+    am_suggest(w[3], 5.0);
+    assert(am_step(solver, -1) && am_value(w[3]) == 10.0);
+    count = am_getbasis(solver, hints, 98);
+    for (i = 0; i < count; ++i)
+        edits += hints[i].kind == AM_HINT_EDIT;
+    assert(edits == 1);
+    hints[count].key = 12345, hints[count].kind = AM_HINT_CONS;
+    hints[count+1].key = 7, hints[count+1].kind = 7;
+    warm = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(warm, 1);
+    am_defer(warm, 1);
+    assert(am_setbasis(warm, hints, count+2) == AM_OK);
+    assert(warm->hints.count == (size_t)count); /* one key, two kinds */
+    build_basis(warm, wx, ww, 20, 800.0);
+    am_addedit(ww[3], AM_MEDIUM);
+    am_suggest(ww[3], 5.0);
+    assert(am_step(warm, -1));
+    for (i = 0; i < 20; ++i)
+        assert(am_approx(am_value(wx[i]), am_value(x[i]))
+                && am_approx(am_value(ww[i]), am_value(w[i])));
+    assert(am_setbasis(warm, NULL, 0) == AM_OK);
+    assert(warm->hints.count == 0 && warm->hinted.count == 0);
+
+    am_delsolver(warm);
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_profile(void) {
+    am_Solver *solver;
+    am_Variable *x[20], *w[20];
+    am_Profile top[64];
+    am_Constraint *cap;
+    size_t entered = 0;
+    int i, n;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest profile\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(solver, 1);
+    assert(am_topcosts(solver, top, 4) == 0);
+    am_profile(solver, 1);
+    build_basis(solver, x, w, 20, 800.0);
+
+    /* the width cap squeezes every widget: it did the pivoting */
+    n = am_topcosts(solver, NULL, 0);
+    assert(n == 61 && am_topcosts(solver, top, 64) == n);
+    for (i = 0; i < n; ++i) entered += top[i].entered;
+    assert(entered > 0); /* the weak widths gave way */
+    for (i = 0; i < 4; ++i)
+        printf("%d: %d pivots, %d rows, %d entered\n",
+                (int)am_key(top[i].constraint).id, (int)top[i].pivots,
+                (int)top[i].substitutions, (int)top[i].entered);
+    cap = top[0].constraint;
+    assert(cap->strength == AM_STRONG && cap->relation == AM_LESSEQUAL);
+    assert(top[0].pivots > 0 && top[0].substitutions >= top[0].pivots);
+    for (i = 1; i < n; ++i) assert(top[i].pivots <= top[i-1].pivots);
+
+    /* taking it out is charged to it too, deleting it drops the record */
+    i = (int)top[0].pivots;
+    am_remove(cap);
+    assert(am_topcosts(solver, top, 1) == n && top[0].constraint == cap);
+    assert((int)top[0].pivots > i);
+    am_delconstraint(cap);
+    assert(am_topcosts(solver, top, 4) == n - 1 && top[0].constraint != cap);
+
+    /* off drops everything, on again starts from what is added */
+    am_profile(solver, 0);
+    assert(am_topcosts(solver, top, 4) == 0);
+    am_profile(solver, 1);
+    assert(am_topcosts(solver, top, 4) == n - 1 && top[0].pivots == 0);
+    am_compact(solver);
+    cap = new_constraint(solver, AM_STRONG, x[19], 1.0, AM_LESSEQUAL, 700.0,
+            w[19], -1.0, END);
+    assert(am_topcosts(solver, top, 1) == n && top[0].constraint == cap);
+    assert(am_approx(am_value(x[19]) + am_value(w[19]), 700.0));
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_nested(void) {
+    am_Solver *parent, *child[2];
+    am_Variable *a[2], *b[2], *pref[2], *width[2], *c[2], *w[2], *z;
+    size_t pivots;
+    int i, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest nested\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    /* each child reports its preferred width and gets its share back */
+    parent = am_newsolver(debug_allocf, NULL);
+    am_autoupdate(parent, 1);
+    for (i = 0; i < 2; ++i) {
+        child[i] = am_newsolver(debug_allocf, NULL);
+        am_autoupdate(child[i], 1);
+        assert(am_nest(child[i], parent) == AM_OK);
+        a[i] = am_newvariable(child[i]);
+        b[i] = am_newvariable(child[i]);
+        pref[i] = am_newvariable(child[i]);
+        width[i] = am_newvariable(child[i]);
+        new_constraint(child[i], AM_REQUIRED, pref[i], 1.0, AM_EQUAL, 0.0,
+                a[i], 1.0, b[i], 1.0, END);
+        am_addedit(a[i], AM_STRONG);
+        am_addedit(b[i], AM_STRONG);
+        am_suggest(a[i], i ? 20.0f : 40.0f);
+        am_suggest(b[i], 30.0f);
+        c[i] = am_newvariable(parent);
+        w[i] = am_newvariable(parent);
+        new_constraint(parent, AM_REQUIRED, w[i], 1.0, AM_EQUAL, 0.0,
+                c[i], 1.0, END);
+    }
+    new_constraint(parent, AM_REQUIRED, c[0], 1.0, AM_LESSEQUAL, 150.0,
+            c[1], -1.0, END);
+    assert(am_link(pref[0], c[0], AM_MEDIUM) == AM_OK);
+    assert(am_link(pref[1], c[1], AM_STRONG) == AM_OK);
+    assert(am_link(w[0], width[0], AM_STRONG) == AM_OK);
+    assert(am_link(w[1], width[1], AM_STRONG) == AM_OK);
+    assert(am_value(width[0]) == 70.0f && am_value(width[1]) == 50.0f);
+
+    /* not parent and child, taken, or a cycle */
+    assert(am_link(pref[0], a[1], AM_STRONG) == AM_FAILED);
+    assert(am_link(pref[0], c[0], AM_STRONG) == AM_FAILED);
+    assert(am_nest(parent, child[0]) == AM_FAILED);
+    assert(am_nest(parent, parent) == AM_FAILED);
+    assert(am_nest(child[0], parent) == AM_OK);
+
+    /* a growing child squeezes its weaker sibling */
+    am_suggest(a[1], 60.0f);
+    assert(am_propagate(child[1]) == 3);
+    printf("width: %f, %f\n", am_value(width[0]), am_value(width[1]));
+    assert(am_value(width[0]) == 60.0f && am_value(width[1]) == 90.0f);
+    assert(am_propagate(child[1]) == 0);
+
+    /* changes inside a child stay there */
+    z = am_newvariable(child[0]);
+    am_addedit(z, AM_STRONG);
+    am_suggest(z, 5.0f);
+    pivots = parent->pivots + parent->dual_pivots;
+    assert(am_propagate(child[0]) == 0);
+    assert(parent->pivots + parent->dual_pivots == pivots);
+
+    /* a dropped edit is restored, an unlinked one stays dropped */
+    am_deledit(c[0]);
+    am_suggest(a[0], 30.0f);
+    assert(am_propagate(child[0]) == 1 && am_hasedit(c[0]));
+    assert(am_value(width[0]) == 60.0f);
+    am_unlink(pref[0], c[0]);
+    assert(!am_hasedit(c[0]) && am_propagate(child[0]) == 0);
+    assert(am_link(pref[0], c[0], AM_MEDIUM) == AM_OK);
+
+    /* a deleted child takes its links along, and its space */
+    am_suggest(a[0], 60.0f);
+    assert(am_propagate(child[0]) == 1 && am_value(width[0]) == 60.0f);
+    am_delsolver(child[1]);
+    assert(!am_hasedit(c[1]) && parent->children == child[0]);
+    assert(am_propagate(parent) == 1 && am_value(width[0]) == 90.0f);
+    printf("width: %f\n", am_value(width[0]));
+
+    am_delvariable(z);
+    am_delsolver(parent);
+    assert(child[0]->parent == NULL && child[0]->links == NULL);
+    assert(!am_hasedit(width[0]));
+    am_delsolver(child[0]);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static void test_release(void) {
+    am_Solver *solver;
+    am_Variable *a, *b;
+    am_Constraint *c;
+    int ret = setjmp(jbuf);
+    printf("\n\n==========\ntest release\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    /* a variable freed by its last constraint while still dirty */
+    solver = am_newsolver(debug_allocf, NULL);
+    a = am_newvariable(solver);
+    b = am_newvariable(solver);
+    c = new_constraint(solver, AM_REQUIRED, a, 1.0, AM_EQUAL, 10.0,
+            b, -1.0, END);
+    am_delvariable(a);
+    am_delconstraint(c);
+    am_updatevars(solver);
+    printf("b: %f\n", am_value(b));
+    assert(solver->dirty_vars.id == 0);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
+static am_Variable *parse_vars[4];
+
+static am_Variable *resolve(void *ud, const char *name, size_t len) {
+    static const char *names[] = { "xl", "xm", "xr", "w.min" };
+    int i;
+    (void)ud;
+    for (i = 0; i < 4; ++i)
+        if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0)
+            return parse_vars[i];
+    return NULL;
+}
+
+static void test_parse(void) {
+    am_Solver *solver;
+    am_Variable *xl, *xm, *xr;
+    am_Constraint *parsed[8];
+    am_Stats stats;
+    const char *errpos = NULL;
+    const char *bad = "xl >= 0\nxl + <= 3";
+    int i, ret = setjmp(jbuf);
+    printf("\n\n==========\ntest parse\n");
+    printf("ret = %d\n", ret);
+    if (ret < 0) { perror("setjmp"); return; }
+    else if (ret != 0) { printf("out of memory!\n"); return; }
+
+    solver = am_newsolver(debug_allocf, NULL);
+    for (i = 0; i < 4; ++i) parse_vars[i] = am_newvariable(solver);
+    xl = parse_vars[0], xm = parse_vars[1], xr = parse_vars[2];
+
+    ret = am_parse(solver,
+            "# a window\n"
+            "xl >= 0; xr <= 100\n"
+            "xm * 2 == xl + xr   # centered\n"
+            "xl + w.min <= xr; w.min == 10\n"
+            "\n"
+            "xm == 20 | weak\n"
+            "-(xl - 2*(xr/4)) <= 100 | strong\n"
+            "xl >= 5 | 0.5\n", resolve, NULL, NULL);
+    assert(ret == AM_OK);
+    am_updatevars(solver);
+    printf("xl: %f, xm: %f, xr: %f\n", am_value(xl), am_value(xm), am_value(xr));
+    assert(am_value(xm) == 20.0 && am_value(xl) + am_value(xr) == 40.0);
+    assert(am_value(xr) - am_value(xl) >= 10.0);
+    am_stats(solver, &stats);
+    assert(stats.constraints == 8);
+
+    /* what the text made, in text order */
+    assert(am_parsed(solver, parsed, 8) == 8);
+    assert(parsed[0]->relation == AM_GREATEQUAL && parsed[7]->strength == 0.5);
+    am_delconstraint(parsed[7]);
+    assert(am_parsed(solver, parsed, 2) == 7 && parsed[1]->relation == AM_LESSEQUAL);
+    assert(am_parse(solver, "xl >= 5 | 0.5", resolve, NULL, NULL) == AM_OK);
+    assert(am_parsed(solver, parsed, 8) == 1 && parsed[0]->strength == 0.5);
+
+    /* a bad statement drops the whole text */
+    assert(am_parse(solver, bad, resolve, NULL, &errpos) == AM_FAILED);
+    assert(errpos == bad + 8);
+    assert(am_parse(solver, "xl >= 0\nxm >= unknown", resolve, NULL, NULL)
+            == AM_FAILED);
+    assert(am_parse(solver, "xl == 1 | heavy", resolve, NULL, NULL) == AM_FAILED);
+    assert(am_parse(solver, "xl / xr == 1", resolve, NULL, NULL) == AM_FAILED);
+    assert(am_parse(solver, "(xl + 1 == 1", resolve, NULL, NULL) == AM_FAILED);
+    assert(am_parse(solver, "xr >= 0\nxl >= 200", resolve, NULL, NULL)
+            != AM_OK);
+    assert(am_parsed(solver, parsed, 8) == 0);
+    am_stats(solver, &stats);
+    assert(stats.constraints == 8);
+    am_updatevars(solver);
+    assert(am_value(xm) == 20.0);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    printf("maxmem = %d\n", (int)maxmem);
+    assert(allmem == 0);
+    maxmem = 0;
+}
+
 static void test_suggest(void) {
 #if 1
     /* This should be valid but fails the (enter.id != 0) assertion in am_dual_optimize() */
@@ -730,13 +1919,155 @@ void test_cycling() {
     }
 }
 
+#ifdef AM_STATIC_CAPACITY
+static am_Solver fixed; /* no allocf at all */
+
+/* every allocation overflows until unpoison(); what is freed meanwhile
+ * stays unused */
+static size_t saved_used;
+static void  *saved_freed[AM_ARENACLASSES];
+static am_Arena saved_arena;
+
+static void poison(am_Solver *solver) {
+    am_Chunk *c = solver->arena.chunks;
+    saved_used = solver->heap_used, saved_arena = solver->arena;
+    memcpy(saved_freed, solver->heap_freed, sizeof(saved_freed));
+    solver->heap_used = sizeof(solver->heap);
+    memset(solver->heap_freed, 0, sizeof(solver->heap_freed));
+    while (c != NULL && c->next != NULL) c = c->next;
+    solver->arena.current = c, solver->arena.used = c ? c->size : 0;
+    memset(solver->arena.freed, 0, sizeof(solver->arena.freed));
+}
+
+static void unpoison(am_Solver *solver) {
+    solver->heap_used = saved_used, solver->arena = saved_arena;
+    memcpy(solver->heap_freed, saved_freed, sizeof(saved_freed));
+}
+
+static void test_overflow(void) {
+    static am_Variable *vars[AM_STATIC_CAPACITY];
+    am_Solver *solver = am_initsolver(&fixed);
+    am_Constraint *cons, *chain[11];
+    am_Variable **v;
+    size_t mem = allmem;
+    int i, n, vcount, ret = AM_OK;
+    printf("\n\n==========\ntest overflow\n");
+
+    /* variables */
+    for (n = 0; n < AM_STATIC_CAPACITY; ++n)
+        assert((vars[n] = am_newvariable(solver)) != NULL);
+    assert(am_newvariable(solver) == NULL);
+    assert(am_error(solver) == AM_OVERFLOW);
+    cons = am_newconstraint(solver, AM_REQUIRED);
+    assert(cons == NULL && am_addedit(vars[0], AM_STRONG) == AM_OVERFLOW);
+    am_resetsolver(solver, 1);
+    assert(am_error(solver) == AM_OK);
+
+    /* rows: distinct constants keep them from being shared */
+    for (i = 0; ret == AM_OK; ++i) {
+        cons = am_newconstraint(solver, AM_REQUIRED);
+        if (cons == NULL) { ret = am_error(solver); break; }
+        am_addterm(cons, vars[i % n], 1.0);
+        am_setrelation(cons, AM_LESSEQUAL);
+        am_addconstant(cons, (am_Float)i);
+        ret = am_add(cons);
+    }
+    printf("overflow after %d constraints, %d rows\n",
+            i, (int)solver->rows.count);
+    assert(ret == AM_OVERFLOW && am_error(solver) == AM_OVERFLOW);
+    assert(am_add(cons) == AM_OVERFLOW);
+    am_delconstraint(cons); /* deletes still work */
+    am_resetsolver(solver, 1);
+    assert(am_error(solver) == AM_OK && solver->rows.count == 0);
+
+    /* usable again */
+    for (i = 2; i < n; ++i) am_delvariable(vars[i]);
+    cons = new_constraint(solver, AM_REQUIRED, vars[0], 1.0, AM_EQUAL, 10.0,
+            vars[1], 2.0, END);
+    assert(cons != NULL);
+    am_addedit(vars[1], AM_STRONG);
+    am_suggest(vars[1], 4.0);
+    am_updatevars(solver);
+    printf("x: %f, y: %f\n", am_value(vars[0]), am_value(vars[1]));
+    assert(am_value(vars[0]) == 18.0 && am_value(vars[1]) == 4.0);
+
+    am_delsolver(solver);
+
+    /* overflow inside a delete: it finishes, and releases only once */
+    solver = am_initsolver(&fixed);
+    n = AM_DENSE_MAX + 12; /* hashed rows grow, so pivots allocate */
+    for (i = 0; i < n; ++i) vars[i] = am_newvariable(solver);
+    v = vars + n - 12;
+    for (i = 0; i < 11; ++i)
+        chain[i] = new_constraint(solver, i % 2 ? AM_REQUIRED : AM_STRONG,
+                v[i+1], 1.0, AM_GREATEQUAL, 10.0, v[i], 1.0, END);
+    am_addedit(v[5], AM_STRONG);
+    am_suggest(v[5], 42.0);
+    am_addedit(v[0], AM_MEDIUM);
+    am_suggest(v[0], 7.0);
+    am_updatevars(solver);
+    assert(am_error(solver) == AM_OK && am_value(v[11]) == 102.0);
+    assert(v[5]->refcount == 4 && v[0]->refcount == 3);
+
+    poison(solver);
+    am_deledit(v[5]);
+    printf("deledit under overflow: %d\n", am_error(solver));
+    assert(am_error(solver) == AM_OVERFLOW);
+    assert(v[5]->constraint == NULL && v[5]->refcount == 3);
+    am_delconstraint(chain[5]); /* sticky: forgets the rows */
+    assert(v[5]->refcount == 2 && v[6]->refcount == 2);
+    am_deledit(v[0]);
+    assert(v[0]->constraint == NULL && v[0]->refcount == 2);
+    vcount = (int)solver->vars.count;
+    am_delvariable(v[5]);
+    am_delconstraint(chain[4]);
+    assert((int)solver->vars.count == vcount - 1);
+    assert(am_step(solver, -1) == 0); /* never "solved" while sticky */
+    unpoison(solver);
+
+    am_resetsolver(solver, 1);
+    assert(am_error(solver) == AM_OK && solver->rows.count == 0);
+    cons = new_constraint(solver, AM_REQUIRED, v[11], 1.0, AM_EQUAL,
+            5.0, v[0], 1.0, END);
+    am_suggest(v[0], 1.0);
+    am_updatevars(solver);
+    assert(cons != NULL && am_value(v[11]) == 6.0);
+
+    am_delsolver(solver);
+    printf("allmem = %d\n", (int)allmem);
+    assert(allmem == mem);
+}
+#endif /* AM_STATIC_CAPACITY */
+
 int main(void) {
     test_binarytree();
     test_unbounded();
     test_strength();
+    test_required();
+    test_coefficient();
+    test_basis();
+    test_profile();
+    test_nested();
     test_suggest();
     test_cycling();
+    test_reset();
+    test_edits();
+    test_suggestmany();
+    test_release();
+    test_parse();
+    test_dedup();
+    test_compact();
+    test_dense();
+    test_step();
+    test_dualpolicy();
+    test_lazy();
+    test_solveall();
+    test_publish();
+    test_trace();
     test_all();
+#ifdef AM_STATIC_CAPACITY
+    test_overflow();
+#endif
     return 0;
 }
 
@@ -0,0 +1,88 @@
+#define AM_IMPLEMENTATION
+#include "amoeba.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t allmem = 0;
+
+static void *debug_allocf(void *ud, void *ptr, size_t ns, size_t os) {
+    void *newptr = NULL;
+    (void)ud;
+    allmem += ns;
+    allmem -= os;
+    if (ns == 0) free(ptr);
+    else newptr = realloc(ptr, ns);
+    return newptr;
+}
+
+static void test_expression(void) {
+    printf("\n\n==========\ntest expression\n");
+    {
+        amoeba::Solver solver(debug_allocf);
+        amoeba::Variable xl(solver), xm(solver), xr(solver);
+        amoeba::Constraint c1(solver, xl >= 0);
+        amoeba::Constraint c2(solver, xr <= 100);
+        amoeba::Constraint c3(solver, xm*2 == xl + xr);
+        amoeba::Constraint c4(solver, xl + 10 <= xr);
+        amoeba::Constraint c5(solver, -(xl - xr*3)/2 + 1 >= 5 - xm, AM_STRONG);
+        amoeba::Constraint c6(solver, xm == 40, AM_WEAK);
+        assert(solver.add(c1) == AM_OK && solver.add(c2) == AM_OK);
+        assert(solver.add(c3) == AM_OK && solver.add(c4) == AM_OK);
+        assert(solver.add(c5) == AM_OK && solver.add(c6) == AM_OK);
+        solver.updatevars();
+        printf("xl: %f, xm: %f, xr: %f\n", xl.value(), xm.value(), xr.value());
+        assert(xm.value() == 40.0 && xl.value() + xr.value() == 80.0);
+
+        /* handles move, the solver keeps one reference */
+        amoeba::Constraint moved(std::move(c6));
+        assert(c6.get() == NULL && moved.added());
+        solver.remove(moved);
+        assert(!moved.added());
+
+        solver.addedit(xm);
+        solver.suggest(xm, 60.0);
+        solver.updatevars();
+        printf("xl: %f, xm: %f, xr: %f\n", xl.value(), xm.value(), xr.value());
+        assert(xm.value() == 60.0 && xl.value() + xr.value() == 120.0);
+        solver.deledit(xm);
+    }
+    printf("allmem = %d\n", (int)allmem);
+    assert(allmem == 0);
+}
+
+static void test_terms(void) {
+    printf("\n\n==========\ntest terms\n");
+    {
+        amoeba::Solver solver(debug_allocf);
+        amoeba::Variable x(solver), y(solver);
+        amoeba::Solver other(debug_allocf);
+        amoeba::Variable z(other);
+        am_Variable *vars[2] = { x.get(), y.get() };
+        am_Variable *bad[2] = { x.get(), z.get() };
+        am_Float ms[2] = { 1.0, 2.0 };
+        amoeba::Constraint c(solver);
+
+        /* one call for the whole row, all or nothing */
+        assert(am_addterms(c.get(), bad, ms, 2) == AM_FAILED);
+        assert(am_addterms(c.get(), vars, ms, 2) == AM_OK);
+        am_setrelation(c.get(), AM_EQUAL);
+        am_addconstant(c.get(), 12.0);
+        amoeba::Constraint d(solver, x == y);
+        assert(solver.add(c) == AM_OK && solver.add(d) == AM_OK);
+        solver.updatevars();
+        printf("x: %f, y: %f\n", x.value(), y.value());
+        assert(x.value() == 4.0 && y.value() == 4.0);
+    }
+    printf("allmem = %d\n", (int)allmem);
+    assert(allmem == 0);
+}
+
+int main(void) {
+    test_expression();
+    test_terms();
+    return 0;
+}
+
+/* cc: flags='-Wall -Wextra -std=c++11' output='testcpp' */
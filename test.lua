@@ -47,3 +47,62 @@ print(xl)
 print(xm)
 print(xr)
 
+
+print('suggest xl to 20 and xm to 50')
+S:suggestmany { [xl] = 20, xm = 50 }
+print(table.concat(S:values { xl, xm, xr }, ", "))
+
+print('load a layout from text')
+local S2 = amoeba.new()
+local v, c = S2:load [[
+   left >= 0; right <= 100   # the window
+   left + 10 <= right
+   mid * 2 == left + right
+   mid == 30 | strong
+]]
+print(v.left:value(), v.mid:value(), v.right:value())
+collectgarbage()
+assert(#c == 5 and v.mid:value() == 30)
+S2:delconstraint(c[5]) -- loaded constraints can be taken out again
+c[5]:delete()
+print(v.left:value(), v.mid:value(), v.right:value())
+
+print('drag x1 to -500 without blocking, a few pivots per frame')
+local S3 = amoeba.new()
+local x = { S3:var "x1" }
+S3:addedit(x[1], "strong")
+for i = 2, 20 do
+   x[i] = S3:var("x"..i)
+   S3:addconstraint(x[i]:ge(x[i-1] + 10))
+   S3:addconstraint(x[i]:eq(0):strength "weak")
+end
+local solve = coroutine.wrap(function()
+   S3:suggest(x[1], -500, { defer = true })
+   while not S3:solve_step(2) do coroutine.yield(false) end
+   return true
+end)
+local frames = 1
+while not solve() do frames = frames + 1 end
+print(frames, x[1]:value(), x[2]:value(), x[20]:value())
+
+print('animate an aspect ratio: w == r*h, r from 1 to 2')
+local S4 = amoeba.new()
+local w, h = S4:var "w", S4:var "h"
+local ratio = w:eq(h * 1)
+S4:addconstraint(ratio)
+S4:addedit(h, "strong")
+S4:suggest(h, 40)
+for r = 1, 2, 0.25 do ratio:coefficient(h, r) end
+print(w:value(), h:value())
+assert(w:value() == 80 and h:value() == 40)
+
+print('expressions keep their variables alive')
+local S5 = amoeba.new()
+local e = S5:var("x")*2 + 1
+S5:var "a"; S5:var "b"
+local e2 = S5:var "a" + "b"
+collectgarbage()
+S5:addconstraint(e:eq(5))
+S5:addconstraint(e2:eq(e))
+print(S5:var "x":value(), e2)
+assert(S5:var "x":value() == 2)